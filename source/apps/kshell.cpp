@@ -2,6 +2,8 @@
 
 #include <drivers/display/terminal/terminal.hpp>
 #include <system/sched/scheduler/scheduler.hpp>
+#include <system/cpu/syscall/syscall.hpp>
+#include <system/cpu/syscall/trace.hpp>
 #include <drivers/fs/devfs/dev/tty.hpp>
 #include <system/sched/rtc/rtc.hpp>
 #include <system/sched/pit/pit.hpp>
@@ -14,6 +16,8 @@
 #include <lib/memory.hpp>
 #include <lib/timer.hpp>
 #include <lib/alloc.hpp>
+#include <lib/ring.hpp>
+#include <lib/cpu.hpp>
 #include <lib/log.hpp>
 #include <lib/io.hpp>
 #include <cwalk.h>
@@ -22,6 +26,7 @@ using namespace kernel::drivers::display;
 using namespace kernel::drivers::fs::dev;
 using namespace kernel::drivers;
 using namespace kernel::system::sched;
+using namespace kernel::system::cpu;
 using namespace kernel::system::mm;
 using namespace kernel::system;
 
@@ -29,6 +34,114 @@ namespace kernel::apps::kshell {
 
 vfs::fs_node_t *current_path = nullptr;
 
+static void systrace(std::string arg)
+{
+    const char *command = arg.c_str();
+    if (!strcmp(command, "on")) syscall::trace::enable(syscall::trace::trace_counters);
+    else if (!strcmp(command, "events")) syscall::trace::enable(syscall::trace::trace_counters | syscall::trace::trace_events);
+    else if (!strcmp(command, "off")) syscall::trace::disable();
+    else if (!strcmp(command, "reset")) syscall::trace::reset();
+    else if (!strncmp(command, "pid ", 4)) syscall::trace::filter = atoi(command + 4);
+    else
+    {
+        size_t len = syscall::trace::report(nullptr, 0);
+        char *text = new char[len + 1];
+        syscall::trace::report(text, len + 1);
+        printf("%s", text);
+        delete[] text;
+    }
+}
+
+static void syscallbench()
+{
+    static constexpr size_t iterations = 100000;
+    registers_t frame { };
+
+    uint64_t start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        frame.rax = syscall::SYSCALL_GETPID;
+        syscall::dispatch(&frame);
+    }
+    uint64_t table = (rdtsc() - start) / iterations;
+
+    start = rdtsc();
+    for (size_t i = 0; i < iterations; i++) syscall::syscall_i(syscall::SYSCALL_GETPID);
+    uint64_t interrupt = (rdtsc() - start) / iterations;
+
+    printf("TSC cycles per null syscall (getpid, %zu iterations):\n", iterations);
+    printf("table dispatch: %4lu\n", table);
+    printf("int 0x69:       %4lu\n", interrupt);
+}
+
+static void ringbench()
+{
+    static constexpr size_t iterations = 1000000;
+    static constexpr size_t batch = 64;
+    char items[batch] = { 0 };
+
+    auto locked = new ringbuffer<char>(1024);
+    auto spsc = new spsc_ring<char, 1024>;
+    auto mpmc = new mpmc_ring<char, 1024>;
+
+    uint64_t start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        locked->put(i);
+        locked->get();
+    }
+    uint64_t locked_single = (rdtsc() - start) / iterations;
+
+    start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        spsc->push(i);
+        spsc->pop(items[0]);
+    }
+    uint64_t spsc_single = (rdtsc() - start) / iterations;
+
+    start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        mpmc->push(i);
+        mpmc->pop(items[0]);
+    }
+    uint64_t mpmc_single = (rdtsc() - start) / iterations;
+
+    start = rdtsc();
+    for (size_t i = 0; i < iterations / batch; i++)
+    {
+        locked->write_n(items, batch);
+        locked->read_n(items, batch);
+    }
+    uint64_t locked_batch = (rdtsc() - start) / iterations;
+
+    start = rdtsc();
+    for (size_t i = 0; i < iterations / batch; i++)
+    {
+        spsc->push_n(items, batch);
+        spsc->pop_n(items, batch);
+    }
+    uint64_t spsc_batch = (rdtsc() - start) / iterations;
+
+    start = rdtsc();
+    for (size_t i = 0; i < iterations / batch; i++)
+    {
+        mpmc->push_n(items, batch);
+        mpmc->pop_n(items, batch);
+    }
+    uint64_t mpmc_batch = (rdtsc() - start) / iterations;
+
+    printf("TSC cycles per put+get (%zu items, batch of %zu):\n", iterations, batch);
+    printf("ringbuffer: %4lu single, %4lu batched\n", locked_single, locked_batch);
+    printf("spsc_ring:  %4lu single, %4lu batched\n", spsc_single, spsc_batch);
+    printf("mpmc_ring:  %4lu single, %4lu batched\n", mpmc_single, mpmc_batch);
+
+    delete locked;
+    delete spsc;
+    delete mpmc;
+}
+
 void parse(std::string cmd, std::string arg)
 {
     if (cmd.empty()) return;
@@ -46,6 +159,9 @@ void parse(std::string cmd, std::string arg)
             printf("- timef -- Get current RTC time (Forever loop)\n");
             printf("- tick -- Get current PIT tick\n");
             printf("- pci -- List PCI devices\n");
+            printf("- ringbench -- Benchmark ring buffers\n");
+            printf("- syscallbench -- Benchmark null syscall round-trip\n");
+            printf("- systrace -- Show syscall statistics (on, events, off, reset, pid <pid>)\n");
             printf("- crash -- Crash whole system\n");
             printf("- reboot -- Reboot the system\n");
             printf("- poweroff -- Shutdown the system\n");
@@ -68,6 +184,7 @@ void parse(std::string cmd, std::string arg)
                 printf("%s\n", arg.c_str());
                 break;
             }
+            node->populate();
 
             for (vfs::fs_node_t *child : node->children)
             {
@@ -198,6 +315,15 @@ void parse(std::string cmd, std::string arg)
                     pci::devices[i]->devicestr.c_str());
             }
             break;
+        case hash("ringbench"):
+            ringbench();
+            break;
+        case hash("syscallbench"):
+            syscallbench();
+            break;
+        case hash("systrace"):
+            systrace(arg);
+            break;
         case hash("crash"):
         {
             vfs::fs_node_t *node = vfs::get_node(current_path, "/bin/crash");
@@ -1,6 +1,7 @@
 // Copyright (C) 2021-2022  ilobilo
 
 #include <drivers/block/ahci/ahci.hpp>
+#include <system/boot/timing.hpp>
 #include <system/mm/pmm/pmm.hpp>
 #include <lib/shared_ptr.hpp>
 #include <lib/memory.hpp>
@@ -61,7 +62,7 @@ size_t AHCIPort::findSlot()
     return -1;
 }
 
-bool AHCIPort::rw(uint64_t sector, uint32_t sectorCount, uint8_t *buffer, bool write)
+bool AHCIPort::rw(uint64_t sector, uint32_t sectorCount, sgentry *entries, size_t count, bool write)
 {
     if (this->portType == AHCIPortType::SATAPI && write)
     {
@@ -90,26 +91,18 @@ bool AHCIPort::rw(uint64_t sector, uint32_t sectorCount, uint8_t *buffer, bool w
 
     cmdHdr->PRDBCount = 0;
     cmdHdr->PortMultiplier = 0;
-    cmdHdr->PRDTLength = static_cast<uint16_t>((sectorCount - 1) >> 4) + 1;
+    cmdHdr->PRDTLength = count;
 
     HBACommandTable *cmdtable = reinterpret_cast<HBACommandTable*>(cmdHdr->CommandTableBaseAddress | static_cast<uint64_t>(cmdHdr->CommandTableBaseAddressUpper) << 32);
-    memset(cmdtable, 0, sizeof(HBACommandTable) + (cmdHdr->PRDTLength - 1) * sizeof(HBAPRDTEntry));
+    memset(cmdtable, 0, sizeof(HBACommandTable) + count * sizeof(HBAPRDTEntry));
 
-    size_t i = 0;
-    for (; i < cmdHdr->PRDTLength - 1; i++)
+    for (size_t i = 0; i < count; i++)
     {
-        cmdtable->PRDTEntry[i].DataBaseAddress = static_cast<uint32_t>(reinterpret_cast<uint64_t>(buffer));
-        cmdtable->PRDTEntry[i].DataBaseAddressUpper = static_cast<uint32_t>(reinterpret_cast<uint64_t>(buffer) << 32);
-        cmdtable->PRDTEntry[i].ByteCount = 0x2000 - 1;
-        cmdtable->PRDTEntry[i].InterruptOnCompletion = 1;
-        buffer += 0x1000;
-        sectorCount -= 16;
+        cmdtable->PRDTEntry[i].DataBaseAddress = static_cast<uint32_t>(entries[i].phys);
+        cmdtable->PRDTEntry[i].DataBaseAddressUpper = static_cast<uint32_t>(entries[i].phys >> 32);
+        cmdtable->PRDTEntry[i].ByteCount = entries[i].size - 1;
+        cmdtable->PRDTEntry[i].InterruptOnCompletion = (i == count - 1);
     }
-
-    cmdtable->PRDTEntry[i].DataBaseAddress = static_cast<uint32_t>(reinterpret_cast<uint64_t>(buffer));
-    cmdtable->PRDTEntry[i].DataBaseAddressUpper = static_cast<uint32_t>(reinterpret_cast<uint64_t>(buffer) << 32);
-    cmdtable->PRDTEntry[i].ByteCount = (sectorCount << 9) - 1;
-    cmdtable->PRDTEntry[i].InterruptOnCompletion = 1;
     // if (this->portType == SATAPI)
     // {
     //     cmdtable->ATAPICommand[0] = ATAPI_CMD_READ;
@@ -174,6 +167,29 @@ bool AHCIPort::rw(uint64_t sector, uint32_t sectorCount, uint8_t *buffer, bool w
     return true;
 }
 
+bool AHCIPort::transfer(uint64_t sector, uint64_t count, sglist &list, bool write)
+{
+    sgentry entries[AHCI_PRDT_ENTRIES];
+    sgcursor cursor;
+
+    while (count > 0)
+    {
+        uint64_t max = (count > AHCI_MAX_SECTORS ? AHCI_MAX_SECTORS : count) * this->stat.blksize;
+        size_t num = list.gather(cursor, entries, AHCI_PRDT_ENTRIES, max, AHCI_PRDT_MAX_BYTES, 0, this->stat.blksize);
+
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < num; i++) bytes += entries[i].size;
+        if (bytes == 0) return false;
+
+        uint32_t sectorCount = bytes / this->stat.blksize;
+        if (!this->rw(sector, sectorCount, entries, num, write)) return false;
+
+        sector += sectorCount;
+        count -= sectorCount;
+    }
+    return true;
+}
+
 bool AHCIPort::identify()
 {
     switch (this->hbaport->Signature)
@@ -303,9 +319,8 @@ AHCIPort::AHCIPort(HBAPort *hbaport, size_t portNum)
     HBACommandHeader *commandHdr = reinterpret_cast<HBACommandHeader*>(this->hbaport->CommandListBase + (static_cast<uint64_t>(this->hbaport->CommandListBaseUpper) << 32));
     for (size_t i = 0; i < 32; i++)
     {
-        commandHdr[i].PRDTLength = 8;
-        void *cmdTableAddr = malloc(256);
-        uint64_t address = reinterpret_cast<uint64_t>(cmdTableAddr) + (i << 8);
+        commandHdr[i].PRDTLength = AHCI_PRDT_ENTRIES;
+        uint64_t address = pmm::alloc<uint64_t>();
         commandHdr[i].CommandTableBaseAddress = static_cast<uint32_t>(address);
         commandHdr[i].CommandTableBaseAddressUpper = static_cast<uint32_t>(static_cast<uint64_t>(address) >> 32);
     }
@@ -506,7 +521,9 @@ void init()
     devices.init(count);
     for (size_t i = 0; i < count; i++)
     {
+        size_t event = boot::event_begin("AHCI controller probe");
         devices.push_back(new AHCIController(pci::search(0x01, 0x06, 0x01, i)));
+        boot::event_end(event);
         if (devices.front()->initialised == false)
         {
             free(devices.front());
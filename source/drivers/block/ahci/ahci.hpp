@@ -14,6 +14,10 @@ using namespace kernel::system;
 
 namespace kernel::drivers::block::ahci {
 
+static constexpr size_t AHCI_PRDT_ENTRIES = 64;
+static constexpr uint64_t AHCI_PRDT_MAX_BYTES = 0x400000;
+static constexpr uint32_t AHCI_MAX_SECTORS = 0x8000;
+
 enum status
 {
     ATA_DEV_BUSY = 0x80,
@@ -320,7 +324,7 @@ class AHCIPort : public drivemgr::Drive
     void startCMD();
 
     size_t findSlot();
-    bool rw(uint64_t sector, uint32_t sectorCount, uint8_t *buffer, bool write);
+    bool rw(uint64_t sector, uint32_t sectorCount, sgentry *entries, size_t count, bool write);
     bool identify();
 
     public:
@@ -330,53 +334,7 @@ class AHCIPort : public drivemgr::Drive
 
     void irq_handler();
 
-    int64_t read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
-    {
-        if (offset % this->stat.blksize || size % this->stat.blksize)
-        {
-            errno_set(EIO);
-            return -1;
-        }
-
-        uint64_t start = offset / this->stat.blksize;
-        uint64_t count = size / this->stat.blksize;
-        uint8_t *abuffer = pmm::alloc<uint8_t*>(count) + hhdm_offset;
-
-        if (!this->rw(start, count, abuffer, false))
-        {
-            errno_set(EIO);
-            pmm::free(abuffer - hhdm_offset);
-            return -1;
-        }
-        memcpy(buffer, abuffer, size);
-
-        pmm::free(abuffer - hhdm_offset);
-        return size;
-    }
-
-    int64_t write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
-    {
-        if (offset % this->stat.blksize || size % this->stat.blksize)
-        {
-            errno_set(EIO);
-            return -1;
-        }
-
-        uint64_t start = offset / this->stat.blksize;
-        uint64_t count = size / this->stat.blksize;
-        uint8_t *abuffer = pmm::alloc<uint8_t*>(count) + hhdm_offset;
-
-        memcpy(abuffer, buffer, size);
-        if (!this->rw(start, count, abuffer, true))
-        {
-            errno_set(EIO);
-            pmm::free(abuffer - hhdm_offset);
-            return -1;
-        }
-
-        pmm::free(abuffer - hhdm_offset);
-        return size;
-    }
+    bool transfer(uint64_t sector, uint64_t count, sglist &list, bool write);
 
     int ioctl(void *handle, uint64_t request, void *argp)
     {
@@ -1,10 +1,14 @@
 // Copyright (C) 2021-2022  ilobilo
 
 #include <drivers/block/ata/ata.hpp>
+#include <system/boot/timing.hpp>
+#include <system/cpu/idt/idt.hpp>
 #include <system/mm/pmm/pmm.hpp>
+#include <system/vdso/vdso.hpp>
 #include <lib/memory.hpp>
 #include <lib/log.hpp>
 
+using namespace kernel::system::cpu;
 using namespace kernel::system::mm;
 
 namespace kernel::drivers::block::ata {
@@ -38,20 +42,172 @@ uint32_t ATAPort::inlcmd(uint8_t offset)
     return inl(this->port + offset);
 }
 
-bool ATAPort::rw(uint64_t sector, uint32_t sectorCount, bool write)
+static void ATA_ChannelHandler(registers_t *regs, uint64_t addr)
 {
-    if (this->initialised == false) return false;
-    lockit(this->lock);
+    reinterpret_cast<ATAChannel*>(addr)->reap();
+}
+
+static void ATA_ControllerHandler(registers_t *regs, uint64_t addr)
+{
+    auto device = reinterpret_cast<ATAController*>(addr);
+    for (auto channel : device->channels) if (channel) channel->reap();
+}
+
+ATAChannel::ATAChannel(uint16_t port, uint16_t ctrlport, uint16_t bmport)
+{
+    this->port = port;
+    this->ctrlport = ctrlport;
+    this->bmport = bmport;
+    this->prdt = pmm::alloc<uint64_t*>();
+}
+
+// wait() may sleep, so a transfer owns the channel through a flag rather than the spinlock
+void ATAChannel::acquire()
+{
+    scheduler::thread_t *thread = this->irq ? this_thread() : nullptr;
+    while (true)
+    {
+        this->lock.lock();
+        if (this->busy == false)
+        {
+            this->busy = true;
+            this->lock.unlock();
+            return;
+        }
+        if (thread != nullptr) this->owners.add(thread);
+        this->lock.unlock();
+
+        if (thread == nullptr)
+        {
+            asm volatile ("pause");
+            continue;
+        }
+        if (this->busy) thread->block();
+        this->owners.remove(thread);
+    }
+}
+
+void ATAChannel::release()
+{
+    this->lock.lock();
+    this->busy = false;
+    this->lock.unlock();
+    this->owners.wake();
+}
+
+void ATAChannel::start(bool write)
+{
+    this->done = false;
+    this->active = true;
+    outb(this->bmport + ATA_BMR_CMD, (write ? 0x00 : 0x08) | 0x01);
+}
+
+void ATAChannel::reap()
+{
+    if (__atomic_test_and_set(&this->reaping, __ATOMIC_ACQUIRE)) return;
+
+    uint8_t bmstatus = inb(this->bmport + ATA_BMR_STATUS);
+    if (bmstatus & ATA_BMR_STATUS_IRQ)
+    {
+        uint8_t status = inb(this->port + ATA_REGISTER_STATUS);
+        if (!(status & ATA_DEV_BUSY))
+        {
+            outb(this->bmport + ATA_BMR_STATUS, bmstatus | ATA_BMR_STATUS_IRQ | ATA_BMR_STATUS_ERROR);
+
+            this->status = status;
+            this->bmstatus = bmstatus;
+            if (this->active)
+            {
+                this->active = false;
+                this->done = true;
+            }
+        }
+    }
+
+    __atomic_clear(&this->reaping, __ATOMIC_RELEASE);
+    if (this->done) this->waiters.wake();
+}
+
+bool ATAChannel::wait()
+{
+    uint64_t deadline = vdso::monotonic() + ATA_TIMEOUT;
+    scheduler::thread_t *thread = this->irq ? this_thread() : nullptr;
 
+    if (thread) scheduler::add_timeout(thread, deadline);
+    while (this->done == false)
+    {
+        if (vdso::monotonic() >= deadline)
+        {
+            this->reap();
+            break;
+        }
+        if (thread == nullptr)
+        {
+            this->reap();
+            asm volatile ("pause");
+            continue;
+        }
+
+        this->waiters.add(thread);
+        if (this->done == false) thread->block();
+        this->waiters.remove(thread);
+    }
+    if (thread) scheduler::remove_timeout(thread);
     outb(this->bmport + ATA_BMR_CMD, 0);
-    outl(this->bmport + ATA_BMR_PRDT_ADDRESS, static_cast<uint32_t>(reinterpret_cast<uint64_t>(this->prdt)));
-    outb(this->bmport + ATA_BMR_STATUS, inb(this->bmport + ATA_BMR_STATUS) | 0x04 | 0x02);
+
+    if (this->done == false)
+    {
+        this->active = false;
+        error("ATA: DMA transfer timed out!");
+        return false;
+    }
+    return !(this->status & (ATA_DEV_ERR | ATA_DEV_DF)) && !(this->bmstatus & ATA_BMR_STATUS_ERROR);
+}
+
+bool ATAPort::settle(uint64_t deadline, bool drdy)
+{
+    while (true)
+    {
+        uint8_t status = this->inbcmd(ATA_REGISTER_STATUS);
+        if (!(status & ATA_DEV_BUSY) && (drdy == false || (status & ATA_DEV_DRDY))) return true;
+        if (vdso::monotonic() >= deadline)
+        {
+            error("ATA: Drive did not become ready!");
+            return false;
+        }
+        asm volatile ("pause");
+    }
+}
+
+bool ATAPort::rw(uint64_t sector, uint32_t sectorCount, sgentry *entries, size_t count, bool write)
+{
+    if (this->initialised == false) return false;
+    this->channel->acquire();
+    uint64_t deadline = vdso::monotonic() + ATA_TIMEOUT;
+
+    uint64_t *prdt = this->channel->prdt;
+    for (size_t i = 0; i < count; i++)
+    {
+        prdt[i] = entries[i].phys | ((entries[i].size & 0xFFFF) << 32);
+        if (i == count - 1) prdt[i] |= 0x8000000000000000ULL;
+    }
+
+    uint16_t bmport = this->channel->bmport;
+    uint16_t ctrlport = this->channel->ctrlport;
+
+    outb(bmport + ATA_BMR_CMD, 0);
+    outl(bmport + ATA_BMR_PRDT_ADDRESS, static_cast<uint32_t>(reinterpret_cast<uint64_t>(prdt)));
+    outb(bmport + ATA_BMR_STATUS, inb(bmport + ATA_BMR_STATUS) | ATA_BMR_STATUS_IRQ | ATA_BMR_STATUS_ERROR);
 
     this->outbcmd(ATA_REGISTER_DRIVE_HEAD, 0x40 | (this->drive << 4));
 
-    for (size_t i = 0; i < 4; i++) inb(this->ctrlport0);
+    for (size_t i = 0; i < 4; i++) inb(ctrlport);
 
-    while (this->inbcmd(ATA_REGISTER_STATUS) & ATA_DEV_BUSY);
+    if (this->settle(deadline, false) == false)
+    {
+        this->channel->release();
+        return false;
+    }
 
     this->outbcmd(ATA_REGISTER_SECTOR_COUNT, (sectorCount >> 8) & 0xFF);
 
@@ -59,7 +215,7 @@ bool ATAPort::rw(uint64_t sector, uint32_t sectorCount, bool write)
     this->outbcmd(ATA_REGISTER_LBA_MID, (sector >> 32) & 0xFF);
     this->outbcmd(ATA_REGISTER_LBA_HIGH, (sector >> 40) & 0xFF);
 
-    for (size_t i = 0; i < 4; i++) inb(this->ctrlport0);
+    for (size_t i = 0; i < 4; i++) inb(ctrlport);
 
     this->outbcmd(ATA_REGISTER_SECTOR_COUNT, sectorCount & 0xFF);
 
@@ -67,45 +223,56 @@ bool ATAPort::rw(uint64_t sector, uint32_t sectorCount, bool write)
     this->outbcmd(ATA_REGISTER_LBA_MID, (sector >> 8) & 0xFF);
     this->outbcmd(ATA_REGISTER_LBA_HIGH, (sector >> 16) & 0xFF);
 
-    for (size_t i = 0; i < 4; i++) inb(this->ctrlport0);
+    for (size_t i = 0; i < 4; i++) inb(ctrlport);
 
-    while (this->inbcmd(ATA_REGISTER_STATUS) & ATA_DEV_BUSY || !(this->inbcmd(ATA_REGISTER_STATUS) & ATA_DEV_DRDY));
+    if (this->settle(deadline, true) == false)
+    {
+        this->channel->release();
+        return false;
+    }
 
     this->outbcmd(ATA_REGISTER_COMMAND, (write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX));
-    outb(this->bmport + ATA_BMR_CMD, (write ? 0x00 : 0x08) | 0x01);
+    this->channel->start(write);
 
-    uint8_t status = this->inbcmd(ATA_REGISTER_STATUS);
-    while (status & ATA_DEV_BUSY)
-    {
-        if (status & ATA_DEV_ERR)
-        {
-            error("ATA: %s error!", write ? "write" : "read");
-            return false;
-        }
-        status = this->inbcmd(ATA_REGISTER_STATUS);
-    }
+    bool ok = this->channel->wait();
+    if (!ok) error("ATA: %s error 0x%X!", write ? "write" : "read", this->inbcmd(ATA_REGISTER_ERROR));
 
-    outb(this->bmport + ATA_BMR_CMD, 0);
+    this->channel->release();
+    return ok;
+}
+
+bool ATAPort::transfer(uint64_t sector, uint64_t count, sglist &list, bool write)
+{
+    sgentry entries[ATA_PRDT_ENTRIES];
+    sgcursor cursor;
 
-    if (this->inbcmd(ATA_REGISTER_STATUS) & ATA_DEV_ERR)
+    while (count > 0)
     {
-        error("ATA: %s error 0x%X!", write ? "write" : "read", this->inbcmd(ATA_REGISTER_ERROR));
-        return false;
-    }
+        uint64_t max = (count > ATA_MAX_SECTORS ? ATA_MAX_SECTORS : count) * this->stat.blksize;
+        size_t num = list.gather(cursor, entries, ATA_PRDT_ENTRIES, max, ATA_PRD_MAX_BYTES, ATA_PRD_MAX_BYTES, this->stat.blksize);
 
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < num; i++) bytes += entries[i].size;
+        if (bytes == 0) return false;
+
+        uint32_t sectorCount = bytes / this->stat.blksize;
+        if (!this->rw(sector, sectorCount, entries, num, write)) return false;
+
+        sector += sectorCount;
+        count -= sectorCount;
+    }
     return true;
 }
 
-ATAPort::ATAPort(uint16_t port, uint16_t bmport, uint16_t ctrlport0, size_t drive)
+ATAPort::ATAPort(ATAChannel *channel, size_t drive)
 {
-    this->port = port;
+    this->channel = channel;
+    this->port = channel->port;
     this->drive = drive;
-    this->bmport = bmport;
-    this->ctrlport0 = ctrlport0;
 
     this->outbcmd(ATA_REGISTER_DRIVE_HEAD, 0xA0 | (drive << 4));
 
-    for (size_t i = 0; i < 4; i++) inb(this->ctrlport0);
+    for (size_t i = 0; i < 4; i++) inb(channel->ctrlport);
 
     this->outbcmd(ATA_REGISTER_SECTOR_COUNT, 0);
     this->outbcmd(ATA_REGISTER_LBA_LOW, 0);
@@ -164,10 +331,7 @@ ATAPort::ATAPort(uint16_t port, uint16_t bmport, uint16_t ctrlport0, size_t driv
     else this->sectors = this->sectors = *reinterpret_cast<uint64_t*>(&identify[ATA_IDENT_MAX_LBA_EXT]);
 
     this->buffer = pmm::alloc<uint8_t*>(2);
-    this->prdt = pmm::alloc<uint64_t*>(2);
-    this->prdtBuffer = pmm::alloc<uint64_t*>(2);
-
-    *this->prdt = (reinterpret_cast<uint64_t>(this->prdtBuffer) | (static_cast<uint64_t>(0x1000) << 32) | 0x8000000000000000ULL) & 0xFFFFFFFF;
+    this->dma_limit = 0x100000000;
 
     this->stat.blocks = this->sectors;
     this->stat.blksize = 512;
@@ -190,10 +354,10 @@ ATAController::ATAController(pci::pcidevice_t *pcidevice)
     if (bar.address != 0 && !bar.mmio) this->port[1] = bar.address;
 
     bar = this->pcidevice->get_bar(2);
-    if (bar.address != 0 && !bar.mmio) this->ctrlport[0] = bar.address;
+    if (bar.address != 0 && !bar.mmio) this->ctrlport[0] = bar.address + 2;
 
     bar = this->pcidevice->get_bar(3);
-    if (bar.address != 0 && !bar.mmio) this->ctrlport[1] = bar.address;
+    if (bar.address != 0 && !bar.mmio) this->ctrlport[1] = bar.address + 2;
 
     bar = this->pcidevice->get_bar(4);
     if (bar.address == 0 || bar.mmio) return;
@@ -201,21 +365,40 @@ ATAController::ATAController(pci::pcidevice_t *pcidevice)
 
     this->pcidevice->command(pci::CMD_BUS_MAST, true);
 
+    uint8_t progif = this->pcidevice->readb(pci::PCI_PROG_IF);
+    uint8_t irq = 0;
+
     for (size_t i = 0; i < 2; i++)
     {
-        outb(this->ctrlport[i], inb(this->ctrlport[i]) | 0x04);
-        for (size_t t = 0; t < 4; t++) inb(this->ctrlport[0]);
-        outb(this->ctrlport[i], 0x00);
+        auto channel = new ATAChannel(this->port[i], this->ctrlport[i], this->bmport + (i ? ATA_BMR_CMD_SECONDARY : ATA_BMR_CMD));
+        this->channels[i] = channel;
 
+        outb(channel->ctrlport, inb(channel->ctrlport) | 0x04);
+        for (size_t t = 0; t < 4; t++) inb(channel->ctrlport);
+        outb(channel->ctrlport, 0x00);
+
+        size_t found = this->ports.size();
         for (size_t t = 0; t < 2; t++)
         {
-            this->ports.push_back(new ATAPort((i ? this->port[1] : this->port[0]), this->bmport, this->ctrlport[0], t));
+            this->ports.push_back(new ATAPort(channel, t));
             if (this->ports.back()->initialised == false)
             {
                 free(this->ports.back());
                 this->ports.pop_back();
             }
         }
+        if (found == this->ports.size()) continue;
+
+        if (progif & (i ? 0x04 : 0x01))
+        {
+            if (irq == 0) irq = this->pcidevice->irq_set(ATA_ControllerHandler, reinterpret_cast<uint64_t>(this));
+            channel->irq = irq;
+        }
+        else
+        {
+            channel->irq = (i ? idt::IRQ15 : idt::IRQ14);
+            idt::register_interrupt_handler(channel->irq, ATA_ChannelHandler, reinterpret_cast<uint64_t>(channel), true);
+        }
     }
 
     if (this->ports.size() == 0) return;
@@ -240,7 +423,9 @@ bool search(uint8_t Class, uint8_t subclass, uint8_t progif)
 
     for (size_t i = 0; i < count; i++)
     {
+        size_t event = boot::event_begin("ATA controller probe");
         devices.push_back(new ATAController(pci::search(Class, subclass, progif, i)));
+        boot::event_end(event);
         if (devices.back()->initialised == false)
         {
             free(devices.back());
@@ -11,6 +11,11 @@ using namespace kernel::system;
 
 namespace kernel::drivers::block::ata {
 
+static constexpr size_t ATA_PRDT_ENTRIES = 64;
+static constexpr uint64_t ATA_PRD_MAX_BYTES = 0x10000;
+static constexpr uint32_t ATA_MAX_SECTORS = 0x8000;
+static constexpr uint64_t ATA_TIMEOUT = 5000000000;
+
 enum regs
 {
     ATA_REGISTER_DATA = 0x00,
@@ -54,6 +59,13 @@ enum bmrcmd
     ATA_BMR_PRDT_ADDRESS_SECONDARY = 0x0C
 };
 
+enum bmrstatus
+{
+    ATA_BMR_STATUS_ACTIVE = 0x01,
+    ATA_BMR_STATUS_ERROR = 0x02,
+    ATA_BMR_STATUS_IRQ = 0x04
+};
+
 enum status
 {
     ATA_DEV_BUSY = 0x80,
@@ -84,17 +96,46 @@ enum ATAPortType
     ATAPI = 1
 };
 
-struct ATAController;
-class ATAPort : public drivemgr::Drive
+class ATAChannel
 {
     private:
+    volatile bool reaping = false;
+    volatile bool active = false;
+    volatile bool done = false;
+    scheduler::waitqueue_t waiters;
+
+    volatile bool busy = false;
+    scheduler::waitqueue_t owners;
+
+    public:
     uint16_t port;
+    uint16_t ctrlport;
     uint16_t bmport;
-    uint16_t ctrlport0;
-    size_t drive;
+    uint8_t irq = 0;
 
     uint64_t *prdt;
-    uint64_t *prdtBuffer;
+    lock_t lock;
+
+    volatile uint8_t status = 0;
+    volatile uint8_t bmstatus = 0;
+
+    void acquire();
+    void release();
+
+    void start(bool write);
+    void reap();
+    bool wait();
+
+    ATAChannel(uint16_t port, uint16_t ctrlport, uint16_t bmport);
+};
+
+struct ATAController;
+class ATAPort : public drivemgr::Drive
+{
+    private:
+    ATAChannel *channel;
+    uint16_t port;
+    size_t drive;
 
     void outbcmd(uint8_t offset, uint8_t val);
     void outwcmd(uint8_t offset, uint16_t val);
@@ -104,89 +145,14 @@ class ATAPort : public drivemgr::Drive
     uint16_t inwcmd(uint8_t offset);
     uint32_t inlcmd(uint8_t offset);
 
-    bool rw(uint64_t sector, uint32_t sectorCount, bool write);
+    bool settle(uint64_t deadline, bool drdy);
+    bool rw(uint64_t sector, uint32_t sectorCount, sgentry *entries, size_t count, bool write);
 
     public:
     bool initialised = false;
     ATAPortType portType;
 
-    int64_t read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
-    {
-        if (offset % this->stat.blksize || size % this->stat.blksize)
-        {
-            errno_set(EIO);
-            return -1;
-        }
-
-        uint64_t start = offset / this->stat.blksize;
-        uint64_t count = size / this->stat.blksize;
-
-        if (count % 16)
-        {
-            uint64_t extra = count % 16;
-            if (!this->rw(start, extra, false))
-            {
-                errno_set(EIO);
-                return -1;
-            }
-            memcpy(buffer, this->prdtBuffer, this->stat.blksize * extra);
-            buffer += this->stat.blksize * extra;
-            count -= extra;
-            start += extra;
-        }
-        if (count == 0) return size;
-
-        for (size_t i = 0; i < count; i += 16)
-        {
-            if (!this->rw(start + i, 16, false))
-            {
-                errno_set(EIO);
-                return -1;
-            }
-            memcpy(buffer, this->prdtBuffer, this->stat.blksize * 16);
-            buffer += this->stat.blksize * 16;
-        }
-        return size;
-    }
-
-    int64_t write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
-    {
-        if (offset % this->stat.blksize || size % this->stat.blksize)
-        {
-            errno_set(EIO);
-            return -1;
-        }
-
-        uint64_t start = offset / this->stat.blksize;
-        uint64_t count = size / this->stat.blksize;
-
-        if (count % 16)
-        {
-            uint64_t extra = count % 16;
-            memcpy(this->prdtBuffer, buffer, this->stat.blksize * extra);
-            if (!this->rw(start, extra, true))
-            {
-                errno_set(EIO);
-                return -1;
-            }
-            buffer += this->stat.blksize * extra;
-            count -= extra;
-            start += extra;
-        }
-        if (count == 0) return size;
-
-        for (size_t i = 0; i < count; i += 16)
-        {
-            memcpy(this->prdtBuffer, buffer, this->stat.blksize * 16);
-            if (!this->rw(start + i, 16, true))
-            {
-                errno_set(EIO);
-                return -1;
-            }
-            buffer += this->stat.blksize * 16;
-        }
-        return size;
-    }
+    bool transfer(uint64_t sector, uint64_t count, sglist &list, bool write);
 
     int ioctl(void *handle, uint64_t request, void *argp)
     {
@@ -213,7 +179,7 @@ class ATAPort : public drivemgr::Drive
         return nullptr;
     }
 
-    ATAPort(uint16_t port, uint16_t bmport, uint16_t ctrlport0, size_t drive);
+    ATAPort(ATAChannel *channel, size_t drive);
 };
 
 struct ATAController
@@ -221,6 +187,7 @@ struct ATAController
     pci::pcidevice_t *pcidevice;
 
     vector<ATAPort*> ports;
+    ATAChannel *channels[2] = { nullptr, nullptr };
 
     uint16_t port[2] = { 0x1F0, 0x170 };
     uint16_t ctrlport[2] = { 0x3F6, 0x376 };
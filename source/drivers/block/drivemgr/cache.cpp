@@ -0,0 +1,586 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <drivers/block/drivemgr/drivemgr.hpp>
+#include <system/mm/pmm/pmm.hpp>
+#include <system/mm/vmm/vmm.hpp>
+#include <kernel/kernel.hpp>
+#include <lib/memory.hpp>
+#include <lib/math.hpp>
+
+using namespace kernel::system::mm;
+
+namespace kernel::drivers::block::drivemgr {
+
+static void lru_unlink(Drive *drive, cachepage *page)
+{
+    if (page->lru_prev) page->lru_prev->lru_next = page->lru_next;
+    else drive->lru_head = page->lru_next;
+
+    if (page->lru_next) page->lru_next->lru_prev = page->lru_prev;
+    else drive->lru_tail = page->lru_prev;
+
+    page->lru_prev = page->lru_next = nullptr;
+}
+
+static void lru_push(Drive *drive, cachepage *page)
+{
+    page->lru_prev = nullptr;
+    page->lru_next = drive->lru_head;
+
+    if (drive->lru_head) drive->lru_head->lru_prev = page;
+    else drive->lru_tail = page;
+    drive->lru_head = page;
+}
+
+static cachepage *cache_evict(Drive *drive)
+{
+    if (drive->cached < CACHE_MAX_PAGES) return nullptr;
+
+    for (cachepage *page = drive->lru_tail; page != nullptr; page = page->lru_prev)
+    {
+        if (page->refcount > 0 || page->busy || page->dirty) continue;
+
+        cachepage **link = &drive->cache_table[page->index % CACHE_BUCKETS];
+        while (*link != page) link = &(*link)->hash_next;
+        *link = page->hash_next;
+
+        lru_unlink(drive, page);
+        return page;
+    }
+    return nullptr;
+}
+
+cachepage *Drive::cache_lookup(uint64_t index)
+{
+    if (this->cache_table == nullptr) return nullptr;
+
+    for (cachepage *page = this->cache_table[index % CACHE_BUCKETS]; page != nullptr; page = page->hash_next)
+    {
+        if (page->index == index) return page;
+    }
+    return nullptr;
+}
+
+cachepage *Drive::cache_get(uint64_t index, bool &load)
+{
+    lockit(this->cache_lock);
+
+    if (this->cache_table == nullptr) this->cache_table = new cachepage*[CACHE_BUCKETS]();
+
+    cachepage *page = this->cache_lookup(index);
+    if (page == nullptr)
+    {
+        page = cache_evict(this);
+        if (page == nullptr)
+        {
+            page = new cachepage;
+            page->phys = pmm::alloc<uint64_t>();
+            this->cached++;
+        }
+
+        page->index = index;
+        page->refcount = 0;
+        page->busy = false;
+        page->uptodate = false;
+        page->dirty = false;
+
+        page->hash_next = this->cache_table[index % CACHE_BUCKETS];
+        this->cache_table[index % CACHE_BUCKETS] = page;
+    }
+    else lru_unlink(this, page);
+
+    lru_push(this, page);
+    page->refcount++;
+
+    load = false;
+    if (!page->uptodate && !page->busy)
+    {
+        page->busy = true;
+        load = true;
+    }
+    return page;
+}
+
+void Drive::cache_put(cachepage *page, bool dirty)
+{
+    lockit(this->cache_lock);
+    if (dirty && page->dirty == false)
+    {
+        page->dirty = true;
+        this->dirty++;
+    }
+    if (--page->refcount == 0 && page->dirty) this->cache_wake();
+}
+
+// Anything waiting on page I/O samples cache_events first, so a
+// completion between the check and the sleep is never missed
+void Drive::cache_wake()
+{
+    __atomic_add_fetch(&this->cache_events, 1, __ATOMIC_SEQ_CST);
+    this->cache_waiters.wake();
+}
+
+void Drive::cache_wait(uint64_t seen)
+{
+    scheduler::thread_t *thread = this_thread();
+    if (thread == nullptr)
+    {
+        asm volatile ("pause");
+        return;
+    }
+
+    this->cache_waiters.add(thread);
+    if (__atomic_load_n(&this->cache_events, __ATOMIC_SEQ_CST) == seen) thread->block();
+    this->cache_waiters.remove(thread);
+}
+
+void Drive::wait_page(cachepage *page)
+{
+    while (true)
+    {
+        uint64_t seen = __atomic_load_n(&this->cache_events, __ATOMIC_SEQ_CST);
+        if (page->busy == false) return;
+        this->cache_wait(seen);
+    }
+}
+
+bool Drive::cache_fill(cachepage **pages, size_t count)
+{
+    uint64_t per_page = vmm::page_size / this->stat.blksize;
+    uint64_t sector = pages[0]->index * per_page;
+    uint64_t sectors = count * per_page;
+
+    if (this->sectors && sector + sectors > this->sectors)
+    {
+        sectors = (sector < this->sectors ? this->sectors - sector : 0);
+        uint64_t valid = sectors * this->stat.blksize;
+        for (size_t i = valid / vmm::page_size; i < count; i++)
+        {
+            uint64_t start = (i == valid / vmm::page_size ? valid % vmm::page_size : 0);
+            memset(reinterpret_cast<uint8_t*>(pages[i]->phys + hhdm_offset) + start, 0, vmm::page_size - start);
+        }
+    }
+
+    bool ret = this->cache_transfer(pages, count, sector, sectors, false);
+    for (size_t i = 0; i < count; i++)
+    {
+        pages[i]->uptodate = ret;
+        pages[i]->busy = false;
+    }
+    this->cache_wake();
+    return ret;
+}
+
+// Cache pages can live anywhere, so bounce them when the device can't reach them
+bool Drive::cache_transfer(cachepage **pages, size_t count, uint64_t sector, uint64_t sectors, bool write)
+{
+    if (sectors == 0) return true;
+
+    sglist list;
+    for (size_t i = 0; i < count; i++) list.push(pages[i]->phys, vmm::page_size);
+    if (list.fits(this->dma_align, this->dma_limit, this->dma_pages)) return this->transfer(sector, sectors, list, write);
+
+    uint8_t *bounce = pmm::alloc_below<uint8_t*>(count, this->dma_limit);
+    if (bounce == nullptr) return false;
+
+    if (write)
+    {
+        for (size_t i = 0; i < count; i++) memcpy(bounce + hhdm_offset + i * vmm::page_size, reinterpret_cast<void*>(pages[i]->phys + hhdm_offset), vmm::page_size);
+    }
+
+    sglist direct;
+    direct.push(reinterpret_cast<uint64_t>(bounce), count * vmm::page_size);
+    bool ret = this->transfer(sector, sectors, direct, write);
+
+    if (ret && write == false)
+    {
+        for (size_t i = 0; i < count; i++) memcpy(reinterpret_cast<void*>(pages[i]->phys + hhdm_offset), bounce + hhdm_offset + i * vmm::page_size, vmm::page_size);
+    }
+
+    pmm::free(bounce, count);
+    return ret;
+}
+
+bool Drive::cache_flush(cachepage **pages, size_t count)
+{
+    uint64_t per_page = vmm::page_size / this->stat.blksize;
+    uint64_t sector = pages[0]->index * per_page;
+    uint64_t sectors = count * per_page;
+
+    if (this->sectors && sector + sectors > this->sectors)
+    {
+        sectors = (sector < this->sectors ? this->sectors - sector : 0);
+    }
+
+    bool ret = this->cache_transfer(pages, count, sector, sectors, true);
+
+    lockit(this->cache_lock);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (ret == false && pages[i]->dirty == false)
+        {
+            pages[i]->dirty = true;
+            this->dirty++;
+        }
+        pages[i]->busy = false;
+        pages[i]->refcount--;
+        this->writing--;
+    }
+    this->cache_wake();
+    return ret;
+}
+
+bool Drive::writeback(size_t target)
+{
+    cachepage *batch[WRITEBACK_BATCH];
+
+    while (this->dirty > target)
+    {
+        size_t count = 0;
+        uint64_t seen = __atomic_load_n(&this->cache_events, __ATOMIC_SEQ_CST);
+
+        this->cache_lock.lock();
+        for (size_t i = 0; i < CACHE_BUCKETS && count < WRITEBACK_BATCH; i++)
+        {
+            for (cachepage *page = this->cache_table[i]; page != nullptr && count < WRITEBACK_BATCH; page = page->hash_next)
+            {
+                if (page->dirty == false || page->busy || page->refcount > 0) continue;
+
+                page->busy = true;
+                page->dirty = false;
+                page->refcount++;
+                this->dirty--;
+                this->writing++;
+                batch[count++] = page;
+            }
+        }
+        this->cache_lock.unlock();
+
+        if (count == 0)
+        {
+            this->cache_wait(seen);
+            continue;
+        }
+
+        for (size_t i = 1; i < count; i++)
+        {
+            cachepage *page = batch[i];
+            size_t t = i;
+            for (; t > 0 && batch[t - 1]->index > page->index; t--) batch[t] = batch[t - 1];
+            batch[t] = page;
+        }
+
+        bool ret = true;
+        for (size_t i = 0; i < count; )
+        {
+            size_t run = 1;
+            while (i + run < count && batch[i + run]->index == batch[i + run - 1]->index + 1) run++;
+
+            if (!this->cache_flush(&batch[i], run)) ret = false;
+            i += run;
+        }
+        if (ret == false) return false;
+    }
+    return true;
+}
+
+static void ra_worker(uint64_t arg)
+{
+    Drive *drive = reinterpret_cast<Drive*>(arg);
+    cachepage *pages[RA_MAX_PAGES];
+
+    while (true)
+    {
+        drive->ra_lock.lock();
+        if (drive->ra_head == drive->ra_tail)
+        {
+            drive->ra_lock.unlock();
+            this_thread()->block();
+            continue;
+        }
+        ra_request request = drive->ra_queue[drive->ra_tail];
+        drive->ra_tail = (drive->ra_tail + 1) % RA_QUEUE_SIZE;
+        drive->ra_lock.unlock();
+
+        size_t count = 0;
+        for (uint64_t i = 0; i <= request.count; i++)
+        {
+            bool load = false;
+            cachepage *page = (i < request.count ? drive->cache_get(request.index + i, load) : nullptr);
+            if (load)
+            {
+                pages[count++] = page;
+                continue;
+            }
+            if (page) drive->cache_put(page);
+            if (count == 0) continue;
+
+            drive->cache_fill(pages, count);
+            for (size_t t = 0; t < count; t++) drive->cache_put(pages[t]);
+            count = 0;
+        }
+    }
+}
+
+static void flush_worker(uint64_t arg)
+{
+    Drive *drive = reinterpret_cast<Drive*>(arg);
+
+    while (true)
+    {
+        if (drive->dirty == 0 || !drive->writeback(0)) this_thread()->block();
+    }
+}
+
+bool Drive::start_workers()
+{
+    if (this->flush_thread != nullptr) return true;
+    if (scheduler::initproc == nullptr) return false;
+
+    lockit(this->ra_lock);
+    if (this->flush_thread != nullptr) return true;
+
+    auto proc = new scheduler::process_t("blkd", ra_worker, reinterpret_cast<uint64_t>(this), scheduler::LOW);
+    this->ra_thread = proc->threads.front();
+    this->flush_thread = proc->add_thread(flush_worker, reinterpret_cast<uint64_t>(this), scheduler::LOW);
+    proc->enqueue();
+
+    return true;
+}
+
+void Drive::prefetch(uint64_t index, uint64_t count)
+{
+    if (!this->start_workers()) return;
+
+    if (this->sectors)
+    {
+        uint64_t limit = DIV_ROUNDUP(this->sectors * this->stat.blksize, vmm::page_size);
+        if (index >= limit) return;
+        if (index + count > limit) count = limit - index;
+    }
+    if (count > RA_MAX_PAGES) count = RA_MAX_PAGES;
+
+    this->ra_lock.lock();
+    size_t next = (this->ra_head + 1) % RA_QUEUE_SIZE;
+    if (next != this->ra_tail)
+    {
+        this->ra_queue[this->ra_head] = ra_request { index, count };
+        this->ra_head = next;
+    }
+    this->ra_lock.unlock();
+
+    this->ra_thread->unblock();
+}
+
+void Drive::readahead(vfs::readahead_t &ra, uint64_t first, uint64_t last)
+{
+    lockit(ra.lock);
+
+    bool sequential = (first == ra.prev || first == ra.prev + 1);
+    ra.prev = last;
+
+    if (sequential == false)
+    {
+        ra.size = 0;
+        ra.next = last + 1;
+        return;
+    }
+
+    ra.size = (ra.size == 0 ? RA_MIN_PAGES : (ra.size * 2 > RA_MAX_PAGES ? RA_MAX_PAGES : ra.size * 2));
+
+    uint64_t start = (ra.next > last + 1 ? ra.next : last + 1);
+    uint64_t end = last + 1 + ra.size;
+    if (start >= end) return;
+
+    this->prefetch(start, end - start);
+    ra.next = end;
+}
+
+int64_t Drive::read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
+{
+    if (size == 0) return 0;
+
+    uint64_t blksize = this->stat.blksize;
+    if (blksize == 0 || vmm::page_size % blksize) return this->rw(buffer, offset, size, false);
+
+    uint64_t first = offset / vmm::page_size;
+    uint64_t last = (offset + size - 1) / vmm::page_size;
+    if (handle != nullptr) this->readahead(static_cast<vfs::handle_t*>(handle)->ra, first, last);
+
+    if (size >= CACHE_DIRECT_BYTES && offset % blksize == 0 && size % blksize == 0 && this->dirty == 0 && this->writing == 0)
+    {
+        return this->rw(buffer, offset, size, false);
+    }
+
+    cachepage *pages[RA_MAX_PAGES];
+    bool loads[RA_MAX_PAGES];
+
+    for (uint64_t index = first; index <= last; )
+    {
+        size_t count = (last - index + 1 > RA_MAX_PAGES ? RA_MAX_PAGES : last - index + 1);
+        for (size_t i = 0; i < count; i++) pages[i] = this->cache_get(index + i, loads[i]);
+
+        for (size_t i = 0; i < count; )
+        {
+            if (loads[i] == false)
+            {
+                i++;
+                continue;
+            }
+            size_t run = 1;
+            while (i + run < count && loads[i + run]) run++;
+
+            this->cache_fill(&pages[i], run);
+            i += run;
+        }
+
+        bool failed = false;
+        for (size_t i = 0; i < count; i++)
+        {
+            this->wait_page(pages[i]);
+
+            if (pages[i]->uptodate && failed == false)
+            {
+                uint64_t pstart = (index + i) * vmm::page_size;
+                uint64_t start = (offset > pstart ? offset : pstart);
+                uint64_t end = (offset + size < pstart + vmm::page_size ? offset + size : pstart + vmm::page_size);
+                memcpy(buffer + (start - offset), reinterpret_cast<uint8_t*>(pages[i]->phys + hhdm_offset) + (start - pstart), end - start);
+            }
+            else failed = true;
+
+            this->cache_put(pages[i]);
+        }
+
+        if (failed)
+        {
+            errno_set(EIO);
+            return -1;
+        }
+        index += count;
+    }
+    return size;
+}
+
+int64_t Drive::readv(void *handle, vfs::iovec_t *iov, size_t count, uint64_t offset)
+{
+    uint64_t size = vfs::iov_length(iov, count);
+    if (size == 0) return 0;
+
+    uint64_t blksize = this->stat.blksize;
+    if (blksize == 0 || size < CACHE_DIRECT_BYTES || offset % blksize || size % blksize || this->dirty || this->writing)
+    {
+        return resource_t::readv(handle, iov, count, offset);
+    }
+
+    sglist list;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!list.map(iov[i].base, iov[i].len, true)) return resource_t::readv(handle, iov, count, offset);
+    }
+    if (!list.fits(this->dma_align, this->dma_limit, this->dma_pages)) return resource_t::readv(handle, iov, count, offset);
+
+    if (handle != nullptr) this->readahead(static_cast<vfs::handle_t*>(handle)->ra, offset / vmm::page_size, (offset + size - 1) / vmm::page_size);
+
+    if (!this->transfer(offset / blksize, size / blksize, list, false))
+    {
+        errno_set(EIO);
+        return -1;
+    }
+    return size;
+}
+
+int64_t Drive::write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
+{
+    if (size == 0) return 0;
+
+    uint64_t blksize = this->stat.blksize;
+    if (blksize == 0 || vmm::page_size % blksize) return this->rw(buffer, offset, size, true);
+
+    uint64_t first = offset / vmm::page_size;
+    uint64_t last = (offset + size - 1) / vmm::page_size;
+
+    cachepage *pages[RA_MAX_PAGES];
+    bool loads[RA_MAX_PAGES];
+    bool full[RA_MAX_PAGES];
+
+    for (uint64_t index = first; index <= last; )
+    {
+        size_t count = (last - index + 1 > RA_MAX_PAGES ? RA_MAX_PAGES : last - index + 1);
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t pstart = (index + i) * vmm::page_size;
+            full[i] = (offset <= pstart && offset + size >= pstart + vmm::page_size);
+            pages[i] = this->cache_get(index + i, loads[i]);
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (loads[i] && full[i] == false)
+            {
+                this->cache_fill(&pages[i], 1);
+                loads[i] = false;
+            }
+        }
+
+        bool failed = false;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (loads[i] == false) this->wait_page(pages[i]);
+
+            if (failed || (loads[i] == false && pages[i]->uptodate == false))
+            {
+                failed = true;
+                if (loads[i])
+                {
+                    pages[i]->busy = false;
+                    this->cache_wake();
+                }
+                this->cache_put(pages[i]);
+                continue;
+            }
+
+            uint64_t pstart = (index + i) * vmm::page_size;
+            uint64_t start = (offset > pstart ? offset : pstart);
+            uint64_t end = (offset + size < pstart + vmm::page_size ? offset + size : pstart + vmm::page_size);
+            memcpy(reinterpret_cast<uint8_t*>(pages[i]->phys + hhdm_offset) + (start - pstart), buffer + (start - offset), end - start);
+
+            if (loads[i])
+            {
+                pages[i]->uptodate = true;
+                pages[i]->busy = false;
+                this->cache_wake();
+            }
+            this->cache_put(pages[i], true);
+        }
+
+        if (failed)
+        {
+            errno_set(EIO);
+            return -1;
+        }
+        index += count;
+    }
+
+    if (this->dirty >= DIRTY_LIMIT_PAGES) this->writeback(DIRTY_BACKGROUND_PAGES);
+    else if (this->dirty >= DIRTY_BACKGROUND_PAGES)
+    {
+        if (this->start_workers()) this->flush_thread->unblock();
+        else this->writeback(0);
+    }
+    return size;
+}
+
+bool Drive::sync(void *handle)
+{
+    bool ret = this->writeback(0);
+    while (true)
+    {
+        uint64_t seen = __atomic_load_n(&this->cache_events, __ATOMIC_SEQ_CST);
+        if (this->writing == 0) break;
+        this->cache_wait(seen);
+    }
+
+    if (ret == false) errno_set(EIO);
+    return ret;
+}
+}
@@ -2,18 +2,94 @@
 
 #include <drivers/block/drivemgr/drivemgr.hpp>
 #include <drivers/block/ahci/ahci.hpp>
+#include <drivers/block/nvme/nvme.hpp>
 #include <drivers/fs/devfs/devfs.hpp>
 #include <drivers/block/ata/ata.hpp>
+#include <system/mm/pmm/pmm.hpp>
+#include <system/mm/vmm/vmm.hpp>
+#include <kernel/kernel.hpp>
 #include <lib/memory.hpp>
+#include <lib/math.hpp>
 #include <lib/log.hpp>
 
 using namespace kernel::drivers::fs;
+using namespace kernel::system::mm;
 
 namespace kernel::drivers::block::drivemgr {
 
 bool initialised = false;
 vector<Drive*> drives;
 
+int64_t Drive::rw(uint8_t *buffer, uint64_t offset, uint64_t size, bool write)
+{
+    if (size == 0) return 0;
+
+    uint64_t blksize = this->stat.blksize;
+    uint64_t start = offset / blksize;
+    uint64_t count = DIV_ROUNDUP(offset + size, blksize) - start;
+    bool aligned = (offset % blksize == 0 && size % blksize == 0);
+
+    if (aligned)
+    {
+        sglist list;
+        if (list.map(buffer, size, !write) && list.fits(this->dma_align, this->dma_limit, this->dma_pages))
+        {
+            if (!this->transfer(start, count, list, write))
+            {
+                errno_set(EIO);
+                return -1;
+            }
+            return size;
+        }
+    }
+
+    uint64_t pages = DIV_ROUNDUP(count * blksize, vmm::page_size);
+    uint8_t *bounce = pmm::alloc_below<uint8_t*>(pages, this->dma_limit);
+    if (bounce == nullptr)
+    {
+        errno_set(ENOMEM);
+        return -1;
+    }
+
+    sglist list;
+    list.push(reinterpret_cast<uint64_t>(bounce), count * blksize);
+
+    if (!write || !aligned)
+    {
+        if (!this->transfer(start, count, list, false))
+        {
+            errno_set(EIO);
+            pmm::free(bounce, pages);
+            return -1;
+        }
+    }
+
+    if (write)
+    {
+        memcpy(bounce + hhdm_offset + offset % blksize, buffer, size);
+        if (!this->transfer(start, count, list, true))
+        {
+            errno_set(EIO);
+            pmm::free(bounce, pages);
+            return -1;
+        }
+    }
+    else memcpy(buffer, bounce + hhdm_offset + offset % blksize, size);
+
+    pmm::free(bounce, pages);
+    return size;
+}
+
+bool sync()
+{
+    bool ret = true;
+    for (size_t i = 0; i < drives.size(); i++)
+    {
+        if (!drives[i]->sync(nullptr)) ret = false;
+    }
+    return ret;
+}
+
 void addDrive(Drive *drive, type_t type)
 {
     serial::newline();
@@ -121,6 +197,17 @@ void addATA()
     }
 }
 
+void addNVMe()
+{
+    for (size_t i = 0; i < nvme::devices.size(); i++)
+    {
+        for (size_t t = 0; t < nvme::devices[i]->namespaces.size(); t++)
+        {
+            addDrive(nvme::devices[i]->namespaces[t], NVME);
+        }
+    }
+}
+
 void init()
 {
     log("Initialising drive manager");
@@ -133,6 +220,7 @@ void init()
 
     addAHCI();
     addATA();
+    addNVMe();
 
     serial::newline();
     initialised = true;
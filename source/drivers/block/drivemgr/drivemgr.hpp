@@ -2,9 +2,11 @@
 
 #pragma once
 
+#include <system/sched/scheduler/scheduler.hpp>
 #include <system/vfs/vfs.hpp>
 #include <lib/string.hpp>
 #include <lib/vector.hpp>
+#include <lib/sglist.hpp>
 #include <lib/log.hpp>
 #include <cstdint>
 
@@ -15,6 +17,18 @@ namespace kernel::drivers::block::drivemgr {
 static constexpr uint64_t GPT_SIGNATURE = 0x5452415020494645;
 static constexpr uint64_t SECTOR_SIZE = 512;
 
+static constexpr size_t CACHE_BUCKETS = 1024;
+static constexpr size_t CACHE_MAX_PAGES = 4096;
+static constexpr uint64_t CACHE_DIRECT_BYTES = 0x40000;
+
+static constexpr size_t DIRTY_BACKGROUND_PAGES = 512;
+static constexpr size_t DIRTY_LIMIT_PAGES = 2048;
+static constexpr size_t WRITEBACK_BATCH = 128;
+
+static constexpr size_t RA_MIN_PAGES = 4;
+static constexpr size_t RA_MAX_PAGES = 64;
+static constexpr size_t RA_QUEUE_SIZE = 16;
+
 enum type_t
 {
     NVME,
@@ -87,6 +101,26 @@ struct partTable
     GPTHdr gpt;
 };
 
+struct cachepage
+{
+    uint64_t index;
+    uint64_t phys;
+    int refcount;
+    volatile bool busy;
+    volatile bool uptodate;
+    volatile bool dirty;
+
+    cachepage *hash_next;
+    cachepage *lru_prev;
+    cachepage *lru_next;
+};
+
+struct ra_request
+{
+    uint64_t index;
+    uint64_t count;
+};
+
 struct Partition;
 struct Drive : vfs::resource_t
 {
@@ -96,6 +130,59 @@ struct Drive : vfs::resource_t
     vector<Partition*> partitions;
     uint64_t sectors;
     type_t type;
+
+    uint64_t dma_align = 2;
+    uint64_t dma_limit = 0;
+    bool dma_pages = false;
+
+    virtual bool transfer(uint64_t sector, uint64_t count, sglist &list, bool write)
+    {
+        errno_set(EINVAL);
+        return false;
+    }
+
+    lock_t cache_lock;
+    cachepage **cache_table = nullptr;
+    cachepage *lru_head = nullptr;
+    cachepage *lru_tail = nullptr;
+    size_t cached = 0;
+    volatile size_t dirty = 0;
+    volatile size_t writing = 0;
+
+    scheduler::waitqueue_t cache_waiters;
+    volatile uint64_t cache_events = 0;
+
+    lock_t ra_lock;
+    ra_request ra_queue[RA_QUEUE_SIZE];
+    size_t ra_head = 0;
+    size_t ra_tail = 0;
+
+    scheduler::thread_t *ra_thread = nullptr;
+    scheduler::thread_t *flush_thread = nullptr;
+
+    cachepage *cache_lookup(uint64_t index);
+    cachepage *cache_get(uint64_t index, bool &load);
+    void cache_put(cachepage *page, bool dirty = false);
+    bool cache_fill(cachepage **pages, size_t count);
+    bool cache_flush(cachepage **pages, size_t count);
+    bool cache_transfer(cachepage **pages, size_t count, uint64_t sector, uint64_t sectors, bool write);
+
+    void cache_wake();
+    void cache_wait(uint64_t seen);
+    void wait_page(cachepage *page);
+
+    bool start_workers();
+    bool writeback(size_t target);
+
+    void readahead(vfs::readahead_t &ra, uint64_t first, uint64_t last);
+    void prefetch(uint64_t index, uint64_t count);
+
+    int64_t rw(uint8_t *buffer, uint64_t offset, uint64_t size, bool write);
+
+    int64_t read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size);
+    int64_t write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size);
+    int64_t readv(void *handle, vfs::iovec_t *iov, size_t count, uint64_t offset);
+    bool sync(void *handle);
 };
 
 struct Partition : vfs::resource_t
@@ -123,6 +210,24 @@ struct Partition : vfs::resource_t
         return this->parent->write(handle, buffer, this->start + offset, size);
     }
 
+    int64_t readv(void *handle, vfs::iovec_t *iov, size_t count, uint64_t offset)
+    {
+        if (offset + vfs::iov_length(iov, count) > this->sectors * this->parent->stat.blksize)
+        {
+            return resource_t::readv(handle, iov, count, offset);
+        }
+        return this->parent->readv(handle, iov, count, this->start + offset);
+    }
+
+    int64_t writev(void *handle, vfs::iovec_t *iov, size_t count, uint64_t offset)
+    {
+        if (offset + vfs::iov_length(iov, count) > this->sectors * this->parent->stat.blksize)
+        {
+            return resource_t::writev(handle, iov, count, offset);
+        }
+        return this->parent->writev(handle, iov, count, this->start + offset);
+    }
+
     int ioctl(void *handle, uint64_t request, void *argp)
     {
         return this->parent->ioctl(handle, request, argp);
@@ -145,10 +250,15 @@ struct Partition : vfs::resource_t
     {
         return this->parent->mmap(page, flags);
     }
+    bool sync(void *handle)
+    {
+        return this->parent->sync(handle);
+    }
 };
 
 extern bool initialised;
 extern vector<Drive*> drives;
 
+bool sync();
 void init();
 }
\ No newline at end of file
@@ -0,0 +1,462 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <drivers/block/nvme/nvme.hpp>
+#include <system/boot/timing.hpp>
+#include <system/cpu/smp/smp.hpp>
+#include <system/cpu/idt/idt.hpp>
+#include <system/mm/pmm/pmm.hpp>
+#include <lib/memory.hpp>
+#include <lib/math.hpp>
+#include <lib/timer.hpp>
+#include <lib/log.hpp>
+
+using namespace kernel::system::cpu;
+using namespace kernel::system::mm;
+
+namespace kernel::drivers::block::nvme {
+
+bool initialised = false;
+vector<NVMeController*> devices;
+
+static void NVMe_Handler(registers_t *regs, uint64_t addr)
+{
+    auto device = reinterpret_cast<NVMeController*>(addr);
+
+    device->adminqueue->reap();
+    for (auto queue : device->ioqueues) queue->reap();
+}
+
+static void NVMe_QueueHandler(registers_t *regs, uint64_t addr)
+{
+    reinterpret_cast<NVMeQueue*>(addr)->reap();
+}
+
+NVMeQueue::NVMeQueue(uint16_t qid, uint16_t depth, volatile uint32_t *sqdb, volatile uint32_t *cqdb)
+{
+    this->qid = qid;
+    this->depth = depth;
+    this->sqdb = sqdb;
+    this->cqdb = cqdb;
+
+    this->sq = reinterpret_cast<NVMeCommand*>(pmm::alloc<uint64_t>(DIV_ROUNDUP(depth * sizeof(NVMeCommand), PAGE_SIZE)) + hhdm_offset);
+    this->cq = reinterpret_cast<NVMeCompletion*>(pmm::alloc<uint64_t>(DIV_ROUNDUP(depth * sizeof(NVMeCompletion), PAGE_SIZE)) + hhdm_offset);
+    this->prps = reinterpret_cast<uint64_t*>(pmm::alloc<uint64_t>() + hhdm_offset);
+    this->entries = new sgentry[PRP_ENTRIES];
+}
+
+void NVMeQueue::setprps(NVMeCommand &cmd, sgentry *entries, size_t count)
+{
+    cmd.PRP1 = entries[0].phys;
+    cmd.PRP2 = 0;
+
+    if (count == 2) cmd.PRP2 = entries[1].phys;
+    else if (count > 2)
+    {
+        for (size_t i = 1; i < count; i++) this->prps[i - 1] = entries[i].phys;
+        cmd.PRP2 = reinterpret_cast<uint64_t>(this->prps) - hhdm_offset;
+    }
+}
+
+void NVMeQueue::reap()
+{
+    if (__atomic_test_and_set(&this->reaping, __ATOMIC_ACQUIRE)) return;
+
+    bool consumed = false;
+    while ((this->cq[this->cqhead].Status & 1) == this->phase)
+    {
+        this->result = this->cq[this->cqhead].Result;
+        this->status = this->cq[this->cqhead].Status >> 1;
+        this->done = true;
+        consumed = true;
+
+        if (++this->cqhead == this->depth)
+        {
+            this->cqhead = 0;
+            this->phase ^= 1;
+        }
+    }
+    if (consumed) *this->cqdb = this->cqhead;
+
+    __atomic_clear(&this->reaping, __ATOMIC_RELEASE);
+    if (consumed) this->waiters.wake();
+}
+
+bool NVMeQueue::submit(NVMeCommand &cmd, uint32_t *result)
+{
+    cmd.CommandID = this->cid++;
+    this->done = false;
+
+    memcpy(&this->sq[this->sqtail], &cmd, sizeof(NVMeCommand));
+    if (++this->sqtail == this->depth) this->sqtail = 0;
+    *this->sqdb = this->sqtail;
+
+    // Queues without an interrupt (the admin queue) are polled
+    scheduler::thread_t *thread = this->vector ? this_thread() : nullptr;
+    while (!this->done)
+    {
+        if (thread == nullptr)
+        {
+            this->reap();
+            asm volatile ("pause");
+            continue;
+        }
+
+        this->waiters.add(thread);
+        this->reap();
+        if (!this->done) thread->block();
+        this->waiters.remove(thread);
+    }
+
+    if (result) *result = this->result;
+    if (this->status)
+    {
+        error("NVMe: Queue #%d: Command 0x%X failed with status 0x%X!", this->qid, cmd.Opcode, this->status);
+        return false;
+    }
+    return true;
+}
+
+// submit() may sleep, so I/O owns the queue through a flag rather than the spinlock
+void NVMeQueue::acquire()
+{
+    scheduler::thread_t *thread = this->vector ? this_thread() : nullptr;
+    while (true)
+    {
+        this->lock.lock();
+        if (this->busy == false)
+        {
+            this->busy = true;
+            this->lock.unlock();
+            return;
+        }
+        if (thread != nullptr) this->owners.add(thread);
+        this->lock.unlock();
+
+        if (thread == nullptr)
+        {
+            asm volatile ("pause");
+            continue;
+        }
+        if (this->busy) thread->block();
+        this->owners.remove(thread);
+    }
+}
+
+void NVMeQueue::release()
+{
+    this->lock.lock();
+    this->busy = false;
+    this->lock.unlock();
+    this->owners.wake();
+}
+
+bool NVMeNamespace::transfer(uint64_t sector, uint64_t count, sglist &list, bool write)
+{
+    sgcursor cursor;
+    while (count > 0)
+    {
+        uint64_t max = (count > this->max_sectors ? this->max_sectors : count) * this->stat.blksize;
+
+        NVMeQueue *queue = this->controller->get_queue();
+        queue->acquire();
+
+        size_t num = list.gather(cursor, queue->entries, PRP_ENTRIES, max, PAGE_SIZE, PAGE_SIZE, this->stat.blksize);
+
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < num; i++) bytes += queue->entries[i].size;
+        if (bytes == 0)
+        {
+            queue->release();
+            return false;
+        }
+
+        uint64_t num_sectors = bytes / this->stat.blksize;
+
+        NVMeCommand cmd;
+        memset(&cmd, 0, sizeof(NVMeCommand));
+        cmd.Opcode = write ? NVME_CMD_WRITE : NVME_CMD_READ;
+        cmd.NSID = this->nsid;
+        cmd.CDW10 = static_cast<uint32_t>(sector);
+        cmd.CDW11 = static_cast<uint32_t>(sector >> 32);
+        cmd.CDW12 = static_cast<uint16_t>(num_sectors - 1);
+        queue->setprps(cmd, queue->entries, num);
+
+        bool ok = queue->submit(cmd);
+        queue->release();
+        if (!ok)
+        {
+            error("NVMe: Namespace #%d: %s error!", this->nsid, write ? "Write" : "Read");
+            return false;
+        }
+
+        sector += num_sectors;
+        count -= num_sectors;
+    }
+    return true;
+}
+
+NVMeNamespace::NVMeNamespace(NVMeController *controller, uint32_t nsid)
+{
+    log("NVMe: Initialising namespace #%d", nsid);
+    this->controller = controller;
+    this->nsid = nsid;
+
+    NVMeIdentifyNamespace *data = reinterpret_cast<NVMeIdentifyNamespace*>(pmm::alloc<uint64_t>() + hhdm_offset);
+    if (!controller->identify(NVME_IDENTIFY_NAMESPACE, nsid, data))
+    {
+        error("NVMe: Namespace #%d: Identify error!", nsid);
+        pmm::free(reinterpret_cast<uint8_t*>(data) - hhdm_offset);
+        return;
+    }
+
+    if (data->Size == 0)
+    {
+        pmm::free(reinterpret_cast<uint8_t*>(data) - hhdm_offset);
+        return;
+    }
+
+    NVMeLBAFormat &format = data->LBAFormats[data->FormattedLBASize & 0x0F];
+    this->sectors = data->Size;
+    this->buffer = pmm::alloc<uint8_t*>();
+    pmm::free(reinterpret_cast<uint8_t*>(data) - hhdm_offset);
+
+    this->stat.blocks = this->sectors;
+    this->stat.blksize = 1 << format.DataSize;
+    this->stat.size = this->stat.blocks * this->stat.blksize;
+    this->stat.rdev = vfs::dev_new_id();
+    this->stat.mode = 0644 | vfs::stats::ifblk;
+
+    this->max_sectors = controller->max_transfer / this->stat.blksize;
+    if (this->max_sectors > 0x10000) this->max_sectors = 0x10000;
+
+    this->dma_align = 4;
+    this->dma_pages = true;
+
+    log("NVMe: Namespace #%d: %zu sectors of %zu bytes", nsid, this->sectors, this->stat.blksize);
+    this->initialised = true;
+}
+
+NVMeQueue *NVMeController::get_queue()
+{
+    return this->ioqueues[this_cpu->id % this->ioqueues.size()];
+}
+
+bool NVMeController::identify(uint8_t cns, uint32_t nsid, void *data)
+{
+    lockit(this->adminqueue->lock);
+
+    NVMeCommand cmd;
+    memset(&cmd, 0, sizeof(NVMeCommand));
+    cmd.Opcode = NVME_ADMIN_IDENTIFY;
+    cmd.NSID = nsid;
+    cmd.PRP1 = reinterpret_cast<uint64_t>(data) - hhdm_offset;
+    cmd.CDW10 = cns;
+
+    return this->adminqueue->submit(cmd);
+}
+
+bool NVMeController::reset()
+{
+    uint64_t timeout = ((this->bar->Capabilities >> 24) & 0xFF) * 500;
+
+    this->bar->Configuration &= ~NVME_CC_EN;
+    size_t spin = timeout;
+    while (spin-- && (this->bar->Status & NVME_CSTS_RDY)) timer::msleep(1);
+    if (this->bar->Status & NVME_CSTS_RDY)
+    {
+        error("NVMe: Controller disable timed out!");
+        return false;
+    }
+
+    this->adminqueue = new NVMeQueue(0, ADMIN_QUEUE_DEPTH, this->doorbell(0, false), this->doorbell(0, true));
+
+    this->bar->AdminQueueAttributes = (ADMIN_QUEUE_DEPTH - 1) | ((ADMIN_QUEUE_DEPTH - 1) << 16);
+    this->bar->AdminSubmissionQueue = this->adminqueue->sq_phys();
+    this->bar->AdminCompletionQueue = this->adminqueue->cq_phys();
+
+    this->bar->Configuration = NVME_CC_EN | NVME_CC_CSS_NVM | NVME_CC_MPS_4K | NVME_CC_AMS_RR | NVME_CC_IOSQES | NVME_CC_IOCQES;
+
+    spin = timeout;
+    while (spin-- && !(this->bar->Status & (NVME_CSTS_RDY | NVME_CSTS_CFS))) timer::msleep(1);
+    if (this->bar->Status & NVME_CSTS_CFS)
+    {
+        error("NVMe: Controller fatal status!");
+        return false;
+    }
+    if (!(this->bar->Status & NVME_CSTS_RDY))
+    {
+        error("NVMe: Controller enable timed out!");
+        return false;
+    }
+
+    return true;
+}
+
+bool NVMeController::setup_ioqueues()
+{
+    // Entry 0 belongs to the admin queue, so per-queue vectors need at
+    // least two MSI-X entries. Otherwise every queue shares one interrupt
+    size_t vectors = this->pcidevice->msix_count();
+    bool msix = vectors > 1;
+
+    size_t count = smp_request.response->cpu_count;
+    if (msix && vectors - 1 < count) count = vectors - 1;
+    if (count == 0) count = 1;
+
+    lockit(this->adminqueue->lock);
+
+    NVMeCommand cmd;
+    memset(&cmd, 0, sizeof(NVMeCommand));
+    cmd.Opcode = NVME_ADMIN_SET_FEATURES;
+    cmd.CDW10 = NVME_FEAT_NUM_QUEUES;
+    cmd.CDW11 = (count - 1) | ((count - 1) << 16);
+
+    uint32_t result = 0;
+    if (!this->adminqueue->submit(cmd, &result))
+    {
+        error("NVMe: Could not set number of queues!");
+        return false;
+    }
+
+    size_t allocated = (result & 0xFFFF) < (result >> 16) ? (result & 0xFFFF) : (result >> 16);
+    if (allocated + 1 < count) count = allocated + 1;
+
+    uint16_t depth = (this->bar->Capabilities & 0xFFFF) + 1;
+    if (depth > IO_QUEUE_DEPTH) depth = IO_QUEUE_DEPTH;
+
+    uint8_t shared = 0;
+    if (!msix) shared = this->pcidevice->irq_set(NVMe_Handler, reinterpret_cast<uint64_t>(this));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint16_t qid = i + 1;
+        NVMeQueue *queue = new NVMeQueue(qid, depth, this->doorbell(qid, false), this->doorbell(qid, true));
+
+        uint16_t iv = 0;
+        if (msix)
+        {
+            iv = qid;
+            queue->vector = idt::alloc_vector();
+            idt::register_interrupt_handler(queue->vector, NVMe_QueueHandler, reinterpret_cast<uint64_t>(queue), false);
+            this->pcidevice->msix_set(iv, queue->vector, smp_request.response->cpus[i]->lapic_id);
+        }
+        else queue->vector = shared;
+
+        memset(&cmd, 0, sizeof(NVMeCommand));
+        cmd.Opcode = NVME_ADMIN_CREATE_CQ;
+        cmd.PRP1 = queue->cq_phys();
+        cmd.CDW10 = qid | ((depth - 1) << 16);
+        cmd.CDW11 = NVME_QUEUE_PHYS_CONTIG | NVME_CQ_IRQ_ENABLED | (iv << 16);
+        if (!this->adminqueue->submit(cmd))
+        {
+            error("NVMe: Could not create completion queue #%d!", qid);
+            return false;
+        }
+
+        memset(&cmd, 0, sizeof(NVMeCommand));
+        cmd.Opcode = NVME_ADMIN_CREATE_SQ;
+        cmd.PRP1 = queue->sq_phys();
+        cmd.CDW10 = qid | ((depth - 1) << 16);
+        cmd.CDW11 = NVME_QUEUE_PHYS_CONTIG | (qid << 16);
+        if (!this->adminqueue->submit(cmd))
+        {
+            error("NVMe: Could not create submission queue #%d!", qid);
+            return false;
+        }
+
+        this->ioqueues.push_back(queue);
+    }
+
+    log("NVMe: Created %zu I/O queue pairs", this->ioqueues.size());
+    return true;
+}
+
+NVMeController::NVMeController(pci::pcidevice_t *pcidevice)
+{
+    this->pcidevice = pcidevice;
+    log("Registering NVMe driver #%zu", devices.size());
+
+    pcidevice->command(pci::CMD_BUS_MAST | pci::CMD_MEM_SPACE, true);
+
+    this->bar = reinterpret_cast<NVMeBar*>(pcidevice->get_bar(0).address);
+    this->stride = 4 << ((this->bar->Capabilities >> 32) & 0x0F);
+
+    if (((this->bar->Capabilities >> 48) & 0x0F) != 0)
+    {
+        error("NVMe: Controller does not support 4 KiB pages!");
+        return;
+    }
+
+    if (!this->reset()) return;
+
+    NVMeIdentifyController *data = reinterpret_cast<NVMeIdentifyController*>(pmm::alloc<uint64_t>() + hhdm_offset);
+    if (!this->identify(NVME_IDENTIFY_CONTROLLER, 0, data))
+    {
+        error("NVMe: Identify error!");
+        pmm::free(reinterpret_cast<uint8_t*>(data) - hhdm_offset);
+        return;
+    }
+
+    this->max_transfer = PRP_ENTRIES * PAGE_SIZE;
+    if (data->MaxDataTransferSize && (PAGE_SIZE << data->MaxDataTransferSize) < this->max_transfer)
+    {
+        this->max_transfer = PAGE_SIZE << data->MaxDataTransferSize;
+    }
+    uint32_t nscount = data->NamespaceCount;
+    pmm::free(reinterpret_cast<uint8_t*>(data) - hhdm_offset);
+
+    if (!this->setup_ioqueues()) return;
+
+    for (uint32_t nsid = 1; nsid <= nscount; nsid++)
+    {
+        this->namespaces.push_back(new NVMeNamespace(this, nsid));
+        if (this->namespaces.back()->initialised == false)
+        {
+            free(this->namespaces.back());
+            this->namespaces.pop_back();
+        }
+    }
+
+    if (namespaces.size() == 0)
+    {
+        error("NVMe: No namespaces found!");
+        return;
+    }
+
+    this->initialised = true;
+}
+
+void init()
+{
+    log("Initialising NVMe driver");
+
+    if (initialised)
+    {
+        warn("NVMe driver has already been initialised!\n");
+        return;
+    }
+
+    size_t count = pci::count(0x01, 0x08, 0x02);
+    if (count == 0)
+    {
+        error("No NVMe devices found!\n");
+        return;
+    }
+
+    devices.init(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t event = boot::event_begin("NVMe controller probe");
+        devices.push_back(new NVMeController(pci::search(0x01, 0x08, 0x02, i)));
+        boot::event_end(event);
+        if (devices.back()->initialised == false)
+        {
+            free(devices.back());
+            devices.pop_back();
+        }
+    }
+
+    serial::newline();
+    if (devices.size() != 0) initialised = true;
+}
+}
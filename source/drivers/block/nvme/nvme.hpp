@@ -0,0 +1,277 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <drivers/block/drivemgr/drivemgr.hpp>
+#include <system/mm/pmm/pmm.hpp>
+#include <system/pci/pci.hpp>
+#include <kernel/kernel.hpp>
+#include <lib/lock.hpp>
+#include <cstdint>
+
+using namespace kernel::system::mm;
+using namespace kernel::system;
+
+namespace kernel::drivers::block::nvme {
+
+static constexpr uint64_t PAGE_SIZE = 0x1000;
+static constexpr uint64_t PRP_ENTRIES = PAGE_SIZE / sizeof(uint64_t);
+static constexpr uint16_t ADMIN_QUEUE_DEPTH = 64;
+static constexpr uint16_t IO_QUEUE_DEPTH = 64;
+
+enum cc
+{
+    NVME_CC_EN = (1 << 0),
+    NVME_CC_CSS_NVM = (0 << 4),
+    NVME_CC_MPS_4K = (0 << 7),
+    NVME_CC_AMS_RR = (0 << 11),
+    NVME_CC_SHN_NORMAL = (1 << 14),
+    NVME_CC_IOSQES = (6 << 16),
+    NVME_CC_IOCQES = (4 << 20)
+};
+
+enum csts
+{
+    NVME_CSTS_RDY = (1 << 0),
+    NVME_CSTS_CFS = (1 << 1)
+};
+
+enum admincmds
+{
+    NVME_ADMIN_CREATE_SQ = 0x01,
+    NVME_ADMIN_CREATE_CQ = 0x05,
+    NVME_ADMIN_IDENTIFY = 0x06,
+    NVME_ADMIN_SET_FEATURES = 0x09
+};
+
+enum iocmds
+{
+    NVME_CMD_FLUSH = 0x00,
+    NVME_CMD_WRITE = 0x01,
+    NVME_CMD_READ = 0x02
+};
+
+enum identify
+{
+    NVME_IDENTIFY_NAMESPACE = 0x00,
+    NVME_IDENTIFY_CONTROLLER = 0x01
+};
+
+enum features
+{
+    NVME_FEAT_NUM_QUEUES = 0x07
+};
+
+enum queueflags
+{
+    NVME_QUEUE_PHYS_CONTIG = (1 << 0),
+    NVME_CQ_IRQ_ENABLED = (1 << 1)
+};
+
+using NVMeBar = volatile struct [[gnu::packed]]
+{
+    uint64_t Capabilities;
+    uint32_t Version;
+    uint32_t InterruptMaskSet;
+    uint32_t InterruptMaskClear;
+    uint32_t Configuration;
+    uint32_t Reserved0;
+    uint32_t Status;
+    uint32_t SubsystemReset;
+    uint32_t AdminQueueAttributes;
+    uint64_t AdminSubmissionQueue;
+    uint64_t AdminCompletionQueue;
+};
+
+struct [[gnu::packed]] NVMeCommand
+{
+    uint8_t Opcode;
+    uint8_t Flags;
+    uint16_t CommandID;
+    uint32_t NSID;
+    uint64_t Reserved0;
+    uint64_t MetadataPtr;
+    uint64_t PRP1;
+    uint64_t PRP2;
+    uint32_t CDW10;
+    uint32_t CDW11;
+    uint32_t CDW12;
+    uint32_t CDW13;
+    uint32_t CDW14;
+    uint32_t CDW15;
+};
+
+using NVMeCompletion = volatile struct [[gnu::packed]]
+{
+    uint32_t Result;
+    uint32_t Reserved0;
+    uint16_t SQHead;
+    uint16_t SQID;
+    uint16_t CommandID;
+    uint16_t Status;
+};
+
+struct [[gnu::packed]] NVMeIdentifyController
+{
+    uint16_t VendorID;
+    uint16_t SubsystemVendorID;
+    char SerialNumber[20];
+    char ModelNumber[40];
+    char FirmwareRevision[8];
+    uint8_t RecommendedArbitrationBurst;
+    uint8_t IEEE[3];
+    uint8_t CMIC;
+    uint8_t MaxDataTransferSize;
+    uint8_t Reserved0[434];
+    uint8_t SubmissionQueueEntrySize;
+    uint8_t CompletionQueueEntrySize;
+    uint16_t MaxCommand;
+    uint32_t NamespaceCount;
+    uint8_t Reserved1[3576];
+};
+
+struct [[gnu::packed]] NVMeLBAFormat
+{
+    uint16_t MetadataSize;
+    uint8_t DataSize;
+    uint8_t RelativePerformance;
+};
+
+struct [[gnu::packed]] NVMeIdentifyNamespace
+{
+    uint64_t Size;
+    uint64_t Capacity;
+    uint64_t Utilisation;
+    uint8_t Features;
+    uint8_t LBAFormatCount;
+    uint8_t FormattedLBASize;
+    uint8_t Reserved0[101];
+    NVMeLBAFormat LBAFormats[16];
+    uint8_t Reserved1[3904];
+};
+
+class NVMeQueue
+{
+    private:
+    NVMeCommand *sq;
+    NVMeCompletion *cq;
+    volatile uint32_t *sqdb;
+    volatile uint32_t *cqdb;
+
+    uint16_t sqtail = 0;
+    uint16_t cqhead = 0;
+    uint16_t phase = 1;
+    uint16_t cid = 0;
+
+    volatile bool reaping = false;
+    volatile bool done = false;
+    volatile uint16_t status = 0;
+    volatile uint32_t result = 0;
+
+    uint64_t *prps;
+    scheduler::waitqueue_t waiters;
+
+    volatile bool busy = false;
+    scheduler::waitqueue_t owners;
+
+    public:
+    sgentry *entries;
+    lock_t lock;
+    uint16_t qid;
+    uint16_t depth;
+    uint8_t vector = 0;
+
+    uint64_t sq_phys()
+    {
+        return reinterpret_cast<uint64_t>(this->sq) - hhdm_offset;
+    }
+    uint64_t cq_phys()
+    {
+        return reinterpret_cast<uint64_t>(this->cq) - hhdm_offset;
+    }
+
+    void setprps(NVMeCommand &cmd, sgentry *entries, size_t count);
+    void reap();
+    bool submit(NVMeCommand &cmd, uint32_t *result = nullptr);
+
+    void acquire();
+    void release();
+
+    NVMeQueue(uint16_t qid, uint16_t depth, volatile uint32_t *sqdb, volatile uint32_t *cqdb);
+};
+
+class NVMeController;
+class NVMeNamespace : public drivemgr::Drive
+{
+    private:
+    NVMeController *controller;
+    uint32_t nsid;
+
+    public:
+    bool initialised = false;
+    uint64_t max_sectors;
+
+    bool transfer(uint64_t sector, uint64_t count, sglist &list, bool write);
+
+    int ioctl(void *handle, uint64_t request, void *argp)
+    {
+        return default_ioctl(this, request, argp);
+    }
+
+    void unref(void *handle)
+    {
+        this->refcount--;
+    }
+
+    void link(void *handle)
+    {
+        this->stat.nlink++;
+    }
+
+    void unlink(void *handle)
+    {
+        this->stat.nlink--;
+    }
+
+    void *mmap(uint64_t page, int flags)
+    {
+        return nullptr;
+    }
+
+    NVMeNamespace(NVMeController *controller, uint32_t nsid);
+};
+
+class NVMeController
+{
+    private:
+    pci::pcidevice_t *pcidevice;
+    uint64_t stride;
+
+    bool reset();
+    bool setup_ioqueues();
+
+    volatile uint32_t *doorbell(uint16_t qid, bool cq)
+    {
+        return reinterpret_cast<volatile uint32_t*>(reinterpret_cast<uint64_t>(this->bar) + 0x1000 + (2 * qid + cq) * this->stride);
+    }
+
+    public:
+    bool initialised = false;
+    NVMeBar *bar;
+    NVMeQueue *adminqueue;
+    vector<NVMeQueue*> ioqueues;
+    vector<NVMeNamespace*> namespaces;
+
+    uint64_t max_transfer;
+
+    NVMeQueue *get_queue();
+    bool identify(uint8_t cns, uint32_t nsid, void *data);
+
+    NVMeController(pci::pcidevice_t *pcidevice);
+};
+
+extern bool initialised;
+extern vector<NVMeController*> devices;
+
+void init();
+}
@@ -4,6 +4,7 @@
 
 #define PRINTF_ALIAS_STANDARD_FUNCTION_NAMES 1
 #include <printf/printf.h>
+#include <system/boot/timing.hpp>
 #include <lib/math.hpp>
 #include <limine.h>
 #include <cstdint>
@@ -39,10 +40,18 @@ static void check(const char *message, auto init, int64_t args, bool &ok, bool s
 {
     printf(term, "\033[1m[\033[21m*\033[0m\033[1m]\033[21m %s", message);
 
+    size_t event = kernel::system::boot::event_begin(message);
     if (shouldinit) reinterpret_cast<void (*)(uint64_t)>(init)(args);
+    kernel::system::boot::event_end(event);
 
     printf(term, "\033[2G\033[%s\033[0m\033[%dG\033[1m[\033[21m \033[%s\033[0m \033[1m]\033[21m", (ok ? "32m*" : "31m*"), term->columns - 5, (ok ? "32mOK" : "31m!!"));
 }
+
+static void report(const char *message, bool ok, limine_terminal *term = main_term)
+{
+    printf(term, "\033[1m[\033[21m*\033[0m\033[1m]\033[21m %s", message);
+    printf(term, "\033[2G\033[%s\033[0m\033[%dG\033[1m[\033[21m \033[%s\033[0m \033[1m]\033[21m", (ok ? "32m*" : "31m*"), term->columns - 5, (ok ? "32mOK" : "31m!!"));
+}
 }
 
 static inline int vprintf(limine_terminal *term, const char *fmt, va_list args)
@@ -25,6 +25,7 @@ devfs_fs *devfs = new devfs_fs;
 
 uint64_t inode_counter = 0;
 uint64_t dev_id = 0;
+new_lock(devfs_lock);
 
 int64_t devfs_res::read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
 {
@@ -209,6 +210,8 @@ vfs::fs_node_t *devfs_fs::mount(vfs::fs_node_t *parent, vfs::fs_node_t *source,
 
 bool add(vfs::resource_t *res, std::string name)
 {
+    lockit(devfs_lock);
+
     vfs::fs_node_t *node = vfs::create_node(devfs, devfs_root, name);
     if (node == nullptr) return false;
 
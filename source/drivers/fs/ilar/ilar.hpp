@@ -29,5 +29,6 @@ struct [[gnu::packed]] fileheader
 
 extern bool initialised;
 
+void index(uint64_t module);
 void init(uint64_t module);
 }
\ No newline at end of file
@@ -1,22 +1,259 @@
 // Copyright (C) 2021-2022  ilobilo
 
+#include <drivers/fs/initrd/initrd.hpp>
 #include <drivers/fs/ustar/ustar.hpp>
 #include <drivers/fs/ilar/ilar.hpp>
+#include <system/sched/rtc/rtc.hpp>
+#include <system/mm/pmm/pmm.hpp>
+#include <system/mm/vmm/vmm.hpp>
+#include <kernel/kernel.hpp>
+#include <lib/inflate.hpp>
+#include <lib/memory.hpp>
+#include <lib/math.hpp>
 #include <lib/log.hpp>
 
+using namespace kernel::system::sched;
+using namespace kernel::system::mm;
+
 namespace kernel::drivers::fs::initrd {
 
 bool initialised = false;
+initrd_fs *initrd = new initrd_fs;
+
+bool initrd_res::copyup()
+{
+    if (this->data == nullptr) return true;
+
+    for (uint64_t done = 0; done < static_cast<uint64_t>(this->stat.size); done += vmm::page_size)
+    {
+        uint64_t page = this->getpage(done / vmm::page_size, true);
+        if (page == 0)
+        {
+            errno_set(ENOSPC);
+            return false;
+        }
+
+        uint64_t chunk = this->stat.size - done;
+        if (chunk > vmm::page_size) chunk = vmm::page_size;
+        memcpy(reinterpret_cast<void*>(page + hhdm_offset), this->data + done, chunk);
+    }
+
+    this->data = nullptr;
+    return true;
+}
+
+int64_t initrd_res::read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
+{
+    this->lock.lock();
+    if (this->data == nullptr)
+    {
+        this->lock.unlock();
+        return tmpfs::tmpfs_res::read(handle, buffer, offset, size);
+    }
+
+    if (offset >= static_cast<uint64_t>(this->stat.size))
+    {
+        this->lock.unlock();
+        return 0;
+    }
+
+    if (offset + size > static_cast<uint64_t>(this->stat.size)) size = this->stat.size - offset;
+    memcpy(buffer, this->data + offset, size);
+
+    this->lock.unlock();
+    return size;
+}
+
+int64_t initrd_res::write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
+{
+    this->lock.lock();
+    bool ret = this->copyup();
+    this->lock.unlock();
+
+    if (ret == false) return -1;
+    return tmpfs::tmpfs_res::write(handle, buffer, offset, size);
+}
+
+bool initrd_res::grow(void *handle, size_t new_size)
+{
+    this->lock.lock();
+    bool ret = this->copyup();
+    this->lock.unlock();
+
+    if (ret == false) return false;
+    return tmpfs::tmpfs_res::grow(handle, new_size);
+}
+
+void *initrd_res::mmap(uint64_t page, int flags)
+{
+    this->lock.lock();
+    if (this->data == nullptr || (flags & vmm::MapShared))
+    {
+        bool ret = this->copyup();
+        this->lock.unlock();
+
+        if (ret == false) return nullptr;
+        return tmpfs::tmpfs_res::mmap(page, flags);
+    }
+
+    void *copy = pmm::alloc();
+    uint64_t offset = page * vmm::page_size;
+    if (offset < static_cast<uint64_t>(this->stat.size))
+    {
+        uint64_t size = this->stat.size - offset;
+        if (size > vmm::page_size) size = vmm::page_size;
+        memcpy(reinterpret_cast<void*>(reinterpret_cast<uint64_t>(copy) + hhdm_offset), this->data + offset, size);
+    }
+
+    this->lock.unlock();
+    return copy;
+}
+
+void initrd_fs::populate(vfs::fs_node_t *node)
+{
+    if (this->indexed == false)
+    {
+        this->indexed = true;
+        if (this->format == ILAR) ilar::index(this->module);
+        else if (this->format == USTAR) ustar::index(this->module);
+    }
+
+    std::string path = vfs::node2path(node);
+    if (path == "/") path = "";
+
+    for (archive_entry *entry : this->entries)
+    {
+        if (entry->parent != path) continue;
+
+        bool exists = false;
+        for (vfs::fs_node_t *child : node->children)
+        {
+            if (child->name == entry->name)
+            {
+                exists = true;
+                break;
+            }
+        }
+        if (exists) continue;
+
+        vfs::fs_node_t *child = nullptr;
+        if (vfs::isdir(entry->mode))
+        {
+            child = this->create(node, entry->name, entry->mode);
+            child->dotentries(node);
+        }
+        else if (vfs::islnk(entry->mode)) child = this->symlink(node, entry->name, entry->link);
+        else
+        {
+            child = vfs::create_node(this, node, entry->name);
+
+            initrd_res *res = new initrd_res;
+            res->refcount = 1;
+            res->can_mmap = true;
+            res->data = entry->data;
+
+            res->stat.size = entry->size;
+            res->stat.blocks = DIV_ROUNDUP(entry->size, 512);
+            res->stat.blksize = 512;
+            res->stat.dev = this->dev_id;
+            res->stat.inode = this->inode_counter++;
+            res->stat.mode = entry->mode;
+            res->stat.nlink = 1;
+
+            vfs::timespec_t epoch { static_cast<int64_t>(rtc::epoch()), 0 };
+            res->stat.atime = epoch;
+            res->stat.mtime = epoch;
+            res->stat.ctime = epoch;
+
+            child->res = res;
+        }
+
+        child->res->stat.uid = entry->uid;
+        child->res->stat.gid = entry->gid;
+        node->children.push_back(child);
+    }
+}
+
+void add(std::string path, std::string link, uint8_t *data, uint64_t size, int mode, uint32_t uid, uint32_t gid)
+{
+    path = vfs::path2normal("/" + path);
+    if (path == "/") return;
+
+    const char *str = path.c_str();
+    size_t slash = 0;
+    for (size_t i = 0; str[i]; i++) if (str[i] == '/') slash = i;
+
+    archive_entry *entry = new archive_entry;
+    entry->parent = std::string(str, slash);
+    entry->name = std::string(str + slash + 1);
+    entry->link = link;
+    entry->data = data;
+    entry->size = size;
+    entry->mode = mode;
+    entry->uid = uid;
+    entry->gid = gid;
+
+    initrd->entries.push_back(entry);
+}
+
+static uint64_t decompress(uint64_t module)
+{
+    auto initrd_mod = reinterpret_cast<limine_file*>(module);
+    uint8_t *data = reinterpret_cast<uint8_t*>(initrd_mod->address);
+    if (gzip_check(data, initrd_mod->size) == false) return module;
+
+    uint64_t size = gzip_size(data, initrd_mod->size);
+    if (size == 0)
+    {
+        error("Initrd: Compressed image is empty!\n");
+        return 0;
+    }
+
+    uint64_t pages = DIV_ROUNDUP(size, vmm::page_size);
+    uint8_t *buffer = pmm::alloc<uint8_t*>(pages) + hhdm_offset;
+    if (gunzip(data, initrd_mod->size, buffer, size) != static_cast<int64_t>(size))
+    {
+        error("Initrd: Could not decompress image!\n");
+        pmm::free(buffer - hhdm_offset, pages);
+        return 0;
+    }
+
+    log("Initrd: Decompressed %zu KiB image to %zu KiB", initrd_mod->size / 1024, size / 1024);
+
+    uint64_t base = reinterpret_cast<uint64_t>(data) - hhdm_offset;
+    pmm::free(reinterpret_cast<void*>(ALIGN_DOWN(base, vmm::page_size)), DIV_ROUNDUP(base % vmm::page_size + initrd_mod->size, vmm::page_size));
+
+    limine_file *unpacked = new limine_file;
+    *unpacked = *initrd_mod;
+    unpacked->address = buffer;
+    unpacked->size = size;
+    return reinterpret_cast<uint64_t>(unpacked);
+}
 
 void init(uint64_t module)
 {
+    module = decompress(module);
+    if (module == 0) return;
+
     ilar::init(module);
-    if (ilar::initialised == false)
+    if (ilar::initialised) initrd->format = ILAR;
+    else
     {
         ustar::init(module);
         if (ustar::initialised == false) return;
+        initrd->format = USTAR;
     }
 
+    vfs::fs_node_t *root = vfs::get_node(nullptr, "/", true);
+    if (root == nullptr) return;
+
+    initrd->name = "initrd";
+    initrd->module = module;
+    initrd->dev_id = tmpfs::tmpfs->dev_id;
+
+    root->fs = initrd;
+    root->populated = false;
+
     initialised = true;
 }
-}
\ No newline at end of file
+}
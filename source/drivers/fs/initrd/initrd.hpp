@@ -2,10 +2,60 @@
 
 #pragma once
 
+#include <drivers/fs/tmpfs/tmpfs.hpp>
+#include <system/vfs/vfs.hpp>
+#include <lib/string.hpp>
+#include <lib/vector.hpp>
 #include <cstdint>
 
+using namespace kernel::system;
+
 namespace kernel::drivers::fs::initrd {
 
+enum format_t
+{
+    NONE,
+    ILAR,
+    USTAR
+};
+
+struct archive_entry
+{
+    std::string parent;
+    std::string name;
+    std::string link;
+    uint8_t *data;
+    uint64_t size;
+    int mode;
+    uint32_t uid;
+    uint32_t gid;
+};
+
+struct initrd_res : tmpfs::tmpfs_res
+{
+    uint8_t *data = nullptr;
+
+    bool copyup();
+
+    int64_t read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size);
+    int64_t write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size);
+    bool grow(void *handle, size_t new_size);
+    void *mmap(uint64_t page, int flags);
+};
+
+struct initrd_fs : tmpfs::tmpfs_fs
+{
+    uint64_t module = 0;
+    format_t format = NONE;
+    bool indexed = false;
+    vector<archive_entry*> entries;
+
+    void populate(vfs::fs_node_t *node);
+};
+
 extern bool initialised;
+extern initrd_fs *initrd;
+
+void add(std::string path, std::string link, uint8_t *data, uint64_t size, int mode, uint32_t uid, uint32_t gid);
 void init(uint64_t module);
-}
\ No newline at end of file
+}
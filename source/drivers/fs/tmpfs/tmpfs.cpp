@@ -19,38 +19,135 @@ namespace kernel::drivers::fs::tmpfs {
 bool initialised = false;
 tmpfs_fs *tmpfs = new tmpfs_fs;
 
+static radix_node *node_at(uint64_t phys)
+{
+    return reinterpret_cast<radix_node*>(phys + hhdm_offset);
+}
+
+static bool prune(uint64_t phys, size_t level, uint64_t base, uint64_t first, bool release)
+{
+    radix_node *node = node_at(phys);
+    uint64_t span = 1UL << (RADIX_BITS * level);
+
+    for (size_t i = 0; i < RADIX_SLOTS; i++)
+    {
+        uint64_t start = base + i * span;
+        if (node->slots[i] == 0 || start + span <= first) continue;
+
+        if (level > 0)
+        {
+            if (prune(node->slots[i], level - 1, start, first, release)) node->slots[i] = 0;
+        }
+        else if (release)
+        {
+            pmm::free(reinterpret_cast<void*>(node->slots[i]));
+            node->slots[i] = 0;
+        }
+        else memset(reinterpret_cast<void*>(node->slots[i] + hhdm_offset), 0, vmm::page_size);
+    }
+
+    if (release == false || base < first) return false;
+
+    pmm::free(reinterpret_cast<void*>(phys));
+    return true;
+}
+
+uint64_t tmpfs_res::getpage(uint64_t index, bool allocate)
+{
+    if (this->root == 0)
+    {
+        if (allocate == false) return 0;
+        this->root = pmm::alloc<uint64_t>();
+        this->height = 1;
+    }
+
+    while (RADIX_BITS * this->height < 64 && (index >> (RADIX_BITS * this->height)) != 0)
+    {
+        if (allocate == false) return 0;
+
+        uint64_t root = pmm::alloc<uint64_t>();
+        node_at(root)->slots[0] = this->root;
+        this->root = root;
+        this->height++;
+    }
+
+    radix_node *node = node_at(this->root);
+    for (size_t level = this->height - 1; level > 0; level--)
+    {
+        uint64_t &slot = node->slots[(index >> (RADIX_BITS * level)) & (RADIX_SLOTS - 1)];
+        if (slot == 0)
+        {
+            if (allocate == false) return 0;
+            slot = pmm::alloc<uint64_t>();
+        }
+        node = node_at(slot);
+    }
+
+    uint64_t &page = node->slots[index & (RADIX_SLOTS - 1)];
+    if (page == 0 && allocate) page = pmm::alloc<uint64_t>();
+    return page;
+}
+
+void tmpfs_res::truncate(uint64_t size)
+{
+    if (this->root == 0) return;
+
+    uint64_t tail = size % vmm::page_size;
+    if (tail != 0)
+    {
+        uint64_t page = this->getpage(size / vmm::page_size, false);
+        if (page != 0) memset(reinterpret_cast<void*>(page + hhdm_offset + tail), 0, vmm::page_size - tail);
+    }
+
+    if (prune(this->root, this->height - 1, 0, DIV_ROUNDUP(size, vmm::page_size), this->shared == false))
+    {
+        this->root = 0;
+        this->height = 0;
+    }
+}
+
 int64_t tmpfs_res::read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
 {
     lockit(this->lock);
 
+    if (offset >= static_cast<uint64_t>(this->stat.size)) return 0;
+
     uint64_t actual_size = size;
-    if (offset + size > static_cast<uint64_t>(this->stat.size))
+    if (offset + size > static_cast<uint64_t>(this->stat.size)) actual_size = this->stat.size - offset;
+
+    for (uint64_t done = 0; done < actual_size; )
     {
-        actual_size = size - ((offset + size) - this->stat.size);
+        uint64_t pageoff = (offset + done) % vmm::page_size;
+        uint64_t chunk = vmm::page_size - pageoff;
+        if (chunk > actual_size - done) chunk = actual_size - done;
+
+        uint64_t page = this->getpage((offset + done) / vmm::page_size, false);
+        if (page != 0) memcpy(buffer + done, reinterpret_cast<uint8_t*>(page + hhdm_offset) + pageoff, chunk);
+        else memset(buffer + done, 0, chunk);
+
+        done += chunk;
     }
-    memcpy(buffer, this->storage + offset, actual_size);
 
     return actual_size;
 }
 
 int64_t tmpfs_res::write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
 {
+    if (size == 0) return 0;
     lockit(this->lock);
 
-    if (offset + size > this->cap)
+    for (uint64_t done = 0; done < size; )
     {
-        uint64_t new_cap = this->cap;
-        while (offset + size > new_cap) new_cap *= 2;
+        uint64_t pageoff = (offset + done) % vmm::page_size;
+        uint64_t chunk = vmm::page_size - pageoff;
+        if (chunk > size - done) chunk = size - done;
 
-        uint8_t *new_storage = realloc<uint8_t*>(this->storage, new_cap);
-        if (new_storage == nullptr || new_storage == this->storage) return 0;
+        uint64_t page = this->getpage((offset + done) / vmm::page_size, true);
+        memcpy(reinterpret_cast<uint8_t*>(page + hhdm_offset) + pageoff, buffer + done, chunk);
 
-        this->storage = new_storage;
-        this->cap = new_cap;
+        done += chunk;
     }
 
-    memcpy(this->storage + offset, buffer, size);
-
     if (offset + size > static_cast<uint64_t>(this->stat.size))
     {
         this->stat.size = offset + size;
@@ -69,14 +166,7 @@ bool tmpfs_res::grow(void *handle, size_t new_size)
 {
     lockit(this->lock);
 
-    uint64_t new_cap = this->cap;
-    while (new_size > new_cap) new_cap *= 2;
-
-    uint8_t *new_storage = realloc<uint8_t*>(this->storage, new_cap);
-    if (new_storage == nullptr || new_storage == this->storage) return false;
-
-    this->storage = new_storage;
-    this->cap = new_cap;
+    if (new_size < static_cast<uint64_t>(this->stat.size)) this->truncate(new_size);
 
     this->stat.size = new_size;
     this->stat.blocks = DIV_ROUNDUP(new_size, this->stat.blksize);
@@ -91,7 +181,7 @@ void tmpfs_res::unref(void *handle)
     this->refcount--;
     if (this->refcount == 0 && vfs::isreg(this->stat.mode))
     {
-        free(this->storage);
+        if (this->root != 0) prune(this->root, this->height - 1, 0, 0, true);
         free(this);
     }
 }
@@ -116,11 +206,13 @@ void *tmpfs_res::mmap(uint64_t page, int flags)
 
     if (flags & vmm::MapShared)
     {
-        return reinterpret_cast<void*>(reinterpret_cast<uint64_t>(&this->storage[page * vmm::page_size]) - hhdm_offset);
+        this->shared = true;
+        return reinterpret_cast<void*>(this->getpage(page, true));
     }
 
     void *copy = pmm::alloc();
-    memcpy(reinterpret_cast<void*>(reinterpret_cast<uint64_t>(copy) + hhdm_offset), &this->storage[page * vmm::page_size], vmm::page_size);
+    uint64_t source = this->getpage(page, false);
+    if (source != 0) memcpy(reinterpret_cast<void*>(reinterpret_cast<uint64_t>(copy) + hhdm_offset), reinterpret_cast<void*>(source + hhdm_offset), vmm::page_size);
 
     return copy;
 }
@@ -161,12 +253,7 @@ vfs::fs_node_t *tmpfs_fs::create(vfs::fs_node_t *parent, std::string name, int m
     tmpfs_res *res = new tmpfs_res;
     res->refcount = 1;
 
-    if (vfs::isreg(mode))
-    {
-        res->cap = 0x1000;
-        res->storage = malloc<uint8_t*>(0x1000);
-        res->can_mmap = true;
-    }
+    if (vfs::isreg(mode)) res->can_mmap = true;
 
     res->stat.size = 0;
     res->stat.blocks = 0;
@@ -8,6 +8,14 @@ using namespace kernel::system;
 
 namespace kernel::drivers::fs::tmpfs {
 
+static constexpr size_t RADIX_BITS = 9;
+static constexpr size_t RADIX_SLOTS = 1 << RADIX_BITS;
+
+struct radix_node
+{
+    uint64_t slots[RADIX_SLOTS];
+};
+
 struct tmpfs_fs : vfs::filesystem_t
 {
     uint64_t inode_counter = 0;
@@ -23,8 +31,12 @@ struct tmpfs_fs : vfs::filesystem_t
 
 struct tmpfs_res : vfs::resource_t
 {
-    uint8_t *storage;
-    uint64_t cap;
+    uint64_t root = 0;
+    size_t height = 0;
+    bool shared = false;
+
+    uint64_t getpage(uint64_t index, bool allocate);
+    void truncate(uint64_t size);
 
     int64_t read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size);
     int64_t write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size);
@@ -1,15 +1,13 @@
 // Copyright (C) 2021-2022  ilobilo
 
+#include <drivers/fs/initrd/initrd.hpp>
 #include <drivers/fs/ustar/ustar.hpp>
-#include <system/mm/pmm/pmm.hpp>
 #include <system/vfs/vfs.hpp>
-#include <kernel/kernel.hpp>
 #include <lib/string.hpp>
-#include <lib/memory.hpp>
 #include <lib/math.hpp>
 #include <lib/log.hpp>
+#include <limine.h>
 
-using namespace kernel::system::mm;
 using namespace kernel::system;
 
 namespace kernel::drivers::fs::ustar {
@@ -28,80 +26,59 @@ uint64_t oct2dec(const char *s)
     return ret;
 }
 
-void init(uint64_t module)
+void index(uint64_t module)
 {
-    log("Initialising USTAR");
-
-    if (initialised)
-    {
-        warn("USTAR has already been initialised!\n");
-        return;
-    }
-
     auto initrd_mod = reinterpret_cast<limine_file*>(module);
     uint64_t base = reinterpret_cast<uint64_t>(initrd_mod->address);
     uint64_t top = base + initrd_mod->size;
     uint64_t address = base;
 
-    while (true)
+    while (address + 512 <= top)
     {
         file_header_t *header = reinterpret_cast<file_header_t*>(address);
-        if (strcmp(header->signature, "ustar") || address >= top) break;
+        if (strcmp(header->signature, "ustar")) break;
 
         uint64_t size = oct2dec(header->size);
         uint64_t mode = oct2dec(header->mode);
-        std::string name(header->name);
-        std::string link(header->link);
-
-        vfs::fs_node_t *node = nullptr;
-        if (name == "./") goto next;
+        uint32_t uid = oct2dec(header->uid);
+        uint32_t gid = oct2dec(header->gid);
 
         switch (header->typeflag[0])
         {
             case DIRECTORY:
-                node = vfs::create(vfs::fs_root, name, mode | vfs::ifdir);
-                if (node == nullptr)
-                {
-                    error("USTAR: Could not create directory %s", name.c_str());
-                    goto next;
-                }
+                initrd::add(header->name, "", nullptr, 0, mode | vfs::ifdir, uid, gid);
                 break;
             case REGULAR_FILE:
-            {
-                node = vfs::create(vfs::fs_root, name, mode | vfs::ifreg);
-                if (node == nullptr)
-                {
-                    error("USTAR: Could not create file %s", name.c_str());
-                    goto next;
-                }
-                uint8_t *buffer = reinterpret_cast<uint8_t*>(reinterpret_cast<uint64_t>(header) + 512);
-                if (node->res->write(nullptr, buffer, 0, size) == -1)
-                {
-                    error("USTAR: Could not write to file %s", name.c_str());
-                    goto next;
-                }
+                initrd::add(header->name, "", reinterpret_cast<uint8_t*>(address + 512), size, mode | vfs::ifreg, uid, gid);
                 break;
-            }
             case SYMLINK:
-                node = vfs::symlink(vfs::fs_root, name, link);
-                if (node == nullptr)
-                {
-                    error("USTAR: Could not create symlink %s", name.c_str());
-                    goto next;
-                }
+                initrd::add(header->name, header->link, nullptr, 0, 0777 | vfs::iflnk, uid, gid);
                 break;
         }
 
-        node->res->stat.uid = oct2dec(header->uid);
-        node->res->stat.gid = oct2dec(header->gid);
-
-        next:
         address += 512 + ALIGN_UP(size, 512);
     }
+}
 
-    pmm::free(reinterpret_cast<void*>(ALIGN_DOWN(base - hhdm_offset, 0x1000)), ALIGN_UP(initrd_mod->size, 0x1000) / 0x1000);
+void init(uint64_t module)
+{
+    log("Initialising USTAR");
+
+    if (initialised)
+    {
+        warn("USTAR has already been initialised!\n");
+        return;
+    }
+
+    auto initrd_mod = reinterpret_cast<limine_file*>(module);
+    file_header_t *header = reinterpret_cast<file_header_t*>(initrd_mod->address);
+    if (initrd_mod->size < 512 || strcmp(header->signature, "ustar"))
+    {
+        error("USTAR: Invalid signature!\n");
+        return;
+    }
 
     serial::newline();
     initialised = true;
 }
-}
\ No newline at end of file
+}
@@ -39,5 +39,6 @@ struct file_header_t
 
 extern bool initialised;
 
+void index(uint64_t module);
 void init(uint64_t module);
 }
\ No newline at end of file
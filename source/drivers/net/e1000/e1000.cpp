@@ -2,6 +2,7 @@
 
 #include <system/net/ethernet/ethernet.hpp>
 #include <drivers/net/e1000/e1000.hpp>
+#include <system/boot/timing.hpp>
 #include <lib/shared_ptr.hpp>
 #include <lib/memory.hpp>
 #include <lib/mmio.hpp>
@@ -271,7 +272,9 @@ bool search(uint16_t vendorid, uint16_t deviceid)
 
     for (size_t i = 0; i < count; i++)
     {
+        size_t event = boot::event_begin("E1000 probe");
         devices.push_back(new E1000(pci::search(vendorid, deviceid, i), devices.size()));
+        boot::event_end(event);
         if (devices.back()->initialised == false)
         {
             free(devices.back());
@@ -2,6 +2,7 @@
 
 #include <system/net/ethernet/ethernet.hpp>
 #include <drivers/net/rtl8139/rtl8139.hpp>
+#include <system/boot/timing.hpp>
 #include <lib/shared_ptr.hpp>
 #include <lib/memory.hpp>
 #include <lib/log.hpp>
@@ -178,7 +179,9 @@ void init()
     devices.init(count);
     for (size_t i = 0; i < count; i++)
     {
+        size_t event = boot::event_begin("RTL8139 probe");
         devices.push_back(new RTL8139(pci::search(0x10EC, 0x8139, i), devices.size()));
+        boot::event_end(event);
         if (devices.back()->initialised == false)
         {
             free(devices.back());
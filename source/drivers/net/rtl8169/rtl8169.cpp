@@ -2,6 +2,7 @@
 
 #include <system/net/ethernet/ethernet.hpp>
 #include <drivers/net/rtl8169/rtl8169.hpp>
+#include <system/boot/timing.hpp>
 #include <lib/shared_ptr.hpp>
 #include <lib/memory.hpp>
 #include <lib/log.hpp>
@@ -217,7 +218,9 @@ bool search(uint16_t vendorid, uint16_t deviceid)
 
     for (size_t i = 0; i < count; i++)
     {
+        size_t event = boot::event_begin("RTL8169 probe");
         devices.push_back(new RTL8169(pci::search(vendorid, deviceid, i), devices.size()));
+        boot::event_end(event);
         if (devices.back()->initialised == false)
         {
             free(devices.back());
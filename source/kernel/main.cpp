@@ -8,6 +8,7 @@
 #include <drivers/net/rtl8139/rtl8139.hpp>
 #include <drivers/net/rtl8169/rtl8169.hpp>
 #include <system/cpu/syscall/syscall.hpp>
+#include <system/cpu/syscall/trace.hpp>
 #include <drivers/net/nicmgr/nicmgr.hpp>
 #include <drivers/display/ssfn/ssfn.hpp>
 #include <drivers/audio/pcspk/pcspk.hpp>
@@ -15,6 +16,7 @@
 #include <drivers/fs/initrd/initrd.hpp>
 #include <drivers/net/e1000/e1000.hpp>
 #include <drivers/block/ahci/ahci.hpp>
+#include <drivers/block/nvme/nvme.hpp>
 #include <drivers/fs/tmpfs/tmpfs.hpp>
 #include <drivers/fs/devfs/devfs.hpp>
 #include <system/sched/hpet/hpet.hpp>
@@ -22,12 +24,14 @@
 #include <drivers/block/ata/ata.hpp>
 #include <system/sched/pit/pit.hpp>
 #include <system/sched/rtc/rtc.hpp>
+#include <system/boot/boot.hpp>
 #include <system/cpu/apic/apic.hpp>
 #include <system/cpu/gdt/gdt.hpp>
 #include <system/cpu/idt/idt.hpp>
 #include <system/cpu/smp/smp.hpp>
 #include <system/mm/pmm/pmm.hpp>
 #include <system/mm/vmm/vmm.hpp>
+#include <system/vdso/vdso.hpp>
 #include <system/acpi/acpi.hpp>
 #include <drivers/ps2/ps2.hpp>
 #include <system/pci/pci.hpp>
@@ -123,29 +127,34 @@ void main()
     terminal::check("Initialising SMP...", smp::init, -1, smp::initialised);
     // lai_enable_acpi(apic::initialised ? 1 : 0);
 
-    terminal::check("Initialising VFS...", vfs::init, -1, vfs::initialised);
-    terminal::check("Initialising TMPFS...", tmpfs::init, -1, tmpfs::initialised);
-    terminal::check("Initialising DEVFS...", devfs::init, -1, devfs::initialised);
+    auto vfs_task = boot::add("Initialising VFS...", vfs::init, -1, vfs::initialised);
+    auto tmpfs_task = boot::add("Initialising TMPFS...", tmpfs::init, -1, tmpfs::initialised)->after(vfs_task);
+    auto devfs_task = boot::add("Initialising DEVFS...", devfs::init, -1, devfs::initialised)->after(tmpfs_task);
 
     auto initrd_mod = find_module("initrd");
-    terminal::check("Initialising Initrd...", initrd::init, reinterpret_cast<uint64_t>(initrd_mod), initrd::initialised, (initrd_mod && strstr(cmdline, "initrd")));
+    boot::add("Initialising Initrd...", initrd::init, reinterpret_cast<uint64_t>(initrd_mod), initrd::initialised, (initrd_mod && strstr(cmdline, "initrd")))->after(devfs_task);
 
-    terminal::check("Initialising AHCI...", ahci::init, -1, ahci::initialised);
-    terminal::check("Initialising ATA...", ata::init, -1, ata::initialised);
+    auto vdso_task = boot::add("Initialising vDSO...", vdso::init, -1, vdso::initialised);
 
-    terminal::check("Initialising RTL8139...", rtl8139::init, -1, rtl8139::initialised);
-    terminal::check("Initialising RTL8169...", rtl8169::init, -1, rtl8169::initialised);
-    terminal::check("Initialising E1000...", e1000::init, -1, e1000::initialised);
+    auto ahci_task = boot::add("Initialising AHCI...", ahci::init, -1, ahci::initialised)->after(vdso_task);
+    auto ata_task = boot::add("Initialising ATA...", ata::init, -1, ata::initialised)->after(vdso_task);
+    auto nvme_task = boot::add("Initialising NVMe...", nvme::init, -1, nvme::initialised)->after(vdso_task);
 
-    terminal::check("Initialising Drive Manager...", drivemgr::init, -1, drivemgr::initialised);
-    terminal::check("Initialising NIC Manager...", nicmgr::init, -1, nicmgr::initialised);
-    serial::init();
+    auto rtl8139_task = boot::add("Initialising RTL8139...", rtl8139::init, -1, rtl8139::initialised);
+    auto rtl8169_task = boot::add("Initialising RTL8169...", rtl8169::init, -1, rtl8169::initialised);
+    auto e1000_task = boot::add("Initialising E1000...", e1000::init, -1, e1000::initialised);
 
-    terminal::check("Initialising System Calls...", syscall::init, -1, syscall::initialised);
+    boot::add("Initialising Drive Manager...", drivemgr::init, -1, drivemgr::initialised)->after(devfs_task)->after(ahci_task)->after(ata_task)->after(nvme_task);
+    boot::add("Initialising NIC Manager...", nicmgr::init, -1, nicmgr::initialised)->after(devfs_task)->after(rtl8139_task)->after(rtl8169_task)->after(e1000_task);
+    boot::add("Initialising Serial TTYs...", serial::init, -1, serial::initialised)->after(devfs_task);
 
-    terminal::check("Initialising PS/2 Controller...", ps2::init, -1, ps2::initialised);
+    boot::add("Initialising System Calls...", syscall::init, -1, syscall::initialised, true, true);
+    boot::add("Initialising Syscall Tracer...", syscall::trace::init, -1, syscall::trace::initialised)->after(devfs_task);
 
-    terminal::check("Initialising VMWare Tools...", vmware::init, -1, vmware::initialised);
+    auto ps2_task = boot::add("Initialising PS/2 Controller...", ps2::init, -1, ps2::initialised)->after(devfs_task);
+    boot::add("Initialising VMWare Tools...", vmware::init, -1, vmware::initialised)->after(ps2_task);
+
+    boot::run();
 
     printf("Current RTC time: %s\n\n", rtc::getTime());
     printf("Userspace has not been implemented yet! dropping to kernel shell...\n\n");
@@ -6,6 +6,13 @@
 #include <cstdint>
 #include <cpuid.h>
 
+uint64_t rdtsc()
+{
+    uint32_t edx, eax;
+    asm volatile("rdtsc" : "=a"(eax), "=d"(edx) : : "memory");
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+}
+
 uint64_t rdmsr(uint32_t msr)
 {
     uint32_t edx, eax;
@@ -131,6 +138,18 @@ void invlpg(uint64_t addr)
     asm volatile ("invlpg (%0)" : : "r"(addr));
 }
 
+uint64_t irq_save()
+{
+    uint64_t flags = 0;
+    asm volatile ("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+void irq_restore(uint64_t flags)
+{
+    if (flags & (1 << 9)) asm volatile ("sti" : : : "memory");
+}
+
 void enableSSE()
 {
     write_cr(0, (read_cr(0) & ~(1 << 2)) | (1 << 1));
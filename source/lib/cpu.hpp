@@ -11,6 +11,7 @@ static constexpr uint64_t CPUID_SMAP = (1 << 20);
 static constexpr uint64_t CPUID_UMIP = (1 << 2);
 static constexpr uint64_t CPUID_X2APIC = (1 << 21);
 static constexpr uint64_t CPUID_GBPAGE = (1 << 26);
+static constexpr uint64_t CPUID_RDTSCP = (1 << 27);
 
 enum PAT
 {
@@ -29,6 +30,8 @@ struct [[gnu::packed]] registers_t
     uint64_t int_no, error_code, rip, cs, rflags, rsp, ss;
 };
 
+uint64_t rdtsc();
+
 uint64_t rdmsr(uint32_t msr);
 void wrmsr(uint32_t msr, uint64_t value);
 
@@ -54,6 +57,9 @@ void fxrstor(uint8_t *region);
 
 void invlpg(uint64_t addr);
 
+uint64_t irq_save();
+void irq_restore(uint64_t flags);
+
 void enableSSE();
 void enableSMEP();
 void enableSMAP();
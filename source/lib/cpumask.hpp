@@ -0,0 +1,69 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+static constexpr size_t MAX_CPUS = 256;
+
+struct cpumask_t
+{
+    uint64_t bits[MAX_CPUS / 64] = { };
+
+    static constexpr cpumask_t all()
+    {
+        cpumask_t mask;
+        for (uint64_t &word : mask.bits) word = ~0UL;
+        return mask;
+    }
+
+    static constexpr cpumask_t first(size_t count)
+    {
+        cpumask_t mask;
+        for (size_t i = 0; i < count && i < MAX_CPUS; i++) mask.set(i);
+        return mask;
+    }
+
+    static constexpr cpumask_t only(size_t cpu)
+    {
+        cpumask_t mask;
+        mask.set(cpu);
+        return mask;
+    }
+
+    constexpr void set(size_t cpu)
+    {
+        if (cpu < MAX_CPUS) this->bits[cpu / 64] |= (1UL << (cpu % 64));
+    }
+
+    constexpr void clear(size_t cpu)
+    {
+        if (cpu < MAX_CPUS) this->bits[cpu / 64] &= ~(1UL << (cpu % 64));
+    }
+
+    constexpr bool test(size_t cpu) const
+    {
+        return cpu < MAX_CPUS && (this->bits[cpu / 64] & (1UL << (cpu % 64)));
+    }
+
+    constexpr bool empty() const
+    {
+        for (uint64_t word : this->bits) if (word) return false;
+        return true;
+    }
+
+    constexpr cpumask_t operator&(const cpumask_t &other) const
+    {
+        cpumask_t mask;
+        for (size_t i = 0; i < MAX_CPUS / 64; i++) mask.bits[i] = this->bits[i] & other.bits[i];
+        return mask;
+    }
+
+    constexpr cpumask_t operator~() const
+    {
+        cpumask_t mask;
+        for (size_t i = 0; i < MAX_CPUS / 64; i++) mask.bits[i] = ~this->bits[i];
+        return mask;
+    }
+};
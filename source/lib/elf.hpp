@@ -20,12 +20,13 @@ struct Auxval
     uint64_t phdr;
     uint64_t phent;
     uint64_t phnum;
+    uint64_t sysinfo;
 };
 
 static inline auto elf_load(vmm::Pagemap *pagemap, vfs::resource_t *res, uint64_t base)
 {
     struct ret { Auxval auxval; std::string ld_path; };
-    ret null { Auxval { 0, 0, 0, 0 }, "" };
+    ret null { Auxval { 0, 0, 0, 0, 0 }, "" };
 
     std::shared_ptr<Elf64_Ehdr> header(new Elf64_Ehdr);
     res->read(nullptr, reinterpret_cast<uint8_t*>(header.get()), 0, sizeof(Elf64_Ehdr));
@@ -50,7 +51,8 @@ static inline auto elf_load(vmm::Pagemap *pagemap, vfs::resource_t *res, uint64_
         .entry = base + header->e_entry,
         .phdr = 0,
         .phent = sizeof(Elf64_Phdr),
-        .phnum = header->e_phnum
+        .phnum = header->e_phnum,
+        .sysinfo = 0
     };
 
     std::string ld_path("");
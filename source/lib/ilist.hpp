@@ -0,0 +1,105 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <cstddef>
+
+template<typename type>
+struct list_node_t
+{
+    type *next = nullptr;
+    type *prev = nullptr;
+};
+
+template<typename type, list_node_t<type> type::*member>
+class list_t
+{
+    private:
+    type *first = nullptr;
+    type *last = nullptr;
+    size_t num = 0;
+
+    static list_node_t<type> &node(type *item)
+    {
+        return item->*member;
+    }
+
+    public:
+    struct iterator
+    {
+        type *item;
+
+        type *operator*()
+        {
+            return this->item;
+        }
+        iterator &operator++()
+        {
+            this->item = node(this->item).next;
+            return *this;
+        }
+        bool operator!=(const iterator &other)
+        {
+            return this->item != other.item;
+        }
+    };
+
+    void push_back(type *item)
+    {
+        node(item).next = nullptr;
+        node(item).prev = this->last;
+        if (this->last) node(this->last).next = item;
+        else this->first = item;
+        this->last = item;
+        this->num++;
+    }
+
+    void remove(type *item)
+    {
+        if (node(item).prev) node(node(item).prev).next = node(item).next;
+        else if (this->first == item) this->first = node(item).next;
+        else return;
+
+        if (node(item).next) node(node(item).next).prev = node(item).prev;
+        else this->last = node(item).prev;
+
+        node(item).next = nullptr;
+        node(item).prev = nullptr;
+        this->num--;
+    }
+
+    static type *next(type *item)
+    {
+        return node(item).next;
+    }
+
+    type *front()
+    {
+        return this->first;
+    }
+
+    type *back()
+    {
+        return this->last;
+    }
+
+    bool empty()
+    {
+        return this->num == 0;
+    }
+
+    size_t size()
+    {
+        return this->num;
+    }
+
+    iterator begin()
+    {
+        return iterator { this->first };
+    }
+
+    iterator end()
+    {
+        return iterator { nullptr };
+    }
+};
@@ -0,0 +1,385 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <lib/inflate.hpp>
+#include <lib/memory.hpp>
+
+static constexpr size_t FAST_BITS = 10;
+static constexpr size_t MAX_BITS = 15;
+static constexpr size_t MAX_LCODES = 288;
+static constexpr size_t MAX_DCODES = 30;
+
+static constexpr uint16_t length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static constexpr uint8_t length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static constexpr uint16_t dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static constexpr uint8_t dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static constexpr uint8_t clen_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+struct huffman
+{
+    uint16_t fast[1 << FAST_BITS];
+    uint16_t count[MAX_BITS + 1];
+    uint16_t symbol[MAX_LCODES];
+};
+
+struct inflate_state
+{
+    const uint8_t *in;
+    size_t insize;
+    size_t inpos;
+
+    uint64_t bitbuf;
+    size_t bitcnt;
+
+    uint8_t *out;
+    size_t outsize;
+    size_t outpos;
+
+    huffman lencode;
+    huffman distcode;
+};
+
+static uint32_t crc_table[256];
+static bool crc_ready = false;
+
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size)
+{
+    if (crc_ready == false)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (size_t k = 0; k < 8; k++) c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            crc_table[i] = c;
+        }
+        crc_ready = true;
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static inline void refill(inflate_state &s)
+{
+    while (s.bitcnt <= 56 && s.inpos < s.insize)
+    {
+        s.bitbuf |= static_cast<uint64_t>(s.in[s.inpos++]) << s.bitcnt;
+        s.bitcnt += 8;
+    }
+}
+
+static inline int32_t bits(inflate_state &s, size_t need)
+{
+    if (s.bitcnt < need)
+    {
+        refill(s);
+        if (s.bitcnt < need) return -1;
+    }
+
+    int32_t ret = s.bitbuf & ((1UL << need) - 1);
+    s.bitbuf >>= need;
+    s.bitcnt -= need;
+    return ret;
+}
+
+static bool build(huffman &h, const uint8_t *lengths, size_t n)
+{
+    memset(&h, 0, sizeof(huffman));
+    for (size_t i = 0; i < n; i++) h.count[lengths[i]]++;
+    h.count[0] = 0;
+
+    int left = 1;
+    for (size_t len = 1; len <= MAX_BITS; len++)
+    {
+        left <<= 1;
+        left -= h.count[len];
+        if (left < 0) return false;
+    }
+
+    uint16_t offs[MAX_BITS + 1] = { 0 };
+    for (size_t len = 1; len < MAX_BITS; len++) offs[len + 1] = offs[len] + h.count[len];
+    for (size_t i = 0; i < n; i++) if (lengths[i]) h.symbol[offs[lengths[i]]++] = i;
+
+    uint32_t code = 0;
+    size_t index = 0;
+    for (size_t len = 1; len <= FAST_BITS; len++)
+    {
+        for (size_t i = 0; i < h.count[len]; i++, code++)
+        {
+            uint32_t rev = 0;
+            for (size_t b = 0; b < len; b++) rev |= ((code >> b) & 1) << (len - 1 - b);
+            for (uint32_t r = rev; r < (1U << FAST_BITS); r += (1U << len))
+            {
+                h.fast[r] = (h.symbol[index] << 4) | len;
+            }
+            index++;
+        }
+        code <<= 1;
+    }
+    return true;
+}
+
+static int decode(inflate_state &s, huffman &h)
+{
+    if (s.bitcnt < MAX_BITS) refill(s);
+
+    uint16_t entry = h.fast[s.bitbuf & ((1 << FAST_BITS) - 1)];
+    if (entry && (entry & 0x0F) <= s.bitcnt)
+    {
+        s.bitbuf >>= (entry & 0x0F);
+        s.bitcnt -= (entry & 0x0F);
+        return entry >> 4;
+    }
+
+    int code = 0, first = 0, index = 0;
+    for (size_t len = 1; len <= MAX_BITS; len++)
+    {
+        int bit = bits(s, 1);
+        if (bit < 0) return -1;
+
+        code |= bit;
+        int count = h.count[len];
+        if (code - count < first) return h.symbol[index + (code - first)];
+
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static bool stored(inflate_state &s)
+{
+    bits(s, s.bitcnt % 8);
+
+    int32_t len = bits(s, 16);
+    int32_t nlen = bits(s, 16);
+    if (len < 0 || nlen < 0 || len != (~nlen & 0xFFFF)) return false;
+    if (s.outpos + len > s.outsize) return false;
+
+    while (len > 0 && s.bitcnt >= 8)
+    {
+        s.out[s.outpos++] = bits(s, 8);
+        len--;
+    }
+
+    if (s.inpos + len > s.insize) return false;
+    memcpy(s.out + s.outpos, s.in + s.inpos, len);
+    s.outpos += len;
+    s.inpos += len;
+    return true;
+}
+
+static bool codes(inflate_state &s)
+{
+    while (true)
+    {
+        int symbol = decode(s, s.lencode);
+        if (symbol < 0) return false;
+
+        if (symbol < 256)
+        {
+            if (s.outpos >= s.outsize) return false;
+            s.out[s.outpos++] = symbol;
+            continue;
+        }
+        if (symbol == 256) return true;
+
+        symbol -= 257;
+        if (symbol >= 29) return false;
+        int32_t extra = bits(s, length_extra[symbol]);
+        if (extra < 0) return false;
+        size_t len = length_base[symbol] + extra;
+
+        symbol = decode(s, s.distcode);
+        if (symbol < 0 || symbol >= 30) return false;
+        extra = bits(s, dist_extra[symbol]);
+        if (extra < 0) return false;
+        size_t dist = dist_base[symbol] + extra;
+
+        if (dist > s.outpos || s.outpos + len > s.outsize) return false;
+
+        uint8_t *dest = s.out + s.outpos;
+        const uint8_t *src = dest - dist;
+        if (dist >= len) memcpy(dest, src, len);
+        else for (size_t i = 0; i < len; i++) dest[i] = src[i];
+        s.outpos += len;
+    }
+}
+
+static bool fixed(inflate_state &s)
+{
+    static huffman lencode, distcode;
+    static bool ready = false;
+
+    if (ready == false)
+    {
+        uint8_t lengths[MAX_LCODES];
+        size_t i = 0;
+        for (; i < 144; i++) lengths[i] = 8;
+        for (; i < 256; i++) lengths[i] = 9;
+        for (; i < 280; i++) lengths[i] = 7;
+        for (; i < MAX_LCODES; i++) lengths[i] = 8;
+        build(lencode, lengths, MAX_LCODES);
+
+        for (i = 0; i < MAX_DCODES; i++) lengths[i] = 5;
+        build(distcode, lengths, MAX_DCODES);
+        ready = true;
+    }
+
+    memcpy(&s.lencode, &lencode, sizeof(huffman));
+    memcpy(&s.distcode, &distcode, sizeof(huffman));
+    return codes(s);
+}
+
+static bool dynamic(inflate_state &s)
+{
+    int32_t nlen = bits(s, 5);
+    int32_t ndist = bits(s, 5);
+    int32_t ncode = bits(s, 4);
+    if (nlen < 0 || ndist < 0 || ncode < 0) return false;
+
+    nlen += 257;
+    ndist += 1;
+    ncode += 4;
+    if (nlen > 286 || ndist > 30) return false;
+
+    uint8_t lengths[MAX_LCODES + MAX_DCODES] = { 0 };
+    for (int32_t i = 0; i < ncode; i++)
+    {
+        int32_t len = bits(s, 3);
+        if (len < 0) return false;
+        lengths[clen_order[i]] = len;
+    }
+    if (build(s.lencode, lengths, 19) == false) return false;
+
+    int32_t index = 0;
+    while (index < nlen + ndist)
+    {
+        int symbol = decode(s, s.lencode);
+        if (symbol < 0) return false;
+
+        if (symbol < 16)
+        {
+            lengths[index++] = symbol;
+            continue;
+        }
+
+        uint8_t len = 0;
+        int32_t repeat = 0;
+        if (symbol == 16)
+        {
+            if (index == 0) return false;
+            len = lengths[index - 1];
+            repeat = bits(s, 2);
+            if (repeat >= 0) repeat += 3;
+        }
+        else if (symbol == 17)
+        {
+            repeat = bits(s, 3);
+            if (repeat >= 0) repeat += 3;
+        }
+        else
+        {
+            repeat = bits(s, 7);
+            if (repeat >= 0) repeat += 11;
+        }
+
+        if (repeat < 0 || index + repeat > nlen + ndist) return false;
+        while (repeat--) lengths[index++] = len;
+    }
+
+    if (lengths[256] == 0) return false;
+    if (build(s.lencode, lengths, nlen) == false) return false;
+    if (build(s.distcode, lengths + nlen, ndist) == false) return false;
+
+    return codes(s);
+}
+
+int64_t inflate(const uint8_t *in, size_t insize, uint8_t *out, size_t outsize, size_t *consumed)
+{
+    inflate_state *s = new inflate_state;
+    s->in = in;
+    s->insize = insize;
+    s->inpos = 0;
+    s->bitbuf = 0;
+    s->bitcnt = 0;
+    s->out = out;
+    s->outsize = outsize;
+    s->outpos = 0;
+
+    bool ok = true;
+    int32_t last = 0;
+    while (ok && last == 0)
+    {
+        last = bits(*s, 1);
+        int32_t type = bits(*s, 2);
+        if (last < 0 || type < 0) ok = false;
+        else if (type == 0) ok = stored(*s);
+        else if (type == 1) ok = fixed(*s);
+        else if (type == 2) ok = dynamic(*s);
+        else ok = false;
+    }
+
+    int64_t ret = ok ? static_cast<int64_t>(s->outpos) : -1;
+    if (consumed) *consumed = s->inpos - s->bitcnt / 8;
+
+    delete s;
+    return ret;
+}
+
+enum gzipflags
+{
+    GZIP_FHCRC = (1 << 1),
+    GZIP_FEXTRA = (1 << 2),
+    GZIP_FNAME = (1 << 3),
+    GZIP_FCOMMENT = (1 << 4)
+};
+
+bool gzip_check(const uint8_t *data, size_t size)
+{
+    return size >= 18 && data[0] == 0x1F && data[1] == 0x8B && data[2] == 8;
+}
+
+uint64_t gzip_size(const uint8_t *data, size_t size)
+{
+    if (gzip_check(data, size) == false) return 0;
+    const uint8_t *isize = data + size - 4;
+    return isize[0] | (isize[1] << 8) | (isize[2] << 16) | (static_cast<uint32_t>(isize[3]) << 24);
+}
+
+int64_t gunzip(const uint8_t *in, size_t insize, uint8_t *out, size_t outsize)
+{
+    if (gzip_check(in, insize) == false) return -1;
+
+    uint8_t flags = in[3];
+    size_t pos = 10;
+
+    if (flags & GZIP_FEXTRA)
+    {
+        if (pos + 2 > insize) return -1;
+        pos += 2 + (in[pos] | (in[pos + 1] << 8));
+    }
+    if (flags & GZIP_FNAME)
+    {
+        while (pos < insize && in[pos]) pos++;
+        pos++;
+    }
+    if (flags & GZIP_FCOMMENT)
+    {
+        while (pos < insize && in[pos]) pos++;
+        pos++;
+    }
+    if (flags & GZIP_FHCRC) pos += 2;
+    if (pos + 8 > insize) return -1;
+
+    int64_t ret = inflate(in + pos, insize - pos - 8, out, outsize);
+    if (ret < 0) return -1;
+
+    const uint8_t *trailer = in + insize - 8;
+    uint32_t crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (static_cast<uint32_t>(trailer[3]) << 24);
+    if (crc32(0, out, ret) != crc) return -1;
+
+    return ret;
+}
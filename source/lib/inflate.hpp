@@ -0,0 +1,14 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size);
+
+int64_t inflate(const uint8_t *in, size_t insize, uint8_t *out, size_t outsize, size_t *consumed = nullptr);
+
+bool gzip_check(const uint8_t *data, size_t size);
+uint64_t gzip_size(const uint8_t *data, size_t size);
+int64_t gunzip(const uint8_t *in, size_t insize, uint8_t *out, size_t outsize);
@@ -2,36 +2,41 @@
 
 #include <lib/pty.hpp>
 
-int64_t pty_res::read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
+// Called with read_lock held, which is dropped while sleeping
+void pty_res::wait_input(size_t count)
 {
-    lockit(this->read_lock);
-    lockit(this->lock);
-
-    while (offset--)
+    while (this->bigbuff.size() < count)
     {
-        while (this->bigbuff.empty());
-        this->bigbuff.get();
+        scheduler::thread_t *thread = this_thread();
+        if (thread == nullptr)
+        {
+            asm volatile ("pause");
+            continue;
+        }
+
+        this->readers.add(thread);
+        this->read_lock.unlock();
+        if (this->bigbuff.size() < count) thread->block();
+        this->readers.remove(thread);
+        this->read_lock.lock();
     }
+}
 
-    bool wait = true;
-    for (size_t i = 0; i < size; i++)
+int64_t pty_res::read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
+{
+    if (size == 0) return 0;
+    lockit(this->read_lock);
+
+    char *chars = reinterpret_cast<char*>(buffer);
+    if (this->tios.c_lflag & ICANON)
     {
-        if (this->bigbuff.empty())
-        {
-            if (wait == true)
-            {
-                this->lock.unlock();
-                while (this->bigbuff.empty());
-                this->lock.lock();
-            }
-            else return i;
-        }
-        *buffer = this->bigbuff.get();
-        buffer++;
-        wait = false;
+        this->wait_input(1);
+        return this->bigbuff.read_n(chars, size, '\n');
     }
 
-    return size;
+    size_t min = this->tios.c_cc[VMIN];
+    this->wait_input(min < size ? min : size);
+    return this->bigbuff.read_n(chars, size);
 }
 
 int64_t pty_res::write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
@@ -74,6 +79,13 @@ bool pty_res::grow(void *handle, size_t new_size)
     return false;
 }
 
+int pty_res::poll(void *handle)
+{
+    int events = vfs::pollout | vfs::pollwrnorm;
+    if (this->bigbuff.size() > 0) events |= vfs::pollin | vfs::pollrdnorm;
+    return events;
+}
+
 void pty_res::unref(void *handle)
 {
     this->refcount--;
@@ -114,12 +126,15 @@ void pty_res::add_char(char c)
             if (this->buff.full()) return;
             this->buff.put(c);
             if (this->tios.c_lflag & ECHO) this->print("%c", c);
-            while (!this->buff.empty() && !this->bigbuff.full())
+            char line[128];
+            size_t count = 0;
+            while ((count = this->buff.read_n(line, sizeof(line))) > 0)
             {
-                char ch = this->buff.get();
-                this->bigbuff.put(ch);
+                if (this->bigbuff.write_n(line, count) < count) break;
             }
             this->buff.clear();
+            this->readers.wake();
+            this->notify(vfs::pollin | vfs::pollrdnorm);
             return;
         }
         else if (c == '\b' || c == this->tios.c_cc[VERASE])
@@ -141,6 +156,8 @@ void pty_res::add_char(char c)
     {
         if (this->bigbuff.full()) return;
         this->bigbuff.put(c);
+        this->readers.wake();
+        this->notify(vfs::pollin | vfs::pollrdnorm);
     }
 
     if (this->tios.c_lflag & ECHO)
@@ -163,13 +180,18 @@ void pty_res::add_str(const char *str)
 std::string pty_res::getline()
 {
     std::string ret("");
-    char c = 0;
+    char buffer[128];
 
     while (true)
     {
-        this->read(nullptr, reinterpret_cast<uint8_t*>(&c), 0, 1);
-        if (c == '\n') break;
-        ret.append(c);
+        size_t size = (this->tios.c_lflag & ICANON) ? sizeof(buffer) - 1 : 1;
+        int64_t count = this->read(nullptr, reinterpret_cast<uint8_t*>(buffer), 0, size);
+        if (count <= 0) continue;
+
+        bool done = (buffer[count - 1] == '\n');
+        buffer[done ? count - 1 : count] = 0;
+        ret.append(buffer);
+        if (done) break;
     }
 
     return ret;
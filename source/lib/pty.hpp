@@ -2,9 +2,11 @@
 
 #pragma once
 
+#include <system/sched/scheduler/scheduler.hpp>
 #include <system/vfs/vfs.hpp>
 #include <lib/ring.hpp>
 
+using namespace kernel::system::sched;
 using namespace kernel::system;
 
 static constexpr uint8_t nccs = 32;
@@ -159,6 +161,7 @@ struct pty_res : vfs::resource_t
     lock_t write_lock;
     ringbuffer<char> buff;
     ringbuffer<char> bigbuff;
+    scheduler::waitqueue_t readers;
     bool decckm = false;
     winsize wsize;
     termios tios;
@@ -201,11 +204,14 @@ struct pty_res : vfs::resource_t
     int64_t write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size);
     int ioctl(void *handle, uint64_t request, void *argp);
     bool grow(void *handle, size_t new_size);
+    int poll(void *handle);
     void unref(void *handle);
     void link(void *handle);
     void unlink(void *handle);
     void *mmap(uint64_t page, int flags);
 
+    void wait_input(size_t count);
+
     void add_char(char c);
     void add_str(const char *str);
     std::string getline();
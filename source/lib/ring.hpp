@@ -2,11 +2,13 @@
 
 #pragma once
 
+#include <lib/memory.hpp>
 #include <lib/lock.hpp>
 #include <cstddef>
 #include <cstdint>
 
 static constexpr uint64_t default_ring_size = 0x1000;
+static constexpr size_t CACHE_LINE = 64;
 
 template<typename type>
 class ringbuffer
@@ -19,6 +21,26 @@ class ringbuffer
     size_t cap = 0;
     bool isfull = false;
 
+    size_t used()
+    {
+        if (this->isfull) return this->cap;
+        if (this->head >= this->tail) return this->head - this->tail;
+        return this->cap + this->head - this->tail;
+    }
+
+    size_t take(type *items, size_t count)
+    {
+        size_t first = this->cap - this->tail;
+        if (first > count) first = count;
+
+        memcpy(items, this->buffer + this->tail, first * sizeof(type));
+        memcpy(items + first, this->buffer, (count - first) * sizeof(type));
+
+        this->tail = (this->tail + count) % this->cap;
+        if (count) this->isfull = false;
+        return count;
+    }
+
     public:
     ringbuffer(size_t cap)
     {
@@ -76,6 +98,50 @@ class ringbuffer
         return val;
     }
 
+    size_t write_n(const type *items, size_t count)
+    {
+        lockit(this->lock);
+
+        size_t free = this->cap - this->used();
+        if (count > free) count = free;
+
+        size_t first = this->cap - this->head;
+        if (first > count) first = count;
+
+        memcpy(this->buffer + this->head, items, first * sizeof(type));
+        memcpy(this->buffer, items + first, (count - first) * sizeof(type));
+
+        this->head = (this->head + count) % this->cap;
+        if (count) this->isfull = this->head == this->tail;
+        return count;
+    }
+
+    size_t read_n(type *items, size_t count)
+    {
+        lockit(this->lock);
+
+        size_t avail = this->used();
+        return this->take(items, count > avail ? avail : count);
+    }
+
+    size_t read_n(type *items, size_t count, type delim)
+    {
+        lockit(this->lock);
+
+        size_t avail = this->used();
+        if (count > avail) count = avail;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (this->buffer[(this->tail + i) % this->cap] == delim)
+            {
+                count = i + 1;
+                break;
+            }
+        }
+        return this->take(items, count);
+    }
+
     void clear()
     {
         lockit(this->lock);
@@ -100,25 +166,275 @@ class ringbuffer
     }
 
     size_t size()
+    {
+        lockit(this->lock);
+        return this->used();
+    }
+
+    void copyto(ringbuffer<type> &newring)
     {
         lockit(this->lock);
 
-        size_t size = this->cap;
-        if (this->isfull == false)
+        size_t s = this->used();
+        for (size_t i = 0; i < s; i++)
+        {
+            newring.put(this->buffer[(this->tail + i) % this->cap]);
+        }
+    }
+};
+
+template<typename type, size_t size>
+class spsc_ring
+{
+    static_assert(size && !(size & (size - 1)), "Ring size must be a power of two");
+
+    private:
+    static constexpr size_t mask = size - 1;
+
+    alignas(CACHE_LINE) size_t head = 0;
+    size_t cached_tail = 0;
+    alignas(CACHE_LINE) size_t tail = 0;
+    size_t cached_head = 0;
+    alignas(CACHE_LINE) type buffer[size];
+
+    public:
+    bool push(const type &item)
+    {
+        size_t pos = __atomic_load_n(&this->head, __ATOMIC_RELAXED);
+        if (pos - this->cached_tail == size)
+        {
+            this->cached_tail = __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE);
+            if (pos - this->cached_tail == size) return false;
+        }
+
+        this->buffer[pos & mask] = item;
+        __atomic_store_n(&this->head, pos + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool pop(type &item)
+    {
+        size_t pos = __atomic_load_n(&this->tail, __ATOMIC_RELAXED);
+        if (pos == this->cached_head)
         {
-            if (this->head >= this->tail) size = this->head - this->tail;
-            else size = this->cap + this->head - this->tail;
+            this->cached_head = __atomic_load_n(&this->head, __ATOMIC_ACQUIRE);
+            if (pos == this->cached_head) return false;
         }
 
+        item = this->buffer[pos & mask];
+        __atomic_store_n(&this->tail, pos + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    size_t push_n(const type *items, size_t count)
+    {
+        size_t pos = __atomic_load_n(&this->head, __ATOMIC_RELAXED);
+        if (size - (pos - this->cached_tail) < count) this->cached_tail = __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE);
+
+        size_t free = size - (pos - this->cached_tail);
+        if (count > free) count = free;
+
+        for (size_t i = 0; i < count; i++) this->buffer[(pos + i) & mask] = items[i];
+        __atomic_store_n(&this->head, pos + count, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    size_t pop_n(type *items, size_t count)
+    {
+        size_t pos = __atomic_load_n(&this->tail, __ATOMIC_RELAXED);
+        if (this->cached_head - pos < count) this->cached_head = __atomic_load_n(&this->head, __ATOMIC_ACQUIRE);
+
+        size_t avail = this->cached_head - pos;
+        if (count > avail) count = avail;
+
+        for (size_t i = 0; i < count; i++) items[i] = this->buffer[(pos + i) & mask];
+        __atomic_store_n(&this->tail, pos + count, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    size_t count()
+    {
+        return __atomic_load_n(&this->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE);
+    }
+
+    bool empty()
+    {
+        return this->count() == 0;
+    }
+
+    bool full()
+    {
+        return this->count() == size;
+    }
+
+    size_t capacity()
+    {
         return size;
     }
+};
 
-    void copyto(ringbuffer<type> &newring)
+template<typename type, size_t size>
+class mpmc_ring
+{
+    static_assert(size && !(size & (size - 1)), "Ring size must be a power of two");
+
+    private:
+    static constexpr size_t mask = size - 1;
+
+    struct cell_t
     {
-        size_t s = this->size();
-        for (size_t i = 0; i < s; i++)
+        size_t seq;
+        type data;
+    };
+
+    alignas(CACHE_LINE) size_t head = 0;
+    alignas(CACHE_LINE) size_t tail = 0;
+    alignas(CACHE_LINE) cell_t cells[size];
+
+    static inline intptr_t diff(size_t a, size_t b)
+    {
+        return static_cast<intptr_t>(a - b);
+    }
+
+    public:
+    mpmc_ring()
+    {
+        for (size_t i = 0; i < size; i++) this->cells[i].seq = i;
+    }
+
+    bool push(const type &item)
+    {
+        size_t pos = __atomic_load_n(&this->head, __ATOMIC_RELAXED);
+        cell_t *cell = nullptr;
+        while (true)
+        {
+            cell = &this->cells[pos & mask];
+            intptr_t d = diff(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE), pos);
+            if (d == 0)
+            {
+                if (__atomic_compare_exchange_n(&this->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+            }
+            else if (d < 0) return false;
+            else pos = __atomic_load_n(&this->head, __ATOMIC_RELAXED);
+        }
+
+        cell->data = item;
+        __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool pop(type &item)
+    {
+        size_t pos = __atomic_load_n(&this->tail, __ATOMIC_RELAXED);
+        cell_t *cell = nullptr;
+        while (true)
+        {
+            cell = &this->cells[pos & mask];
+            intptr_t d = diff(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE), pos + 1);
+            if (d == 0)
+            {
+                if (__atomic_compare_exchange_n(&this->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+            }
+            else if (d < 0) return false;
+            else pos = __atomic_load_n(&this->tail, __ATOMIC_RELAXED);
+        }
+
+        item = cell->data;
+        __atomic_store_n(&cell->seq, pos + size, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    size_t push_n(const type *items, size_t count)
+    {
+        if (count == 0) return 0;
+
+        size_t pos = __atomic_load_n(&this->head, __ATOMIC_RELAXED);
+        size_t n = 0;
+        while (true)
+        {
+            intptr_t used = diff(pos, __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE));
+            if (used < 0)
+            {
+                pos = __atomic_load_n(&this->head, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            n = size - used;
+            if (n > count) n = count;
+            if (n == 0) return 0;
+
+            intptr_t d = diff(__atomic_load_n(&this->cells[(pos + n - 1) & mask].seq, __ATOMIC_ACQUIRE), pos + n - 1);
+            if (d == 0)
+            {
+                if (__atomic_compare_exchange_n(&this->head, &pos, pos + n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+            }
+            else if (d < 0) return this->push(items[0]) ? 1 : 0;
+            else pos = __atomic_load_n(&this->head, __ATOMIC_RELAXED);
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            cell_t *cell = &this->cells[(pos + i) & mask];
+            while (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + i) asm volatile ("pause");
+
+            cell->data = items[i];
+            __atomic_store_n(&cell->seq, pos + i + 1, __ATOMIC_RELEASE);
+        }
+        return n;
+    }
+
+    size_t pop_n(type *items, size_t count)
+    {
+        if (count == 0) return 0;
+
+        size_t pos = __atomic_load_n(&this->tail, __ATOMIC_RELAXED);
+        size_t n = 0;
+        while (true)
+        {
+            intptr_t avail = diff(__atomic_load_n(&this->head, __ATOMIC_ACQUIRE), pos);
+            if (avail < 0)
+            {
+                pos = __atomic_load_n(&this->tail, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            n = avail;
+            if (n > count) n = count;
+            if (n == 0) return 0;
+
+            intptr_t d = diff(__atomic_load_n(&this->cells[(pos + n - 1) & mask].seq, __ATOMIC_ACQUIRE), pos + n);
+            if (d == 0)
+            {
+                if (__atomic_compare_exchange_n(&this->tail, &pos, pos + n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+            }
+            else if (d < 0) return this->pop(items[0]) ? 1 : 0;
+            else pos = __atomic_load_n(&this->tail, __ATOMIC_RELAXED);
+        }
+
+        for (size_t i = 0; i < n; i++)
         {
-            newring.put(this->buffer[i]);
+            cell_t *cell = &this->cells[(pos + i) & mask];
+            while (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + i + 1) asm volatile ("pause");
+
+            items[i] = cell->data;
+            __atomic_store_n(&cell->seq, pos + i + size, __ATOMIC_RELEASE);
         }
+        return n;
+    }
+
+    size_t count()
+    {
+        intptr_t count = diff(__atomic_load_n(&this->head, __ATOMIC_ACQUIRE), __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE));
+        return count < 0 ? 0 : count;
+    }
+
+    bool empty()
+    {
+        return this->count() == 0;
+    }
+
+    size_t capacity()
+    {
+        return size;
     }
 };
\ No newline at end of file
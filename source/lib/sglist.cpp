@@ -0,0 +1,139 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <system/mm/vmm/vmm.hpp>
+#include <kernel/kernel.hpp>
+#include <lib/sglist.hpp>
+
+using namespace kernel::system::mm;
+
+static uint64_t virt2phys(uint64_t vaddr, bool writable)
+{
+    uint64_t kernel_base = kernel_address_request.response->virtual_base;
+    if (vaddr >= kernel_base) return vaddr - kernel_base + kernel_address_request.response->physical_base;
+    if (vaddr >= hhdm_offset) return vaddr - hhdm_offset;
+
+    auto table = reinterpret_cast<vmm::PTable*>(reinterpret_cast<uint64_t>(vmm::getPagemap()) + hhdm_offset);
+    for (size_t level = (vmm::lvl5 ? 5 : 4); level > 0; level--)
+    {
+        uint64_t shift = 12 + 9 * (level - 1);
+        vmm::PDEntry &entry = table->entries[(vaddr >> shift) & 0x1FF];
+        if (!entry.getflag(vmm::Present)) return 0;
+        if (writable && (!entry.getflag(vmm::ReadWrite) || !entry.getflag(vmm::UserSuper))) return 0;
+
+        if (level == 1 || (level < 4 && entry.getflag(vmm::LargerPages)))
+        {
+            uint64_t mask = (1UL << shift) - 1;
+            return ((entry.getAddr() << 12) & ~mask) | (vaddr & mask);
+        }
+        table = reinterpret_cast<vmm::PTable*>((entry.getAddr() << 12) + hhdm_offset);
+    }
+    return 0;
+}
+
+void sglist::push(uint64_t phys, uint64_t size)
+{
+    if (size == 0) return;
+    this->length += size;
+
+    if (!this->entries.empty() && this->entries.back().phys + this->entries.back().size == phys)
+    {
+        this->entries.back().size += size;
+        return;
+    }
+    this->entries.push_back(sgentry { phys, size });
+}
+
+bool sglist::map(void *buffer, uint64_t size, bool writable)
+{
+    uint64_t vaddr = reinterpret_cast<uint64_t>(buffer);
+    while (size > 0)
+    {
+        uint64_t phys = virt2phys(vaddr, writable);
+        if (phys == 0) return false;
+
+        uint64_t chunk = vmm::page_size - (vaddr & (vmm::page_size - 1));
+        if (chunk > size) chunk = size;
+
+        this->push(phys, chunk);
+        vaddr += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+bool sglist::fits(uint64_t align, uint64_t limit, bool pages)
+{
+    for (size_t i = 0; i < this->entries.size(); i++)
+    {
+        sgentry &entry = this->entries[i];
+        if (entry.phys % align || entry.size % align) return false;
+        if (limit && entry.phys + entry.size > limit) return false;
+
+        if (pages)
+        {
+            if (i > 0 && entry.phys % vmm::page_size) return false;
+            if (i < this->entries.size() - 1 && (entry.phys + entry.size) % vmm::page_size) return false;
+        }
+    }
+    return true;
+}
+
+void sglist::skip(sgcursor &cursor, uint64_t bytes)
+{
+    while (bytes > 0 && cursor.index < this->entries.size())
+    {
+        uint64_t left = this->entries[cursor.index].size - cursor.offset;
+        if (bytes < left)
+        {
+            cursor.offset += bytes;
+            return;
+        }
+        bytes -= left;
+        cursor.index++;
+        cursor.offset = 0;
+    }
+}
+
+size_t sglist::gather(sgcursor &cursor, sgentry *out, size_t max, uint64_t bytes, uint64_t chunk, uint64_t boundary, uint64_t granularity)
+{
+    sgcursor start = cursor;
+    uint64_t total = 0;
+    size_t count = 0;
+
+    while (count < max && total < bytes && cursor.index < this->entries.size())
+    {
+        sgentry &entry = this->entries[cursor.index];
+        uint64_t phys = entry.phys + cursor.offset;
+        uint64_t size = entry.size - cursor.offset;
+
+        if (size > chunk) size = chunk;
+        if (size > bytes - total) size = bytes - total;
+        if (boundary && (phys % boundary) + size > boundary) size = boundary - (phys % boundary);
+
+        out[count++] = sgentry { phys, size };
+        total += size;
+        this->skip(cursor, size);
+    }
+
+    uint64_t excess = total % granularity;
+    if (excess == 0) return count;
+
+    total -= excess;
+    while (excess > 0 && count > 0)
+    {
+        if (out[count - 1].size <= excess)
+        {
+            excess -= out[count - 1].size;
+            count--;
+        }
+        else
+        {
+            out[count - 1].size -= excess;
+            excess = 0;
+        }
+    }
+
+    cursor = start;
+    this->skip(cursor, total);
+    return count;
+}
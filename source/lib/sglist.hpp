@@ -0,0 +1,67 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <lib/vector.hpp>
+#include <cstddef>
+#include <cstdint>
+
+struct sgentry
+{
+    uint64_t phys;
+    uint64_t size;
+};
+
+struct sgcursor
+{
+    size_t index = 0;
+    uint64_t offset = 0;
+};
+
+class sglist
+{
+    private:
+    vector<sgentry> entries;
+    uint64_t length = 0;
+
+    public:
+    void push(uint64_t phys, uint64_t size);
+    // writable: the device will write into the buffer, so read-only
+    // and copy-on-write user pages are refused
+    bool map(void *buffer, uint64_t size, bool writable = false);
+    bool fits(uint64_t align, uint64_t limit, bool pages);
+
+    void skip(sgcursor &cursor, uint64_t bytes);
+    size_t gather(sgcursor &cursor, sgentry *out, size_t max, uint64_t bytes, uint64_t chunk, uint64_t boundary, uint64_t granularity);
+
+    void clear()
+    {
+        while (!this->entries.empty()) this->entries.pop_back();
+        this->length = 0;
+    }
+
+    sgentry &operator[](size_t pos)
+    {
+        return this->entries[pos];
+    }
+
+    size_t count()
+    {
+        return this->entries.size();
+    }
+
+    uint64_t bytes()
+    {
+        return this->length;
+    }
+
+    sgentry *begin()
+    {
+        return this->entries.begin();
+    }
+
+    sgentry *end()
+    {
+        return this->entries.end();
+    }
+};
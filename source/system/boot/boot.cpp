@@ -0,0 +1,164 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <drivers/display/terminal/terminal.hpp>
+#include <system/sched/hpet/hpet.hpp>
+#include <system/sched/pit/pit.hpp>
+#include <system/cpu/smp/smp.hpp>
+#include <system/boot/timing.hpp>
+#include <system/boot/boot.hpp>
+#include <lib/string.hpp>
+#include <lib/panic.hpp>
+#include <lib/lock.hpp>
+#include <lib/log.hpp>
+
+using namespace kernel::drivers::display;
+using namespace kernel::system::sched;
+using namespace kernel::system::cpu;
+
+namespace kernel::system::boot {
+
+new_lock(graph_lock);
+new_lock(report_lock);
+
+static task_t tasks[MAX_TASKS];
+static size_t task_count = 0;
+static volatile size_t tasks_done = 0;
+
+static volatile bool released = false;
+static volatile bool finished = false;
+
+task_t *task_t::after(task_t *dep)
+{
+    if (dep == nullptr) return this;
+    assert(this->depcount < MAX_DEPS, "Boot task has too many dependencies!");
+    this->deps[this->depcount++] = dep;
+    return this;
+}
+
+task_t *add_task(const char *message, void (*func)(uint64_t), int64_t args, bool &ok, bool shouldinit, bool bsp)
+{
+    assert(task_count < MAX_TASKS, "Too many boot tasks!");
+
+    task_t *task = &tasks[task_count++];
+    task->message = message;
+    task->func = func;
+    task->args = args;
+    task->ok = &ok;
+    task->shouldinit = shouldinit;
+    task->bsp = bsp;
+    task->depcount = 0;
+    task->state = WAITING;
+    return task;
+}
+
+uint64_t now()
+{
+    if (hpet::initialised) return hpet::nanos();
+    if (pit::initialised) return pit::get_tick() * (1000000000 / pit::frequency);
+    return 0;
+}
+
+static bool ready(task_t *task)
+{
+    for (size_t i = 0; i < task->depcount; i++)
+    {
+        if (__atomic_load_n(&task->deps[i]->state, __ATOMIC_ACQUIRE) != DONE) return false;
+    }
+    return true;
+}
+
+static task_t *pick(bool bsp)
+{
+    lockit(graph_lock);
+    for (size_t i = 0; i < task_count; i++)
+    {
+        task_t *task = &tasks[i];
+        if (task->state != WAITING || (task->bsp && !bsp) || !ready(task)) continue;
+
+        task->state = RUNNING;
+        return task;
+    }
+    return nullptr;
+}
+
+static void execute(task_t *task)
+{
+    task->cpu = smp::initialised ? this_cpu->id : 0;
+    size_t event = event_begin(task->message, task->cpu);
+    task->start = now();
+    if (task->shouldinit) task->func(task->args);
+    task->end = now();
+    event_end(event);
+
+    report_lock.lock();
+    terminal::report(task->message, *task->ok);
+    report_lock.unlock();
+
+    __atomic_store_n(&task->state, DONE, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&tasks_done, 1, __ATOMIC_ACQ_REL);
+}
+
+static void critical_path(uint64_t start)
+{
+    task_t *last = nullptr;
+    for (size_t i = 0; i < task_count; i++)
+    {
+        if (last == nullptr || tasks[i].end > last->end) last = &tasks[i];
+    }
+    if (last == nullptr) return;
+
+    task_t *path[MAX_TASKS];
+    size_t length = 0;
+    for (task_t *task = last; task != nullptr; length++)
+    {
+        path[length] = task;
+
+        task_t *next = nullptr;
+        for (size_t i = 0; i < task->depcount; i++)
+        {
+            if (next == nullptr || task->deps[i]->end > next->end) next = task->deps[i];
+        }
+        task = next;
+    }
+
+    log("Boot graph: %zu tasks finished in %lu us", task_count, (last->end - start) / 1000);
+    log("Critical path:");
+    for (size_t i = length; i > 0; i--)
+    {
+        task_t *task = path[i - 1];
+        size_t len = 0;
+        const char *name = shortname(task->message, len);
+        log("- %.*s: %lu us on CPU %lu", static_cast<int>(len), name, (task->end - task->start) / 1000, task->cpu);
+    }
+    serial::newline();
+}
+
+void worker()
+{
+    while (finished == false)
+    {
+        task_t *task = released ? pick(false) : nullptr;
+        if (task != nullptr) execute(task);
+        else asm volatile ("pause");
+    }
+}
+
+void run()
+{
+    uint64_t start = now();
+    released = true;
+
+    while (tasks_done < task_count)
+    {
+        task_t *task = pick(true);
+        if (task != nullptr) execute(task);
+        else asm volatile ("pause");
+    }
+
+    finished = true;
+    critical_path(start);
+
+    summary();
+    export_trace();
+}
+}
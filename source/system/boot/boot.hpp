@@ -0,0 +1,51 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kernel::system::boot {
+
+static constexpr size_t MAX_TASKS = 32;
+static constexpr size_t MAX_DEPS = 8;
+
+enum taskstate
+{
+    WAITING,
+    RUNNING,
+    DONE
+};
+
+struct task_t
+{
+    const char *message;
+    void (*func)(uint64_t);
+    int64_t args;
+    bool *ok;
+    bool shouldinit;
+    bool bsp;
+
+    task_t *deps[MAX_DEPS];
+    size_t depcount;
+
+    volatile int state;
+    uint64_t cpu;
+    uint64_t start;
+    uint64_t end;
+
+    task_t *after(task_t *dep);
+};
+
+task_t *add_task(const char *message, void (*func)(uint64_t), int64_t args, bool &ok, bool shouldinit, bool bsp);
+
+static inline task_t *add(const char *message, auto init, int64_t args, bool &ok, bool shouldinit = true, bool bsp = false)
+{
+    return add_task(message, reinterpret_cast<void (*)(uint64_t)>(init), args, ok, shouldinit, bsp);
+}
+
+uint64_t now();
+
+void worker();
+void run();
+}
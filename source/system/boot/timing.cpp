@@ -0,0 +1,188 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <drivers/display/terminal/terminal.hpp>
+#include <drivers/fs/devfs/devfs.hpp>
+#include <system/sched/hpet/hpet.hpp>
+#include <system/cpu/smp/smp.hpp>
+#include <system/boot/timing.hpp>
+#include <system/boot/boot.hpp>
+#include <system/vfs/vfs.hpp>
+#include <kernel/kernel.hpp>
+#include <lib/memory.hpp>
+#include <lib/string.hpp>
+#include <lib/math.hpp>
+#include <lib/cpu.hpp>
+#include <lib/log.hpp>
+
+using namespace kernel::system::sched;
+using namespace kernel::system::cpu;
+using namespace kernel::drivers::fs;
+
+namespace kernel::system::boot {
+
+uint64_t tsc_hz = 0;
+
+static event_t events[MAX_EVENTS];
+static volatile size_t event_count = 0;
+
+static char *trace = nullptr;
+static size_t trace_len = 0;
+
+struct trace_res : vfs::resource_t
+{
+    int64_t read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
+    {
+        if (offset >= trace_len) return 0;
+        if (offset + size > trace_len) size = trace_len - offset;
+        memcpy(buffer, trace + offset, size);
+        return size;
+    }
+
+    void unref(void *handle)
+    {
+        this->refcount--;
+    }
+
+    void link(void *handle)
+    {
+        this->stat.nlink++;
+    }
+
+    void unlink(void *handle)
+    {
+        this->stat.nlink--;
+    }
+};
+
+size_t event_begin(const char *name, int64_t cpu)
+{
+    size_t event = __atomic_fetch_add(&event_count, 1, __ATOMIC_RELAXED);
+    if (event >= MAX_EVENTS) return MAX_EVENTS;
+
+    events[event].name = name;
+    events[event].cpu = (cpu >= 0) ? cpu : (smp::initialised ? this_cpu->id : 0);
+    events[event].end = 0;
+    events[event].start = rdtsc();
+    return event;
+}
+
+void event_end(size_t event)
+{
+    if (event >= MAX_EVENTS) return;
+    events[event].end = rdtsc();
+}
+
+const char *shortname(const char *name, size_t &len)
+{
+    len = strlen(name);
+    if (!strncmp(name, "Initialising ", 13))
+    {
+        name += 13;
+        len -= 13;
+    }
+    while (len && name[len - 1] == '.') len--;
+    return name;
+}
+
+uint64_t tsc2us(uint64_t ticks)
+{
+    if (tsc_hz == 0) return ticks;
+    return ticks / (tsc_hz / 1000000);
+}
+
+void calibrate()
+{
+    if (tsc_hz != 0) return;
+
+    uint64_t tsc = rdtsc();
+    uint64_t start = now();
+    if (start == 0) return;
+
+    uint64_t elapsed = 0;
+    while ((elapsed = now() - start) < 10000000) asm volatile ("pause");
+    tsc_hz = (rdtsc() - tsc) * 1000000000 / elapsed;
+}
+
+static size_t sorted(size_t *order)
+{
+    size_t count = event_count > MAX_EVENTS ? MAX_EVENTS : event_count;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t t = i;
+        while (t > 0 && events[order[t - 1]].start > events[i].start)
+        {
+            order[t] = order[t - 1];
+            t--;
+        }
+        order[t] = i;
+    }
+    return count;
+}
+
+void summary()
+{
+    calibrate();
+
+    size_t order[MAX_EVENTS];
+    size_t count = sorted(order);
+    if (count == 0) return;
+
+    uint64_t origin = events[order[0]].start;
+    log("Boot timing (%s):", (tsc_hz ? "us" : "TSC ticks"));
+    log("%-32s %4s %10s %10s", "Step", "CPU", "Start", "Duration");
+    for (size_t i = 0; i < count; i++)
+    {
+        event_t &event = events[order[i]];
+        if (event.end == 0) continue;
+
+        size_t len = 0;
+        const char *name = shortname(event.name, len);
+        log("%-32.*s %4ld %10lu %10lu", static_cast<int>(len), name, event.cpu, tsc2us(event.start - origin), tsc2us(event.end - event.start));
+    }
+    serial::newline();
+}
+
+void export_trace()
+{
+    size_t order[MAX_EVENTS];
+    size_t count = sorted(order);
+    if (count == 0 || trace != nullptr) return;
+
+    size_t size = 64 + count * 192;
+    trace = new char[size];
+    trace_len = snprintf(trace, size, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    uint64_t origin = events[order[0]].start;
+    bool first = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        event_t &event = events[order[i]];
+        if (event.end == 0) continue;
+
+        size_t len = 0;
+        const char *name = shortname(event.name, len);
+        trace_len += snprintf(trace + trace_len, size - trace_len, "%s\n{\"name\":\"%.*s\",\"ph\":\"X\",\"pid\":0,\"tid\":%ld,\"ts\":%lu,\"dur\":%lu}",
+            (first ? "" : ","), static_cast<int>(len), name, event.cpu, tsc2us(event.start - origin), tsc2us(event.end - event.start));
+        first = false;
+    }
+    trace_len += snprintf(trace + trace_len, size - trace_len, "\n]}\n");
+
+    if (devfs::initialised)
+    {
+        trace_res *res = new trace_res;
+        res->stat.size = trace_len;
+        res->stat.blksize = 512;
+        res->stat.blocks = DIV_ROUNDUP(trace_len, 512);
+        res->stat.rdev = vfs::dev_new_id();
+        res->stat.mode = 0444 | vfs::ifreg;
+        devfs::add(res, "boottrace");
+    }
+
+    if (strstr(cmdline, "boottrace"))
+    {
+        serial::print(serial::COM1, "--- BOOT TRACE BEGIN ---\n");
+        serial::print(serial::COM1, "%s", trace);
+        serial::print(serial::COM1, "--- BOOT TRACE END ---\n");
+    }
+}
+}
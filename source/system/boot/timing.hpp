@@ -0,0 +1,31 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kernel::system::boot {
+
+static constexpr size_t MAX_EVENTS = 256;
+
+struct event_t
+{
+    const char *name;
+    int64_t cpu;
+    uint64_t start;
+    uint64_t end;
+};
+
+extern uint64_t tsc_hz;
+
+size_t event_begin(const char *name, int64_t cpu = -1);
+void event_end(size_t event);
+
+const char *shortname(const char *name, size_t &len);
+uint64_t tsc2us(uint64_t ticks);
+
+void calibrate();
+void summary();
+void export_trace();
+}
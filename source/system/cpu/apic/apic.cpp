@@ -17,6 +17,8 @@
 namespace kernel::system::cpu::apic {
 
 bool initialised = false;
+
+new_lock(ioapic_lock);
 static bool x2apic = false;
 static uint64_t ticks_in_1ms = 0;
 
@@ -83,12 +85,14 @@ void lapic_init(uint8_t processor_id)
 
 uint32_t ioapic_read(uintptr_t ioapic_address, size_t reg)
 {
+    lockit(ioapic_lock);
     mmoutl(reinterpret_cast<void*>(ioapic_address), reg & 0xFF);
     return mminl(reinterpret_cast<void*>(ioapic_address + 16));
 }
 
 void ioapic_write(uintptr_t ioapic_address, size_t reg, uint32_t data)
 {
+    lockit(ioapic_lock);
     mmoutl(reinterpret_cast<void*>(ioapic_address), reg & 0xFF);
     mmoutl(reinterpret_cast<void*>(ioapic_address + 16), data);
 }
@@ -134,6 +138,31 @@ void ioapic_redirect_gsi(uint32_t gsi, uint8_t vec, uint16_t flags)
     ioapic_write(io_apic, low_index, low);
 }
 
+void ioapic_set_destination(uint32_t gsi, uint32_t lapic_id)
+{
+    size_t io_apic = get_ioapic_by_gsi(gsi)->addr;
+    uint32_t high_index = 0x10 + (gsi - get_ioapic_by_gsi(gsi)->gsib) * 2 + 1;
+
+    uint32_t high = ioapic_read(io_apic, high_index);
+    high &= ~0xFF000000;
+    high |= lapic_id << 24;
+    ioapic_write(io_apic, high_index, high);
+}
+
+void ioapic_set_affinity(uint32_t irq, uint32_t lapic_id)
+{
+    for (size_t i = 0; i < acpi::isos.size(); i++)
+    {
+        if (acpi::isos[i]->irq_source == irq)
+        {
+            ioapic_set_destination(acpi::isos[i]->gsi, lapic_id);
+            return;
+        }
+    }
+
+    ioapic_set_destination(irq, lapic_id);
+}
+
 void ioapic_redirect_irq(uint32_t irq, uint8_t vect)
 {
     for (size_t i = 0; i < acpi::isos.size(); i++)
@@ -29,6 +29,8 @@ void ioapic_write(uintptr_t ioapic_address, size_t reg, uint32_t data);
 
 void ioapic_redirect_gsi(uint32_t gsi, uint8_t vec, uint16_t flags);
 void ioapic_redirect_irq(uint32_t irq, uint8_t vect);
+void ioapic_set_destination(uint32_t gsi, uint32_t lapic_id);
+void ioapic_set_affinity(uint32_t irq, uint32_t lapic_id);
 void apic_send_ipi(uint32_t lapic_id, uint32_t flags);
 void eoi();
 
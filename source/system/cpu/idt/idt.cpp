@@ -1,6 +1,7 @@
 // Copyright (C) 2021-2022  ilobilo
 
 #include <drivers/display/terminal/terminal.hpp>
+#include <system/sched/scheduler/scheduler.hpp>
 #include <system/cpu/syscall/syscall.hpp>
 #include <system/cpu/apic/apic.hpp>
 #include <system/cpu/smp/smp.hpp>
@@ -17,6 +18,7 @@ using namespace kernel::drivers::display;
 namespace kernel::system::cpu::idt {
 
 new_lock(idt_lock);
+new_lock(vector_lock);
 bool initialised = false;
 
 IDTEntry idt[256];
@@ -71,19 +73,28 @@ void init()
 static uint8_t next_free = 48;
 uint8_t alloc_vector()
 {
+    lockit(vector_lock);
     return (++next_free == SYSCALL ? ++next_free : next_free);
 }
 
 void register_interrupt_handler(uint8_t vector, int_handler_func handler, bool ioapic)
 {
     SET_HANDLER(vector, handler);
-    if (ioapic && apic::initialised && vector > 31 && vector < 48) apic::ioapic_redirect_irq(vector - 32, vector);
+    if (ioapic && apic::initialised && vector > 31 && vector < 48)
+    {
+        apic::ioapic_redirect_irq(vector - 32, vector);
+        if (smp::initialised) apic::ioapic_set_affinity(vector - 32, sched::scheduler::irq_target());
+    }
 }
 
 void register_interrupt_handler(uint8_t vector, int_handler_func_arg handler, uint64_t args, bool ioapic)
 {
     SET_HANDLER_ARG(vector, handler, args);
-    if (ioapic && apic::initialised && vector > 31 && vector < 48) apic::ioapic_redirect_irq(vector - 32, vector);
+    if (ioapic && apic::initialised && vector > 31 && vector < 48)
+    {
+        apic::ioapic_redirect_irq(vector - 32, vector);
+        if (smp::initialised) apic::ioapic_set_affinity(vector - 32, sched::scheduler::irq_target());
+    }
 }
 
 static const char *exception_messages[32] = {
@@ -147,11 +158,35 @@ static void exception_handler(registers_t *regs)
             auto [range, mem_page, file_page] = pagemap->addr2range(addr);
             if (range == nullptr) break;
 
-            void *page = nullptr;
-            if (range->flags & vmm::MapAnon) page = pmm::alloc();
-            else page = range->global->res->mmap(file_page, range->flags);
+            bool present = regs->error_code & 0x01;
+            bool write = regs->error_code & 0x02;
+            bool cow = (range->flags & vmm::MapPrivate) && (range->prot & vmm::ProtWrite);
 
-            range->global->map_in_range(mem_page * vmm::page_size, reinterpret_cast<uint64_t>(page), range->prot);
+            void *page = nullptr;
+            int prot = range->prot;
+            if (present)
+            {
+                if (write == false || cow == false) break;
+
+                uint64_t old = pagemap->virt2phys(mem_page * vmm::page_size);
+                if (old == 0) break;
+
+                page = pmm::alloc();
+                memcpy(reinterpret_cast<void*>(reinterpret_cast<uint64_t>(page) + hhdm_offset), reinterpret_cast<void*>(old + hhdm_offset), vmm::page_size);
+            }
+            else if (range->flags & vmm::MapAnon) page = pmm::alloc();
+            else
+            {
+                if (cow && write == false)
+                {
+                    page = range->global->res->mmap(file_page, (range->flags & ~vmm::MapPrivate) | vmm::MapShared);
+                    if (page != nullptr) prot &= ~vmm::ProtWrite;
+                }
+                if (page == nullptr) page = range->global->res->mmap(file_page, range->flags);
+            }
+            if (page == nullptr) break;
+
+            range->global->map_in_range(mem_page * vmm::page_size, reinterpret_cast<uint64_t>(page), prot);
             halt = false;
         }
     }
@@ -3,10 +3,13 @@
 #include <system/sched/scheduler/scheduler.hpp>
 #include <system/cpu/syscall/syscall.hpp>
 #include <system/cpu/apic/apic.hpp>
+#include <system/boot/timing.hpp>
+#include <system/boot/boot.hpp>
 #include <system/cpu/idt/idt.hpp>
 #include <system/cpu/smp/smp.hpp>
 #include <system/mm/pmm/pmm.hpp>
 #include <system/mm/vmm/vmm.hpp>
+#include <system/vdso/vdso.hpp>
 #include <kernel/kernel.hpp>
 #include <lib/alloc.hpp>
 #include <lib/panic.hpp>
@@ -92,6 +95,8 @@ static void cpu_init(limine_smp_info *cpu)
     wrmsr(0xC0000082, reinterpret_cast<uint64_t>(syscall::syscall_entry));
     wrmsr(0xC0000084, ~static_cast<uint32_t>(0x02));
 
+    if (__get_cpuid(0x80000001, &a, &b, &c, &d) && (d & CPUID_RDTSCP)) wrmsr(vdso::TSC_AUX, this_cpu->id);
+
     log("CPU %ld is up", this_cpu->id);
     this_cpu->is_up = true;
 
@@ -99,6 +104,7 @@ static void cpu_init(limine_smp_info *cpu)
     if (cpu->lapic_id != smp_request.response->bsp_lapic_id)
     {
         if (apic::initialised) apic::lapic_init(this_cpu->lapic_id);
+        boot::worker();
         scheduler::init();
         while (true) asm volatile ("hlt");
     }
@@ -125,12 +131,16 @@ void init()
 
         if (smp_request.response->bsp_lapic_id != smp_info->lapic_id)
         {
+            size_t event = boot::event_begin("AP startup", i);
             smp_request.response->cpus[i]->goto_address = cpu_init;
             while (cpus[i].is_up == false);
+            boot::event_end(event);
         }
         else cpu_init(smp_info);
     }
 
+    scheduler::init_affinity(smp_request.response->cpu_count);
+
     log("All CPUs are up\n");
     initialised = true;
 }
@@ -1,12 +1,26 @@
 %include "lib/cpu.inc"
 
 EXTERN syscall_table
+EXTERN syscall_count
+EXTERN syscall_enosys
+EXTERN syscall_trace_mode
+EXTERN syscall_traced
+
+FRAME_R11 equ 32
+FRAME_R10 equ 40
+FRAME_R9 equ 48
+FRAME_R8 equ 56
+FRAME_RDI equ 72
+FRAME_RSI equ 80
+FRAME_RDX equ 88
+FRAME_RCX equ 96
+FRAME_RAX equ 112
+FRAME_RSP equ 160
 
 syscall_entry:
     swapgs
     mov gs:[8], rsp
     mov rsp, gs:[16]
-    sti
 
     push qword 0x43
     push qword gs:[8]
@@ -16,15 +30,37 @@ syscall_entry:
     push 0
     push 0
     pushall
+    sti
 
     mov rdi, rsp
-    lea rbx, [rel syscall_table]
-    call [rbx + rax * 8]
-
-    popall
-    add rsp, 56
+    cmp byte [rel syscall_trace_mode], 0
+    jne .traced
+    cmp rax, [rel syscall_count]
+    jae .invalid
+    lea rcx, [rel syscall_table]
+    call [rcx + rax * 8]
 
+.return:
     cli
+    mov rax, [rsp + FRAME_RAX]
+    mov rdx, [rsp + FRAME_RDX]
+    mov rdi, [rsp + FRAME_RDI]
+    mov rsi, [rsp + FRAME_RSI]
+    mov r8, [rsp + FRAME_R8]
+    mov r9, [rsp + FRAME_R9]
+    mov r10, [rsp + FRAME_R10]
+    mov r11, [rsp + FRAME_R11]
+    mov rcx, [rsp + FRAME_RCX]
+    mov rsp, [rsp + FRAME_RSP]
+
     swapgs
     o64 sysret
-GLOBAL syscall_entry
\ No newline at end of file
+
+.traced:
+    call syscall_traced
+    jmp .return
+
+.invalid:
+    call syscall_enosys
+    jmp .return
+GLOBAL syscall_entry
@@ -1,11 +1,19 @@
 // Copyright (C) 2021-2022  ilobilo
 
 #include <drivers/display/terminal/terminal.hpp>
+#include <drivers/block/drivemgr/drivemgr.hpp>
 #include <system/sched/scheduler/scheduler.hpp>
 #include <system/cpu/syscall/syscall.hpp>
+#include <system/cpu/syscall/trace.hpp>
+#include <system/cpu/smp/smp.hpp>
+#include <system/sched/futex/futex.hpp>
+#include <system/epoll/epoll.hpp>
 #include <system/sched/rtc/rtc.hpp>
+#include <system/uring/uring.hpp>
 #include <system/mm/pmm/pmm.hpp>
+#include <system/vdso/vdso.hpp>
 #include <system/acpi/acpi.hpp>
+#include <system/vfs/pipe.hpp>
 #include <system/vfs/vfs.hpp>
 #include <lib/memory.hpp>
 #include <lib/string.hpp>
@@ -14,6 +22,7 @@
 #include <lib/log.hpp>
 
 using namespace kernel::drivers::display;
+using namespace kernel::drivers::block;
 using namespace kernel::system::sched;
 using namespace kernel::system::cpu;
 using namespace kernel::system::mm;
@@ -90,6 +99,7 @@ static void syscall_ioctl(registers_t *regs)
     {
         RAX_RET = -1;
         RDX_ERRNO = -errno_get();
+        fd->unref();
         return;
     }
     RAX_RET = ret;
@@ -97,6 +107,72 @@ static void syscall_ioctl(registers_t *regs)
     fd->unref();
 }
 
+static void syscall_rw(registers_t *regs, vfs::iovec_t *iov, size_t count, int64_t offset, bool positional, bool write)
+{
+    if (count > vfs::iov_max || (positional && offset < 0))
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -EINVAL;
+        return;
+    }
+
+    vfs::fd_t *fd = vfs::fd_from_fdnum(nullptr, RDI_ARG0);
+    if (fd == nullptr)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+
+    vfs::handle_t *handle = fd->handle;
+    int64_t ret = -1;
+    if (positional == false) ret = write ? handle->writev(iov, count) : handle->readv(iov, count);
+    else if (vfs::isifo(handle->res->stat.mode)) errno_set(ESPIPE);
+    else ret = write ? handle->pwritev(iov, count, offset) : handle->preadv(iov, count, offset);
+    fd->unref();
+
+    if (ret == -1)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+    RAX_RET = ret;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_pread(registers_t *regs)
+{
+    vfs::iovec_t iov { reinterpret_cast<void*>(RSI_ARG1), RDX_ARG2 };
+    syscall_rw(regs, &iov, 1, R10_ARG3, true, false);
+}
+
+static void syscall_pwrite(registers_t *regs)
+{
+    vfs::iovec_t iov { reinterpret_cast<void*>(RSI_ARG1), RDX_ARG2 };
+    syscall_rw(regs, &iov, 1, R10_ARG3, true, true);
+}
+
+static void syscall_readv(registers_t *regs)
+{
+    syscall_rw(regs, reinterpret_cast<vfs::iovec_t*>(RSI_ARG1), RDX_ARG2, 0, false, false);
+}
+
+static void syscall_writev(registers_t *regs)
+{
+    syscall_rw(regs, reinterpret_cast<vfs::iovec_t*>(RSI_ARG1), RDX_ARG2, 0, false, true);
+}
+
+static void syscall_preadv(registers_t *regs)
+{
+    syscall_rw(regs, reinterpret_cast<vfs::iovec_t*>(RSI_ARG1), RDX_ARG2, R10_ARG3, true, false);
+}
+
+static void syscall_pwritev(registers_t *regs)
+{
+    syscall_rw(regs, reinterpret_cast<vfs::iovec_t*>(RSI_ARG1), RDX_ARG2, R10_ARG3, true, true);
+}
+
 static void syscall_access(registers_t *regs)
 {
     uint64_t path = RDI_ARG0;
@@ -110,6 +186,12 @@ static void syscall_access(registers_t *regs)
     syscall_table[SYSCALL_FACCESAT](regs);
 }
 
+static void syscall_pipe(registers_t *regs)
+{
+    RSI_ARG1 = 0;
+    syscall_table[SYSCALL_PIPE2](regs);
+}
+
 static void syscall_getpid(registers_t *regs)
 {
     int pid = getpid();
@@ -123,7 +205,7 @@ static void syscall_getpid(registers_t *regs)
     RDX_ERRNO = 0;
 }
 
-static void syscall_fork(registers_t *regs)
+static scheduler::thread_t *fork_process(registers_t *regs)
 {
     auto *oldproc = this_proc();
     auto *newproc = new scheduler::process_t;
@@ -137,27 +219,135 @@ static void syscall_fork(registers_t *regs)
     newproc->parent = oldproc;
     newproc->thread_stack_top = oldproc->thread_stack_top;
     newproc->mmap_anon_base = oldproc->mmap_anon_base;
+    vdso::map(newproc);
 
-    for (size_t i = 0; i < scheduler::max_fds; i++)
+    oldproc->fd_lock.lock();
+    for (size_t i = 0; oldproc->fdt != nullptr && i < oldproc->fdt->size; i++)
     {
-        if (oldproc->fds[i] == nullptr) continue;
-        vfs::fdnum_dup(oldproc, i, newproc, i, 0, true, false);
+        if (oldproc->fdt->test(i)) vfs::fdnum_dup(oldproc, i, newproc, i, 0, true, false);
     }
+    oldproc->fd_lock.unlock();
+
+    scheduler::thread_t *thread = newproc->add_thread(this_thread()->fork(regs));
+    thread->regs.rax = 0;
+    thread->regs.rdx = 0;
+    return thread;
+}
 
-    newproc->add_thread(this_thread()->fork(regs));
+static void syscall_fork(registers_t *regs)
+{
+    scheduler::process_t *newproc = fork_process(regs)->parent;
     newproc->enqueue();
 
     RAX_RET = newproc->pid;
     RDX_ERRNO = 0;
 }
 
+static void syscall_clone(registers_t *regs)
+{
+    uint64_t flags = RDI_ARG0;
+    uint64_t stack = RSI_ARG1;
+    int *parent_tid = reinterpret_cast<int*>(RDX_ARG2);
+    int *child_tid = reinterpret_cast<int*>(R10_ARG3);
+    uint64_t tls = R8_ARG4;
+
+    bool thread = (flags & CLONE_THREAD) || (flags & (CLONE_VM | CLONE_FILES)) == (CLONE_VM | CLONE_FILES);
+    if ((thread && (!(flags & CLONE_VM) || stack == 0)) || (!thread && (flags & CLONE_VM)))
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -EINVAL;
+        return;
+    }
+
+    int ret = 0;
+    if (thread)
+    {
+        scheduler::thread_t *newthread = this_thread()->clone(regs, stack, (flags & CLONE_SETTLS) ? tls : 0);
+        this_proc()->add_thread(newthread, false);
+
+        if (flags & CLONE_CHILD_CLEARTID) newthread->clear_tid = reinterpret_cast<uint32_t*>(child_tid);
+        if ((flags & CLONE_CHILD_SETTID) && child_tid) *child_tid = newthread->tid;
+        if ((flags & CLONE_PARENT_SETTID) && parent_tid) *parent_tid = newthread->tid;
+
+        ret = newthread->tid;
+        __atomic_store_n(&newthread->state, scheduler::READY, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        scheduler::thread_t *newthread = fork_process(regs);
+        scheduler::process_t *newproc = newthread->parent;
+
+        if (stack) newthread->regs.rsp = stack;
+        if (flags & CLONE_SETTLS) newthread->fsbase = tls;
+        if (flags & CLONE_CHILD_CLEARTID) newthread->clear_tid = reinterpret_cast<uint32_t*>(child_tid);
+        if ((flags & CLONE_CHILD_SETTID) && child_tid)
+        {
+            uint64_t vaddr = reinterpret_cast<uint64_t>(child_tid);
+            uint64_t page = newproc->pagemap->virt2phys(vaddr & ~0xFFFUL);
+            if (page) *reinterpret_cast<int*>(page + hhdm_offset + (vaddr & 0xFFF)) = newproc->pid;
+        }
+        if ((flags & CLONE_PARENT_SETTID) && parent_tid) *parent_tid = newproc->pid;
+
+        ret = newproc->pid;
+        newproc->enqueue();
+    }
+
+    RAX_RET = ret;
+    RDX_ERRNO = 0;
+}
+
 static void syscall_exit(registers_t *regs)
+{
+    size_t alive = 0;
+    uint64_t flags = irq_save();
+    scheduler::list_lock.lock();
+    for (scheduler::thread_t *thread : this_proc()->threads)
+    {
+        if (thread->user && thread->state != scheduler::KILLED) alive++;
+    }
+    scheduler::list_lock.unlock();
+    irq_restore(flags);
+
+    if (alive > 1) this_thread()->exit();
+    else this_proc()->exit();
+    RAX_RET = 0;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_exit_group(registers_t *regs)
 {
     this_proc()->exit();
     RAX_RET = 0;
     RDX_ERRNO = 0;
 }
 
+static void syscall_gettid(registers_t *regs)
+{
+    RAX_RET = gettid();
+    RDX_ERRNO = 0;
+}
+
+static void syscall_arch_prctl(registers_t *regs)
+{
+    uint64_t addr = RSI_ARG1;
+    switch (RDI_ARG0)
+    {
+        case ARCH_SET_FS:
+            this_thread()->fsbase = addr;
+            set_fs(addr);
+            break;
+        case ARCH_GET_FS:
+            *reinterpret_cast<uint64_t*>(addr) = get_fs();
+            break;
+        default:
+            RAX_RET = -1;
+            RDX_ERRNO = -EINVAL;
+            return;
+    }
+    RAX_RET = 0;
+    RDX_ERRNO = 0;
+}
+
 #define SYSNAME "Kernel"
 #define NODENAME ""
 #define RELEASE KERNEL_VERSION
@@ -198,6 +388,27 @@ static void syscall_uname(registers_t *regs)
     RDX_ERRNO = 0;
 }
 
+static void syscall_fsync(registers_t *regs)
+{
+    vfs::fd_t *fd = vfs::fd_from_fdnum(nullptr, RDI_ARG0);
+    if (fd == nullptr)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+    if (!fd->handle->res->sync(fd->handle))
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        fd->unref();
+        return;
+    }
+    RAX_RET = 0;
+    RDX_ERRNO = 0;
+    fd->unref();
+}
+
 static void syscall_getcwd(registers_t *regs)
 {
     char *buffer = reinterpret_cast<char*>(RDI_ARG0);
@@ -420,6 +631,13 @@ static void syscall_getppid(registers_t *regs)
     RDX_ERRNO = 0;
 }
 
+static void syscall_sync(registers_t *regs)
+{
+    drivemgr::sync();
+    RAX_RET = 0;
+    RDX_ERRNO = 0;
+}
+
 static void syscall_mount(registers_t *regs)
 {
     std::string source(reinterpret_cast<char*>(RDI_ARG0));
@@ -498,6 +716,201 @@ static void syscall_time(registers_t *regs)
     RDX_ERRNO = 0;
 }
 
+static void syscall_futex(registers_t *regs)
+{
+    uint32_t *uaddr = reinterpret_cast<uint32_t*>(RDI_ARG0);
+    int op = RSI_ARG1;
+    uint32_t val = RDX_ARG2;
+    vfs::timespec_t *timeout = reinterpret_cast<vfs::timespec_t*>(R10_ARG3);
+    uint32_t *uaddr2 = reinterpret_cast<uint32_t*>(R8_ARG4);
+    uint32_t val3 = R9_ARG5;
+
+    int ret = -1;
+    switch (op & futex::FUTEX_CMD_MASK)
+    {
+        case futex::FUTEX_WAIT:
+        case futex::FUTEX_WAIT_BITSET:
+        {
+            bool bitset = (op & futex::FUTEX_CMD_MASK) == futex::FUTEX_WAIT_BITSET;
+            uint64_t deadline = 0;
+            if (timeout != nullptr)
+            {
+                if (timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000)
+                {
+                    errno_set(EINVAL);
+                    break;
+                }
+                uint64_t ns = timeout->tv_sec * 1000000000 + timeout->tv_nsec;
+                if (bitset == false) deadline = vdso::monotonic() + ns;
+                else if (op & futex::FUTEX_CLOCK_REALTIME)
+                {
+                    uint64_t offset = vdso::realtime() - vdso::monotonic();
+                    deadline = ns > offset ? ns - offset : 1;
+                }
+                else deadline = ns;
+                if (deadline == 0) deadline = 1;
+            }
+            ret = futex::wait(uaddr, val, deadline, bitset ? val3 : futex::BITSET_ANY);
+            break;
+        }
+        case futex::FUTEX_WAKE:
+            ret = futex::wake(uaddr, val);
+            break;
+        case futex::FUTEX_WAKE_BITSET:
+            ret = futex::wake(uaddr, val, val3);
+            break;
+        case futex::FUTEX_REQUEUE:
+            ret = futex::requeue(uaddr, val, uaddr2, R10_ARG3, nullptr);
+            break;
+        case futex::FUTEX_CMP_REQUEUE:
+            ret = futex::requeue(uaddr, val, uaddr2, R10_ARG3, &val3);
+            break;
+        default:
+            errno_set(ENOSYS);
+            break;
+    }
+
+    if (ret == -1)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+    RAX_RET = ret;
+    RDX_ERRNO = 0;
+}
+
+// Works on the mask under list_lock, the thread may exit as soon as it's dropped
+static int affinity_access(int pid, cpumask_t &mask, bool set)
+{
+    if (pid == 0) pid = gettid();
+
+    int ret = ESRCH;
+    uint64_t flags = irq_save();
+    scheduler::list_lock.lock();
+    for (scheduler::thread_t *thread : this_proc()->threads)
+    {
+        if (thread->tid != pid) continue;
+
+        if (set) ret = scheduler::set_affinity(thread, mask) ? 0 : EINVAL;
+        else
+        {
+            mask = thread->affinity;
+            ret = 0;
+        }
+        break;
+    }
+    scheduler::list_lock.unlock();
+    irq_restore(flags);
+    return ret;
+}
+
+static void syscall_sched_setaffinity(registers_t *regs)
+{
+    size_t len = RSI_ARG1;
+    uint8_t *mask = reinterpret_cast<uint8_t*>(RDX_ARG2);
+
+    cpumask_t affinity;
+    if (mask != nullptr) memcpy(affinity.bits, mask, MIN(len, sizeof(affinity.bits)));
+
+    int err = affinity_access(RDI_ARG0, affinity, true);
+    if (err != 0)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -err;
+        return;
+    }
+
+    if ((RDI_ARG0 == 0 || static_cast<int>(RDI_ARG0) == gettid()) && !affinity.test(this_cpu->id)) scheduler::yield();
+    RAX_RET = 0;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_sched_getaffinity(registers_t *regs)
+{
+    size_t len = RSI_ARG1;
+    uint8_t *mask = reinterpret_cast<uint8_t*>(RDX_ARG2);
+
+    if (mask == nullptr || len < sizeof(uint64_t) || (len & (sizeof(uint64_t) - 1)))
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -EINVAL;
+        return;
+    }
+
+    cpumask_t affinity;
+    int err = affinity_access(RDI_ARG0, affinity, false);
+    if (err != 0)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -err;
+        return;
+    }
+
+    len = MIN(len, sizeof(affinity.bits));
+    memcpy(mask, affinity.bits, len);
+    RAX_RET = len;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_gettimeofday(registers_t *regs)
+{
+    vdso::timeval_t *tv = reinterpret_cast<vdso::timeval_t*>(RDI_ARG0);
+    if (tv != nullptr)
+    {
+        uint64_t now = vdso::realtime();
+        tv->tv_sec = now / 1000000000;
+        tv->tv_usec = (now % 1000000000) / 1000;
+    }
+    RAX_RET = 0;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_clock_gettime(registers_t *regs)
+{
+    vfs::timespec_t *tp = reinterpret_cast<vfs::timespec_t*>(RSI_ARG1);
+    if (tp == nullptr)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -EFAULT;
+        return;
+    }
+
+    uint64_t now = 0;
+    switch (RDI_ARG0)
+    {
+        case vdso::CLOCK_REALTIME:
+        case vdso::CLOCK_REALTIME_COARSE:
+            now = vdso::realtime();
+            break;
+        case vdso::CLOCK_MONOTONIC:
+        case vdso::CLOCK_MONOTONIC_RAW:
+        case vdso::CLOCK_MONOTONIC_COARSE:
+        case vdso::CLOCK_BOOTTIME:
+            now = vdso::monotonic();
+            break;
+        default:
+            RAX_RET = -1;
+            RDX_ERRNO = -EINVAL;
+            return;
+    }
+
+    tp->tv_sec = now / 1000000000;
+    tp->tv_nsec = now % 1000000000;
+    RAX_RET = 0;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_getcpu(registers_t *regs)
+{
+    uint32_t *cpu = reinterpret_cast<uint32_t*>(RDI_ARG0);
+    uint32_t *node = reinterpret_cast<uint32_t*>(RSI_ARG1);
+    if (cpu != nullptr) *cpu = this_cpu->id;
+    if (node != nullptr) *node = 0;
+    RAX_RET = 0;
+    RDX_ERRNO = 0;
+}
+
 static void syscall_openat(registers_t *regs)
 {
     std::string path(reinterpret_cast<char*>(RSI_ARG1));
@@ -766,43 +1179,371 @@ static void syscall_faccessat(registers_t *regs)
     RDX_ERRNO = 0;
 }
 
-syscall_t syscall_table[] = {
-    [SYSCALL_READ] = syscall_read,
-    [SYSCALL_WRITE] = syscall_write,
-    [SYSCALL_OPEN] = syscall_open,
-    [SYSCALL_CLOSE] = syscall_close,
-    [SYSCALL_IOCTL] = syscall_ioctl,
-    [SYSCALL_ACCESS] = syscall_access,
-    [SYSCALL_GETPID] = syscall_getpid,
-    [SYSCALL_FORK] = syscall_fork,
-    [SYSCALL_EXIT] = syscall_exit,
-    [SYSCALL_UNAME] = syscall_uname,
-    [SYSCALL_GETCWD] = syscall_getcwd,
-    [SYSCALL_CHDIR] = syscall_chdir,
-    [SYSCALL_MKDIR] = syscall_mkdir,
-    [SYSCALL_RMDIR] = syscall_rmdir,
-    [SYSCALL_LINK] = syscall_link,
-    [SYSCALL_CHMOD] = syscall_chmod,
-    [SYSCALL_FCHMOD] = syscall_fchmod,
-    [SYSCALL_CHOWN] = syscall_chown,
-    [SYSCALL_FCHOWN] = syscall_fchown,
-    [SYSCALL_LCHOWN] = syscall_lchown,
-    [SYSCALL_SYSINFO] = syscall_sysinfo,
-    [SYSCALL_GETPPID] = syscall_getppid,
-    [SYSCALL_MOUNT] = syscall_mount,
-    [SYSCALL_REBOOT] = syscall_reboot,
-    [SYSCALL_TIME] = syscall_time,
-    [SYSCALL_OPENAT] = syscall_openat,
-    [SYSCALL_MKDIRAT] = syscall_mkdirat,
-    [SYSCALL_UNLINKAT] = syscall_unlinkat,
-    [SYSCALL_LINKAT] = syscall_linkat,
-    [SYSCALL_READLINKAT] = syscall_readlinkat,
-    [SYSCALL_FACCESAT] = syscall_faccessat
-};
+static void syscall_splice(registers_t *regs)
+{
+    vfs::fd_t *in = vfs::fd_from_fdnum(nullptr, RDI_ARG0);
+    if (in == nullptr)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+    vfs::fd_t *out = vfs::fd_from_fdnum(nullptr, RDX_ARG2);
+    if (out == nullptr)
+    {
+        in->unref();
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+
+    int64_t *off_in = reinterpret_cast<int64_t*>(RSI_ARG1);
+    int64_t *off_out = reinterpret_cast<int64_t*>(R10_ARG3);
+
+    int64_t ret = vfs::splice(in, off_in, out, off_out, R8_ARG4, R9_ARG5);
+    in->unref();
+    out->unref();
+
+    if (ret == -1)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+    RAX_RET = ret;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_vmsplice(registers_t *regs)
+{
+    vfs::fd_t *fd = vfs::fd_from_fdnum(nullptr, RDI_ARG0);
+    if (fd == nullptr)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+
+    int64_t ret = vfs::vmsplice(fd, reinterpret_cast<vfs::iovec_t*>(RSI_ARG1), RDX_ARG2, R10_ARG3);
+    fd->unref();
+
+    if (ret == -1)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+    RAX_RET = ret;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_pipe2(registers_t *regs)
+{
+    int *fds = reinterpret_cast<int*>(RDI_ARG0);
+    int flags = RSI_ARG1;
+
+    if (flags & ~(vfs::o_cloexec | vfs::o_nonblock))
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -EINVAL;
+        return;
+    }
+
+    vfs::pipe_t *pipe = vfs::new_pipe();
+
+    int rfd = vfs::fdnum_from_res(nullptr, pipe->reader, vfs::o_rdonly | flags, 0, false);
+    int wfd = (rfd == -1) ? -1 : vfs::fdnum_from_res(nullptr, pipe->writer, vfs::o_wronly | flags, 0, false);
+    if (wfd == -1)
+    {
+        if (rfd != -1) vfs::fdnum_close(nullptr, rfd);
+        RAX_RET = -1;
+        RDX_ERRNO = -EMFILE;
+        return;
+    }
+
+    fds[0] = rfd;
+    fds[1] = wfd;
+
+    RAX_RET = 0;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_syncfs(registers_t *regs)
+{
+    vfs::fd_t *fd = vfs::fd_from_fdnum(nullptr, RDI_ARG0);
+    if (fd == nullptr)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+    fd->unref();
+
+    if (!drivemgr::sync())
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -EIO;
+        return;
+    }
+    RAX_RET = 0;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_epoll_create1(registers_t *regs)
+{
+    int fdnum = epoll::create(RDI_ARG0);
+    if (fdnum == -1)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+    RAX_RET = fdnum;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_epoll_create(registers_t *regs)
+{
+    if (static_cast<int>(RDI_ARG0) <= 0)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -EINVAL;
+        return;
+    }
+    RDI_ARG0 = 0;
+    syscall_epoll_create1(regs);
+}
+
+static void syscall_epoll_ctl(registers_t *regs)
+{
+    vfs::fd_t *fd = vfs::fd_from_fdnum(nullptr, RDI_ARG0);
+    if (fd == nullptr)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+
+    int ret = epoll::ctl(fd, RSI_ARG1, RDX_ARG2, reinterpret_cast<epoll::event_t*>(R10_ARG3));
+    fd->unref();
+    if (ret == -1)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+    RAX_RET = 0;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_epoll_wait(registers_t *regs)
+{
+    vfs::fd_t *fd = vfs::fd_from_fdnum(nullptr, RDI_ARG0);
+    if (fd == nullptr)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+
+    int ret = epoll::wait(fd, reinterpret_cast<epoll::event_t*>(RSI_ARG1), RDX_ARG2, static_cast<int>(R10_ARG3));
+    fd->unref();
+    if (ret == -1)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+    RAX_RET = ret;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_uring_setup(registers_t *regs)
+{
+    int fdnum = uring::setup(RDI_ARG0, reinterpret_cast<uring::params_t*>(RSI_ARG1));
+    if (fdnum == -1)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+    RAX_RET = fdnum;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_uring_enter(registers_t *regs)
+{
+    vfs::fd_t *fd = vfs::fd_from_fdnum(nullptr, RDI_ARG0);
+    if (fd == nullptr)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+
+    int64_t ret = uring::enter(fd, RSI_ARG1, RDX_ARG2, R10_ARG3);
+    fd->unref();
+
+    if (ret == -1)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -errno_get();
+        return;
+    }
+    RAX_RET = ret;
+    RDX_ERRNO = 0;
+}
+
+static void syscall_batch(registers_t *regs)
+{
+    batch_t *entries = reinterpret_cast<batch_t*>(RDI_ARG0);
+    size_t count = RSI_ARG1;
+    uint32_t flags = RDX_ARG2;
+
+    if (entries == nullptr || count > MAX_BATCH)
+    {
+        RAX_RET = -1;
+        RDX_ERRNO = -EINVAL;
+        return;
+    }
+
+    size_t done = 0;
+    for (; done < count; done++)
+    {
+        batch_t &entry = entries[done];
+        if (entry.number == SYSCALL_BATCH || entry.number == SYSCALL_FORK || entry.number == SYSCALL_CLONE || entry.number == SYSCALL_EXIT || entry.number == SYSCALL_EXIT_GROUP || (entry.chain && entry.from >= done))
+        {
+            entry.result = -EINVAL;
+        }
+        else
+        {
+            for (size_t i = 0; i < 6; i++)
+            {
+                if (entry.chain & (1 << i)) entry.args[i] = entries[entry.from].result;
+            }
+            entry.result = invoke(entry.number, entry.args[0], entry.args[1], entry.args[2], entry.args[3], entry.args[4], entry.args[5]);
+        }
+
+        if (entry.result < 0 && ((flags | entry.flags) & batch_abort))
+        {
+            done++;
+            break;
+        }
+    }
+    for (size_t i = done; i < count; i++) entries[i].result = -ECANCELED;
+
+    RAX_RET = done;
+    RDX_ERRNO = 0;
+}
+
+extern "C" void syscall_enosys(registers_t *regs)
+{
+    RAX_RET = -1;
+    RDX_ERRNO = -ENOSYS;
+}
+
+static consteval syscall_table_t make_table()
+{
+    syscall_table_t table { };
+    for (syscall_t &entry : table.entries) entry = syscall_enosys;
+
+    table[SYSCALL_READ] = syscall_read;
+    table[SYSCALL_WRITE] = syscall_write;
+    table[SYSCALL_OPEN] = syscall_open;
+    table[SYSCALL_CLOSE] = syscall_close;
+    table[SYSCALL_IOCTL] = syscall_ioctl;
+    table[SYSCALL_PREAD] = syscall_pread;
+    table[SYSCALL_PWRITE] = syscall_pwrite;
+    table[SYSCALL_READV] = syscall_readv;
+    table[SYSCALL_WRITEV] = syscall_writev;
+    table[SYSCALL_ACCESS] = syscall_access;
+    table[SYSCALL_PIPE] = syscall_pipe;
+    table[SYSCALL_GETPID] = syscall_getpid;
+    table[SYSCALL_CLONE] = syscall_clone;
+    table[SYSCALL_FORK] = syscall_fork;
+    table[SYSCALL_EXIT] = syscall_exit;
+    table[SYSCALL_UNAME] = syscall_uname;
+    table[SYSCALL_FSYNC] = syscall_fsync;
+    table[SYSCALL_FDATASYNC] = syscall_fsync;
+    table[SYSCALL_GETCWD] = syscall_getcwd;
+    table[SYSCALL_CHDIR] = syscall_chdir;
+    table[SYSCALL_MKDIR] = syscall_mkdir;
+    table[SYSCALL_RMDIR] = syscall_rmdir;
+    table[SYSCALL_LINK] = syscall_link;
+    table[SYSCALL_CHMOD] = syscall_chmod;
+    table[SYSCALL_FCHMOD] = syscall_fchmod;
+    table[SYSCALL_CHOWN] = syscall_chown;
+    table[SYSCALL_FCHOWN] = syscall_fchown;
+    table[SYSCALL_LCHOWN] = syscall_lchown;
+    table[SYSCALL_GETTIMEOFDAY] = syscall_gettimeofday;
+    table[SYSCALL_SYSINFO] = syscall_sysinfo;
+    table[SYSCALL_GETPPID] = syscall_getppid;
+    table[SYSCALL_ARCH_PRCTL] = syscall_arch_prctl;
+    table[SYSCALL_GETTID] = syscall_gettid;
+    table[SYSCALL_SYNC] = syscall_sync;
+    table[SYSCALL_MOUNT] = syscall_mount;
+    table[SYSCALL_REBOOT] = syscall_reboot;
+    table[SYSCALL_TIME] = syscall_time;
+    table[SYSCALL_FUTEX] = syscall_futex;
+    table[SYSCALL_SCHED_SETAFFINITY] = syscall_sched_setaffinity;
+    table[SYSCALL_SCHED_GETAFFINITY] = syscall_sched_getaffinity;
+    table[SYSCALL_EPOLL_CREATE] = syscall_epoll_create;
+    table[SYSCALL_CLOCK_GETTIME] = syscall_clock_gettime;
+    table[SYSCALL_EXIT_GROUP] = syscall_exit_group;
+    table[SYSCALL_EPOLL_WAIT] = syscall_epoll_wait;
+    table[SYSCALL_EPOLL_CTL] = syscall_epoll_ctl;
+    table[SYSCALL_OPENAT] = syscall_openat;
+    table[SYSCALL_MKDIRAT] = syscall_mkdirat;
+    table[SYSCALL_UNLINKAT] = syscall_unlinkat;
+    table[SYSCALL_LINKAT] = syscall_linkat;
+    table[SYSCALL_READLINKAT] = syscall_readlinkat;
+    table[SYSCALL_FACCESAT] = syscall_faccessat;
+    table[SYSCALL_SPLICE] = syscall_splice;
+    table[SYSCALL_VMSPLICE] = syscall_vmsplice;
+    table[SYSCALL_EPOLL_PWAIT] = syscall_epoll_wait;
+    table[SYSCALL_EPOLL_CREATE1] = syscall_epoll_create1;
+    table[SYSCALL_PIPE2] = syscall_pipe2;
+    table[SYSCALL_PREADV] = syscall_preadv;
+    table[SYSCALL_PWRITEV] = syscall_pwritev;
+    table[SYSCALL_SYNCFS] = syscall_syncfs;
+    table[SYSCALL_GETCPU] = syscall_getcpu;
+    table[SYSCALL_URING_SETUP] = syscall_uring_setup;
+    table[SYSCALL_URING_ENTER] = syscall_uring_enter;
+    table[SYSCALL_BATCH] = syscall_batch;
+    return table;
+}
+
+extern "C" constinit const syscall_table_t syscall_table = make_table();
+extern "C" const size_t syscall_count = MAX_SYSCALLS;
+
+void dispatch(registers_t *regs)
+{
+    if (RAX_RET < MAX_SYSCALLS) syscall_table[RAX_RET](regs);
+    else syscall_enosys(regs);
+}
 
 static void handler(registers_t *regs)
 {
-    if (RAX_RET >= 0 && syscall_table[RAX_RET]) syscall_table[RAX_RET](regs);
+    if (trace::syscall_trace_mode) [[unlikely]] trace::syscall_traced(regs);
+    else dispatch(regs);
+}
+
+int64_t invoke(size_t number, uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5)
+{
+    registers_t frame { };
+    registers_t *regs = &frame;
+
+    RAX_RET = number;
+    RDI_ARG0 = arg0;
+    RSI_ARG1 = arg1;
+    RDX_ARG2 = arg2;
+    R10_ARG3 = arg3;
+    R8_ARG4 = arg4;
+    R9_ARG5 = arg5;
+
+    handler(regs);
+    if (static_cast<int64_t>(RAX_RET) == -1) return RDX_ERRNO;
+    return RAX_RET;
 }
 
 void reboot(std::string message)
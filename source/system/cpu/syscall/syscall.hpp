@@ -30,11 +30,19 @@ enum syscalls
     SYSCALL_OPEN = 2,
     SYSCALL_CLOSE = 3,
     SYSCALL_IOCTL = 16,
+    SYSCALL_PREAD = 17,
+    SYSCALL_PWRITE = 18,
+    SYSCALL_READV = 19,
+    SYSCALL_WRITEV = 20,
     SYSCALL_ACCESS = 21,
+    SYSCALL_PIPE = 22,
     SYSCALL_GETPID = 39,
+    SYSCALL_CLONE = 56,
     SYSCALL_FORK = 57,
     SYSCALL_EXIT = 60,
     SYSCALL_UNAME = 63,
+    SYSCALL_FSYNC = 74,
+    SYSCALL_FDATASYNC = 75,
     SYSCALL_GETCWD = 79,
     SYSCALL_CHDIR = 80,
     SYSCALL_MKDIR = 83,
@@ -45,21 +53,96 @@ enum syscalls
     SYSCALL_CHOWN = 92,
     SYSCALL_FCHOWN = 93,
     SYSCALL_LCHOWN = 94,
+    SYSCALL_GETTIMEOFDAY = 96,
     SYSCALL_SYSINFO = 99,
     SYSCALL_GETPPID = 110,
+    SYSCALL_ARCH_PRCTL = 158,
+    SYSCALL_SYNC = 162,
     SYSCALL_MOUNT = 165,
     SYSCALL_REBOOT = 169,
+    SYSCALL_GETTID = 186,
     SYSCALL_TIME = 201,
+    SYSCALL_FUTEX = 202,
+    SYSCALL_SCHED_SETAFFINITY = 203,
+    SYSCALL_SCHED_GETAFFINITY = 204,
+    SYSCALL_EPOLL_CREATE = 213,
+    SYSCALL_CLOCK_GETTIME = 228,
+    SYSCALL_EXIT_GROUP = 231,
+    SYSCALL_EPOLL_WAIT = 232,
+    SYSCALL_EPOLL_CTL = 233,
     SYSCALL_OPENAT = 257,
     SYSCALL_MKDIRAT = 258,
     SYSCALL_UNLINKAT = 263,
     SYSCALL_LINKAT = 265,
     SYSCALL_READLINKAT = 267,
-    SYSCALL_FACCESAT = 269
+    SYSCALL_FACCESAT = 269,
+    SYSCALL_SPLICE = 275,
+    SYSCALL_VMSPLICE = 278,
+    SYSCALL_EPOLL_PWAIT = 281,
+    SYSCALL_EPOLL_CREATE1 = 291,
+    SYSCALL_PIPE2 = 293,
+    SYSCALL_PREADV = 295,
+    SYSCALL_PWRITEV = 296,
+    SYSCALL_SYNCFS = 306,
+    SYSCALL_GETCPU = 309,
+    SYSCALL_URING_SETUP = 425,
+    SYSCALL_URING_ENTER = 426,
+    SYSCALL_BATCH = 500
+};
+
+static constexpr size_t MAX_SYSCALLS = 512;
+static constexpr size_t MAX_BATCH = 256;
+
+enum cloneflags
+{
+    CLONE_VM = 0x00000100,
+    CLONE_FS = 0x00000200,
+    CLONE_FILES = 0x00000400,
+    CLONE_SIGHAND = 0x00000800,
+    CLONE_THREAD = 0x00010000,
+    CLONE_SETTLS = 0x00080000,
+    CLONE_PARENT_SETTID = 0x00100000,
+    CLONE_CHILD_CLEARTID = 0x00200000,
+    CLONE_CHILD_SETTID = 0x01000000
+};
+
+enum archprctl
+{
+    ARCH_SET_FS = 0x1002,
+    ARCH_GET_FS = 0x1003
+};
+
+enum batchflags
+{
+    batch_abort = (1 << 0)
+};
+
+struct batch_t
+{
+    uint64_t number;
+    uint64_t args[6];
+    uint32_t flags;
+    uint16_t chain;
+    uint16_t from;
+    int64_t result;
 };
 
 using syscall_t = void (*)(registers_t *);
 
+struct syscall_table_t
+{
+    syscall_t entries[MAX_SYSCALLS];
+
+    constexpr syscall_t &operator[](size_t number)
+    {
+        return this->entries[number];
+    }
+    constexpr syscall_t operator[](size_t number) const
+    {
+        return this->entries[number];
+    }
+};
+
 extern bool initialised;
 
 [[gnu::naked]] static inline syscall_ret syscall_i(size_t number, ...)
@@ -100,9 +183,13 @@ extern bool initialised;
     );
 }
 
-extern "C" syscall_t syscall_table[];
+extern "C" const syscall_table_t syscall_table;
+extern "C" const size_t syscall_count;
+extern "C" void syscall_enosys(registers_t *regs);
 extern "C" void syscall_entry();
 
+void dispatch(registers_t *regs);
+int64_t invoke(size_t number, uint64_t arg0 = 0, uint64_t arg1 = 0, uint64_t arg2 = 0, uint64_t arg3 = 0, uint64_t arg4 = 0, uint64_t arg5 = 0);
 void reboot(std::string message);
 void init();
 }
\ No newline at end of file
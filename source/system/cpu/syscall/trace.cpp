@@ -0,0 +1,298 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <system/sched/scheduler/scheduler.hpp>
+#include <system/cpu/syscall/syscall.hpp>
+#include <system/cpu/syscall/trace.hpp>
+#include <drivers/fs/devfs/devfs.hpp>
+#include <system/cpu/smp/smp.hpp>
+#include <system/boot/timing.hpp>
+#include <kernel/kernel.hpp>
+#include <lib/memory.hpp>
+#include <lib/string.hpp>
+#include <lib/ring.hpp>
+#include <lib/log.hpp>
+
+using namespace kernel::drivers::fs;
+using namespace kernel::system::sched;
+
+namespace kernel::system::cpu::syscall::trace {
+
+extern "C" volatile uint8_t syscall_trace_mode = 0;
+
+bool initialised = false;
+stats_t global;
+volatile uint64_t dropped = 0;
+int filter = 0;
+
+static mpmc_ring<event_t, EVENTS> *events = nullptr;
+
+counter_t *stats_t::get(size_t number)
+{
+    counter_t *counter = __atomic_load_n(&this->counters[number], __ATOMIC_ACQUIRE);
+    if (counter != nullptr) return counter;
+
+    counter_t *fresh = new counter_t { };
+    if (__atomic_compare_exchange_n(&this->counters[number], &counter, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return fresh;
+
+    delete fresh;
+    return counter;
+}
+
+void stats_t::record(size_t number, uint64_t cycles, bool error)
+{
+    counter_t *counter = this->get(number);
+
+    __atomic_add_fetch(&counter->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counter->cycles, cycles, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counter->hist[bucket(cycles)], 1, __ATOMIC_RELAXED);
+    if (error) __atomic_add_fetch(&counter->errors, 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&counter->max, __ATOMIC_RELAXED);
+    while (cycles > max && !__atomic_compare_exchange_n(&counter->max, &max, cycles, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void stats_t::reset()
+{
+    for (counter_t *counter : this->counters)
+    {
+        if (counter != nullptr) memset(counter, 0, sizeof(counter_t));
+    }
+}
+
+stats_t::~stats_t()
+{
+    for (counter_t *counter : this->counters) delete counter;
+}
+
+extern "C" void syscall_traced(registers_t *regs)
+{
+    scheduler::process_t *proc = this_proc();
+    int pid = proc ? proc->pid : 0;
+    if (filter != 0 && pid != filter) return dispatch(regs);
+
+    size_t number = regs->rax;
+    uint64_t args[6] = { regs->rdi, regs->rsi, regs->rdx, regs->r10, regs->r8, regs->r9 };
+
+    uint64_t start = rdtsc();
+    dispatch(regs);
+    uint64_t duration = rdtsc() - start;
+
+    int64_t ret = static_cast<int64_t>(regs->rax) == -1 ? static_cast<int64_t>(regs->rdx) : static_cast<int64_t>(regs->rax);
+    uint8_t mode = syscall_trace_mode;
+
+    if ((mode & trace_counters) && number < MAX_SYSCALLS)
+    {
+        global.record(number, duration, ret < 0);
+        if (proc != nullptr)
+        {
+            stats_t *stats = __atomic_load_n(&proc->trace_stats, __ATOMIC_ACQUIRE);
+            if (stats == nullptr)
+            {
+                stats_t *fresh = new stats_t;
+                if (__atomic_compare_exchange_n(&proc->trace_stats, &stats, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) stats = fresh;
+                else delete fresh;
+            }
+            stats->record(number, duration, ret < 0);
+        }
+    }
+
+    if ((mode & trace_events) && events != nullptr)
+    {
+        event_t event
+        {
+            .tsc = start,
+            .pid = pid,
+            .number = static_cast<uint16_t>(number),
+            .cpu = static_cast<uint16_t>(this_cpu->id),
+            .args = { args[0], args[1], args[2], args[3], args[4], args[5] },
+            .ret = ret,
+            .duration = duration
+        };
+        if (events->push(event) == false) __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void enable(uint8_t mode)
+{
+    __atomic_store_n(&syscall_trace_mode, mode, __ATOMIC_RELEASE);
+}
+
+void disable()
+{
+    __atomic_store_n(&syscall_trace_mode, 0, __ATOMIC_RELEASE);
+}
+
+void reset()
+{
+    global.reset();
+    uint64_t flags = irq_save();
+    scheduler::list_lock.lock();
+    for (scheduler::process_t *proc : scheduler::proc_table)
+    {
+        if (proc->trace_stats != nullptr) proc->trace_stats->reset();
+    }
+    scheduler::list_lock.unlock();
+    irq_restore(flags);
+
+    event_t event;
+    if (events != nullptr) while (events->pop(event));
+    dropped = 0;
+}
+
+static size_t dump(char *buffer, size_t size, size_t len, int pid, stats_t &stats)
+{
+    for (size_t i = 0; i < MAX_SYSCALLS; i++)
+    {
+        counter_t *counter = stats.counters[i];
+        if (counter == nullptr || counter->count == 0) continue;
+
+        len += snprintf(buffer + MIN(len, size), size - MIN(len, size), "%5d %4zu %10lu %8lu %10lu %12lu |",
+            pid, i, counter->count, counter->errors, counter->cycles / counter->count, counter->max);
+        for (size_t b = 0; b < BUCKETS; b++)
+        {
+            if (counter->hist[b] == 0) continue;
+            len += snprintf(buffer + MIN(len, size), size - MIN(len, size), " %zu:%u", b, counter->hist[b]);
+        }
+        len += snprintf(buffer + MIN(len, size), size - MIN(len, size), "\n");
+    }
+    return len;
+}
+
+size_t report(char *buffer, size_t size, int pid)
+{
+    uint8_t mode = syscall_trace_mode;
+    size_t len = snprintf(buffer, size, "counters: %s, events: %s, filter: %d, dropped: %lu, tsc: %lu Hz\n%5s %4s %10s %8s %10s %12s | log2(cycles):calls\n",
+        (mode & trace_counters) ? "on" : "off", (mode & trace_events) ? "on" : "off", filter, dropped, boot::tsc_hz,
+        "pid", "nr", "count", "errors", "avg", "max");
+
+    if (pid >= 0)
+    {
+        scheduler::process_t *proc = scheduler::find_proc(pid);
+        if (proc != nullptr && proc->trace_stats != nullptr) len = dump(buffer, size, len, proc->pid, *proc->trace_stats);
+        return len;
+    }
+
+    len = dump(buffer, size, len, 0, global);
+    uint64_t flags = irq_save();
+    scheduler::list_lock.lock();
+    for (scheduler::process_t *proc : scheduler::proc_table)
+    {
+        if (proc->trace_stats != nullptr) len = dump(buffer, size, len, proc->pid, *proc->trace_stats);
+    }
+    scheduler::list_lock.unlock();
+    irq_restore(flags);
+    return len;
+}
+
+bool next_event(event_t &event)
+{
+    if (events == nullptr) return false;
+    return events->pop(event);
+}
+
+struct stats_res : vfs::resource_t
+{
+    int64_t read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
+    {
+        size_t len = report(nullptr, 0);
+        if (offset >= len) return 0;
+
+        char *text = new char[len + 1];
+        len = MIN(report(text, len + 1), len);
+        if (offset + size > len) size = len - offset;
+
+        memcpy(buffer, text + offset, size);
+        delete[] text;
+        return size;
+    }
+
+    int64_t write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
+    {
+        char command[32] = { 0 };
+        memcpy(command, buffer, MIN(size, sizeof(command) - 1));
+
+        if (!strncmp(command, "off", 3)) disable();
+        else if (!strncmp(command, "on", 2)) enable(trace_counters);
+        else if (!strncmp(command, "events", 6)) enable(trace_counters | trace_events);
+        else if (!strncmp(command, "reset", 5)) reset();
+        else if (!strncmp(command, "pid ", 4)) filter = atoi(command + 4);
+        else
+        {
+            errno_set(EINVAL);
+            return -1;
+        }
+        return size;
+    }
+
+    void unref(void *handle)
+    {
+        this->refcount--;
+    }
+
+    void link(void *handle)
+    {
+        this->stat.nlink++;
+    }
+
+    void unlink(void *handle)
+    {
+        this->stat.nlink--;
+    }
+};
+
+struct events_res : vfs::resource_t
+{
+    int64_t read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
+    {
+        event_t *out = reinterpret_cast<event_t*>(buffer);
+        size_t count = 0;
+        while (count < size / sizeof(event_t) && next_event(out[count])) count++;
+        return count * sizeof(event_t);
+    }
+
+    void unref(void *handle)
+    {
+        this->refcount--;
+    }
+
+    void link(void *handle)
+    {
+        this->stat.nlink++;
+    }
+
+    void unlink(void *handle)
+    {
+        this->stat.nlink--;
+    }
+};
+
+void init()
+{
+    log("Initialising syscall tracer");
+
+    if (initialised)
+    {
+        warn("Syscall tracer has already been initialised!\n");
+        return;
+    }
+
+    events = new mpmc_ring<event_t, EVENTS>;
+
+    stats_res *stats = new stats_res;
+    stats->stat.blksize = 512;
+    stats->stat.rdev = vfs::dev_new_id();
+    stats->stat.mode = 0644 | vfs::ifchr;
+    devfs::add(stats, "systrace");
+
+    events_res *stream = new events_res;
+    stream->stat.blksize = sizeof(event_t);
+    stream->stat.rdev = vfs::dev_new_id();
+    stream->stat.mode = 0444 | vfs::ifchr;
+    devfs::add(stream, "systrace_events");
+
+    if (strstr(cmdline, "systrace")) enable(trace_counters | trace_events);
+
+    serial::newline();
+    initialised = true;
+}
+}
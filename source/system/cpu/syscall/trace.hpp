@@ -0,0 +1,74 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <lib/cpu.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace kernel::system::cpu::syscall::trace {
+
+static constexpr size_t MAX_SYSCALLS = 512;
+static constexpr size_t BUCKETS = 40;
+static constexpr size_t EVENTS = 4096;
+
+enum modes
+{
+    trace_counters = (1 << 0),
+    trace_events = (1 << 1)
+};
+
+struct counter_t
+{
+    uint64_t count;
+    uint64_t errors;
+    uint64_t cycles;
+    uint64_t max;
+    uint32_t hist[BUCKETS];
+};
+
+struct stats_t
+{
+    counter_t *counters[MAX_SYSCALLS] = { };
+
+    counter_t *get(size_t number);
+    void record(size_t number, uint64_t cycles, bool error);
+    void reset();
+
+    ~stats_t();
+};
+
+struct event_t
+{
+    uint64_t tsc;
+    int32_t pid;
+    uint16_t number;
+    uint16_t cpu;
+    uint64_t args[6];
+    int64_t ret;
+    uint64_t duration;
+};
+
+extern "C" volatile uint8_t syscall_trace_mode;
+extern "C" void syscall_traced(registers_t *regs);
+
+extern bool initialised;
+extern stats_t global;
+extern volatile uint64_t dropped;
+extern int filter;
+
+static inline size_t bucket(uint64_t cycles)
+{
+    size_t ret = 63 - __builtin_clzll(cycles | 1);
+    return ret < BUCKETS ? ret : BUCKETS - 1;
+}
+
+void enable(uint8_t mode);
+void disable();
+void reset();
+
+size_t report(char *buffer, size_t size, int pid = -1);
+bool next_event(event_t &event);
+
+void init();
+}
@@ -0,0 +1,365 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <system/epoll/epoll.hpp>
+#include <system/vdso/vdso.hpp>
+#include <kernel/kernel.hpp>
+
+namespace kernel::system::epoll {
+
+static constexpr uint32_t private_bits = epollexclusive | epollwakeup | epolloneshot | epollet;
+
+static uint64_t epoll_dev = 0;
+new_lock(epoll_lock);
+
+// Called under watch_lock with interrupts disabled
+static void wake_item(vfs::watch_t *watch, int events)
+{
+    item_t *item = reinterpret_cast<item_t*>(watch);
+    epoll_res *epoll = item->epoll;
+
+    epoll->ready_lock.lock();
+    if ((events & item->events & ~private_bits) == 0)
+    {
+        epoll->ready_lock.unlock();
+        return;
+    }
+    epoll->enqueue(item);
+    epoll->ready_lock.unlock();
+
+    epoll->signal();
+}
+
+static void release_item(vfs::watch_t *watch)
+{
+    item_t *item = reinterpret_cast<item_t*>(watch);
+
+    lockit(epoll_lock);
+    epoll_res *epoll = item->epoll;
+    if (epoll == nullptr)
+    {
+        delete item;
+        return;
+    }
+
+    lockit(epoll->ep_lock);
+    uint64_t flags = irq_save();
+    epoll->ready_lock.lock();
+    epoll->dequeue(item);
+    epoll->ready_lock.unlock();
+    irq_restore(flags);
+
+    epoll->items.remove(item);
+    delete item;
+}
+
+item_t *epoll_res::find(int fd, void *handle)
+{
+    for (item_t *item : this->items)
+    {
+        if (item->fd == fd && item->watch.handle == handle) return item;
+    }
+    return nullptr;
+}
+
+void epoll_res::enqueue(item_t *item)
+{
+    if (item->ready) return;
+
+    item->ready_next = nullptr;
+    item->ready_prev = this->ready_tail;
+    if (this->ready_tail) this->ready_tail->ready_next = item;
+    else this->ready_head = item;
+    this->ready_tail = item;
+    item->ready = true;
+}
+
+void epoll_res::dequeue(item_t *item)
+{
+    if (item->ready == false) return;
+
+    if (item->ready_prev) item->ready_prev->ready_next = item->ready_next;
+    else this->ready_head = item->ready_next;
+    if (item->ready_next) item->ready_next->ready_prev = item->ready_prev;
+    else this->ready_tail = item->ready_prev;
+    item->ready = false;
+}
+
+void epoll_res::signal()
+{
+    if (this->waiters.head != nullptr) this->waiters.wake();
+    this->notify(vfs::pollin | vfs::pollrdnorm);
+}
+
+void epoll_res::arm(item_t *item)
+{
+    if ((item->res->poll(item->watch.handle) & item->events & ~private_bits) == 0) return;
+
+    uint64_t flags = irq_save();
+    this->ready_lock.lock();
+    this->enqueue(item);
+    this->ready_lock.unlock();
+    irq_restore(flags);
+
+    this->signal();
+}
+
+int epoll_res::add(int fd, vfs::handle_t *handle, event_t *event)
+{
+    if (this->find(fd, handle) != nullptr)
+    {
+        errno_set(EEXIST);
+        return -1;
+    }
+
+    item_t *item = new item_t;
+    item->watch.callback = wake_item;
+    item->watch.release = release_item;
+    item->watch.handle = handle;
+    item->epoll = this;
+    item->res = handle->res;
+    item->fd = fd;
+    item->events = event->events | vfs::pollerr | vfs::pollhup;
+    item->data = event->data;
+    item->ready = false;
+
+    this->items.push_back(item);
+    item->res->watch(&item->watch);
+
+    this->arm(item);
+    return 0;
+}
+
+int epoll_res::mod(int fd, vfs::handle_t *handle, event_t *event)
+{
+    item_t *item = this->find(fd, handle);
+    if (item == nullptr)
+    {
+        errno_set(ENOENT);
+        return -1;
+    }
+
+    uint64_t flags = irq_save();
+    this->ready_lock.lock();
+    item->events = event->events | vfs::pollerr | vfs::pollhup;
+    item->data = event->data;
+    this->dequeue(item);
+    this->ready_lock.unlock();
+    irq_restore(flags);
+
+    this->arm(item);
+    return 0;
+}
+
+int epoll_res::del(int fd, vfs::handle_t *handle)
+{
+    item_t *item = this->find(fd, handle);
+    if (item == nullptr)
+    {
+        errno_set(ENOENT);
+        return -1;
+    }
+
+    if (item->res->unwatch(&item->watch) == false) return 0;
+
+    uint64_t flags = irq_save();
+    this->ready_lock.lock();
+    this->dequeue(item);
+    this->ready_lock.unlock();
+    irq_restore(flags);
+
+    this->items.remove(item);
+    delete item;
+    return 0;
+}
+
+size_t epoll_res::collect(event_t *events, size_t max)
+{
+    item_t *requeue_head = nullptr;
+    item_t *requeue_tail = nullptr;
+    size_t count = 0;
+
+    uint64_t flags = irq_save();
+    this->ready_lock.lock();
+    while (count < max && this->ready_head != nullptr)
+    {
+        item_t *item = this->ready_head;
+        this->dequeue(item);
+        uint32_t mask = item->events;
+        this->ready_lock.unlock();
+        irq_restore(flags);
+
+        uint32_t revents = item->res->poll(item->watch.handle) & mask & ~private_bits;
+        if (revents != 0) events[count++] = event_t { revents, item->data };
+
+        flags = irq_save();
+        this->ready_lock.lock();
+        if (revents == 0) continue;
+
+        if (mask & epolloneshot) item->events &= private_bits;
+        else if ((mask & epollet) == 0 && item->ready == false)
+        {
+            item->ready_next = nullptr;
+            item->ready_prev = requeue_tail;
+            if (requeue_tail) requeue_tail->ready_next = item;
+            else requeue_head = item;
+            requeue_tail = item;
+            item->ready = true;
+        }
+    }
+
+    if (requeue_head != nullptr)
+    {
+        requeue_head->ready_prev = this->ready_tail;
+        if (this->ready_tail) this->ready_tail->ready_next = requeue_head;
+        else this->ready_head = requeue_head;
+        this->ready_tail = requeue_tail;
+    }
+    this->ready_lock.unlock();
+    irq_restore(flags);
+
+    return count;
+}
+
+int epoll_res::wait(event_t *events, size_t max, uint64_t deadline)
+{
+    scheduler::thread_t *thread = this_thread();
+    size_t count = 0;
+
+    if (deadline) scheduler::add_timeout(thread, deadline);
+    while (true)
+    {
+        this->ep_lock.lock();
+        count = this->collect(events, max);
+        this->ep_lock.unlock();
+
+        if (count > 0 || (deadline && vdso::monotonic() >= deadline)) break;
+
+        this->waiters.add(thread);
+        if (this->ready_head == nullptr && (deadline == 0 || vdso::monotonic() < deadline)) thread->block();
+        this->waiters.remove(thread);
+    }
+    if (deadline) scheduler::remove_timeout(thread);
+
+    return count;
+}
+
+int epoll_res::poll(void *handle)
+{
+    return this->ready_head ? vfs::pollin | vfs::pollrdnorm : 0;
+}
+
+void epoll_res::unref(void *handle)
+{
+    this->refcount--;
+    if (this->refcount > 0) return;
+
+    epoll_lock.lock();
+    this->ep_lock.lock();
+    for (item_t *item : this->items)
+    {
+        if (item->res->unwatch(&item->watch)) delete item;
+        else item->epoll = nullptr;
+    }
+    this->ep_lock.unlock();
+    epoll_lock.unlock();
+
+    delete this;
+}
+
+epoll_res *res2epoll(vfs::resource_t *res)
+{
+    if (epoll_dev == 0 || res == nullptr || res->stat.dev != epoll_dev) return nullptr;
+    return static_cast<epoll_res*>(res);
+}
+
+int create(int flags)
+{
+    if (flags & ~vfs::o_cloexec)
+    {
+        errno_set(EINVAL);
+        return -1;
+    }
+
+    if (epoll_dev == 0) epoll_dev = vfs::dev_new_id();
+
+    epoll_res *epoll = new epoll_res;
+    epoll->refcount = 0;
+    epoll->can_mmap = false;
+    epoll->stat.dev = epoll_dev;
+    epoll->stat.mode = 0600;
+    epoll->stat.nlink = 1;
+
+    int fdnum = vfs::fdnum_from_res(nullptr, epoll, vfs::o_rdwr | flags, 0, false);
+    if (fdnum == -1)
+    {
+        delete epoll;
+        errno_set(EMFILE);
+        return -1;
+    }
+    return fdnum;
+}
+
+int ctl(vfs::fd_t *epfd, int op, int fd, event_t *event)
+{
+    epoll_res *epoll = res2epoll(epfd->handle->res);
+    if (epoll == nullptr || (op != ctl_del && event == nullptr))
+    {
+        errno_set(EINVAL);
+        return -1;
+    }
+
+    vfs::fd_t *target = vfs::fd_from_fdnum(nullptr, fd);
+    if (target == nullptr) return -1;
+
+    if (target->handle->res == epoll)
+    {
+        target->unref();
+        errno_set(EINVAL);
+        return -1;
+    }
+
+    int ret = -1;
+    {
+        lockit(epoll_lock);
+        lockit(epoll->ep_lock);
+        switch (op)
+        {
+            case ctl_add:
+                ret = epoll->add(fd, target->handle, event);
+                break;
+            case ctl_mod:
+                ret = epoll->mod(fd, target->handle, event);
+                break;
+            case ctl_del:
+                ret = epoll->del(fd, target->handle);
+                break;
+            default:
+                errno_set(EINVAL);
+                break;
+        }
+    }
+
+    target->unref();
+    return ret;
+}
+
+int wait(vfs::fd_t *epfd, event_t *events, int max, int64_t timeout)
+{
+    epoll_res *epoll = res2epoll(epfd->handle->res);
+    if (epoll == nullptr || max <= 0 || static_cast<size_t>(max) > MAX_EVENTS)
+    {
+        errno_set(EINVAL);
+        return -1;
+    }
+
+    if (timeout == 0)
+    {
+        lockit(epoll->ep_lock);
+        return epoll->collect(events, max);
+    }
+
+    uint64_t deadline = 0;
+    if (timeout > 0) deadline = vdso::monotonic() + timeout * 1000000;
+    return epoll->wait(events, max, deadline);
+}
+}
@@ -0,0 +1,102 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <system/sched/scheduler/scheduler.hpp>
+#include <system/vfs/vfs.hpp>
+#include <lib/vector.hpp>
+#include <lib/lock.hpp>
+#include <cstdint>
+
+using namespace kernel::system::sched;
+
+namespace kernel::system::epoll {
+
+static constexpr size_t MAX_EVENTS = 1024;
+
+enum ctlops
+{
+    ctl_add = 1,
+    ctl_del = 2,
+    ctl_mod = 3
+};
+
+enum epollflags
+{
+    epollexclusive = (1U << 28),
+    epollwakeup = (1U << 29),
+    epolloneshot = (1U << 30),
+    epollet = (1U << 31)
+};
+
+struct [[gnu::packed]] event_t
+{
+    uint32_t events;
+    uint64_t data;
+};
+
+struct epoll_res;
+struct item_t
+{
+    vfs::watch_t watch;
+    epoll_res *epoll;
+    vfs::resource_t *res;
+    int fd;
+    uint32_t events;
+    uint64_t data;
+
+    item_t *ready_next;
+    item_t *ready_prev;
+    bool ready;
+};
+
+struct epoll_res : vfs::resource_t
+{
+    lock_t ep_lock;
+    lock_t ready_lock;
+    vector<item_t*> items;
+
+    item_t *ready_head = nullptr;
+    item_t *ready_tail = nullptr;
+
+    scheduler::waitqueue_t waiters;
+
+    item_t *find(int fd, void *handle);
+
+    void enqueue(item_t *item);
+    void dequeue(item_t *item);
+    void signal();
+    void arm(item_t *item);
+
+    int add(int fd, vfs::handle_t *handle, event_t *event);
+    int mod(int fd, vfs::handle_t *handle, event_t *event);
+    int del(int fd, vfs::handle_t *handle);
+
+    size_t collect(event_t *events, size_t max);
+    int wait(event_t *events, size_t max, uint64_t deadline);
+
+    int poll(void *handle);
+    void unref(void *handle);
+
+    void link(void *handle)
+    {
+        this->stat.nlink++;
+    }
+
+    void unlink(void *handle)
+    {
+        this->stat.nlink--;
+    }
+
+    void *mmap(uint64_t page, int flags)
+    {
+        return nullptr;
+    }
+};
+
+epoll_res *res2epoll(vfs::resource_t *res);
+
+int create(int flags);
+int ctl(vfs::fd_t *epfd, int op, int fd, event_t *event);
+int wait(vfs::fd_t *epfd, event_t *events, int max, int64_t timeout);
+}
@@ -1,5 +1,6 @@
 // Copyright (C) 2021-2022  ilobilo
 
+#include <system/boot/timing.hpp>
 #include <system/mm/pmm/pmm.hpp>
 #include <kernel/kernel.hpp>
 #include <lib/memory.hpp>
@@ -59,6 +60,26 @@ void *alloc(size_t count)
     return ret;
 }
 
+// For devices that can't address all of memory. Returns nullptr instead of panicking
+void *alloc_below(size_t count, uint64_t limit)
+{
+    if (limit == 0 || limit >= highest_addr) return alloc(count);
+    lockit(pmm_lock);
+
+    size_t i = lastI;
+    lastI = 0;
+    void *ret = inner_alloc(count, limit / 0x1000);
+    lastI = i;
+    if (ret == nullptr) return nullptr;
+
+    memset(reinterpret_cast<void*>(reinterpret_cast<uint64_t>(ret) + hhdm_offset), 0, count * 0x1000);
+
+    usedRam += count * 0x1000;
+    freeRam -= count * 0x1000;
+
+    return ret;
+}
+
 void free(void *ptr, size_t count)
 {
     if (ptr == nullptr) return;
@@ -113,6 +134,7 @@ void init()
     limine_memmap_entry **memmaps = memmap_request.response->entries;
     uint64_t memmap_count = memmap_request.response->entry_count;
 
+    size_t event = boot::event_begin("PMM memory map scan");
     for (size_t i = 0; i < memmap_count; i++)
     {
         if (memmaps[i]->type != LIMINE_MEMMAP_USABLE) continue;
@@ -140,7 +162,9 @@ void init()
             break;
         }
     }
+    boot::event_end(event);
 
+    event = boot::event_begin("PMM bitmap setup");
     for (size_t i = 0; i < memmap_count; i++)
     {
         if (memmaps[i]->type != LIMINE_MEMMAP_USABLE) continue;
@@ -150,6 +174,7 @@ void init()
             bitmap.Set((memmaps[i]->base + t) / 0x1000, false);
         }
     }
+    boot::event_end(event);
 
     serial::newline();
     initialised = true;
@@ -19,6 +19,14 @@ type alloc(size_t count = 1)
     return reinterpret_cast<type>(alloc(count));
 }
 
+void *alloc_below(size_t count, uint64_t limit);
+
+template<typename type = void*>
+type alloc_below(size_t count, uint64_t limit)
+{
+    return reinterpret_cast<type>(alloc_below(count, limit));
+}
+
 void *realloc(void *ptr, size_t oldcount = 1, size_t newcount = 1);
 void free(void *ptr, size_t count = 1);
 
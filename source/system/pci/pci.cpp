@@ -1,6 +1,8 @@
 // Copyright (C) 2021-2022  ilobilo
 
 #include <drivers/display/terminal/terminal.hpp>
+#include <system/sched/scheduler/scheduler.hpp>
+#include <system/cpu/smp/smp.hpp>
 #include <system/cpu/apic/apic.hpp>
 #include <system/cpu/idt/idt.hpp>
 #include <system/pci/pcidesc.hpp>
@@ -15,6 +17,7 @@ namespace kernel::system::pci {
 
 bool initialised = false;
 bool legacy = false;
+lock_t legacy_lock;
 
 vector<pcidevice_t*> devices;
 
@@ -42,23 +45,55 @@ pcibar pcidevice_t::get_bar(size_t bar)
     return { address, mmio, prefetchable };
 }
 
-void pcidevice_t::msi_set(uint8_t vector)
+static uint32_t irq_lapic()
+{
+    return smp::initialised ? sched::scheduler::irq_target() : smp_request.response->bsp_lapic_id;
+}
+
+void pcidevice_t::msi_set(uint8_t vector, uint32_t lapic_id)
 {
     if (!this->msi_support) return;
     uint16_t msg_ctrl = this->readw(this->msi_offset + 2);
-    this->writel(this->msi_offset + 0x04, (0x0FEE << 20) | (smp_request.response->bsp_lapic_id << 12));
+    this->writel(this->msi_offset + 0x04, (0x0FEE << 20) | (lapic_id << 12));
     this->writel(this->msi_offset + (((msg_ctrl << 7) & 1) == 1 ? 0x0C : 0x08), vector);
     this->writew(this->msi_offset + 2, (msg_ctrl | 1) & ~(0b111 << 4));
 }
 
+uint16_t pcidevice_t::msix_count()
+{
+    if (!this->msix_support) return 0;
+    return (this->readw(this->msix_offset + 2) & 0x7FF) + 1;
+}
+
+void pcidevice_t::msix_set(uint16_t entry, uint8_t vector, uint32_t lapic_id)
+{
+    if (!this->msix_support || entry >= this->msix_count()) return;
+    uint16_t msg_ctrl = this->readw(this->msix_offset + 2);
+    uint32_t table = this->readl(this->msix_offset + 4);
+
+    uint64_t address = this->get_bar(table & 0b111).address + (table & ~0b111) + entry * 16;
+    mmoutl(reinterpret_cast<void*>(address), (0x0FEE << 20) | (lapic_id << 12));
+    mmoutl(reinterpret_cast<void*>(address + 0x04), 0);
+    mmoutl(reinterpret_cast<void*>(address + 0x08), vector);
+    mmoutl(reinterpret_cast<void*>(address + 0x0C), mminl(reinterpret_cast<void*>(address + 0x0C)) & ~1);
+
+    this->writew(this->msix_offset + 2, (msg_ctrl | (1 << 15)) & ~(1 << 14));
+}
+
 uint8_t pcidevice_t::irq_set(idt::int_handler_func handler)
 {
     if (this->int_on) return 0;
     uint8_t irq = 0;
-    if (this->msi_support)
+    if (this->msix_support)
+    {
+        irq = idt::alloc_vector();
+        this->msix_set(0, irq, irq_lapic());
+        idt::register_interrupt_handler(irq, handler, false);
+    }
+    else if (this->msi_support)
     {
         irq = idt::alloc_vector();
-        this->msi_set(irq);
+        this->msi_set(irq, irq_lapic());
         idt::register_interrupt_handler(irq, handler, false);
     }
     else
@@ -84,10 +119,16 @@ uint8_t pcidevice_t::irq_set(idt::int_handler_func_arg handler, uint64_t args)
 {
     if (this->int_on) return 0;
     uint8_t irq = 0;
-    if (this->msi_support)
+    if (this->msix_support)
     {
         irq = idt::alloc_vector();
-        this->msi_set(irq);
+        this->msix_set(0, irq, irq_lapic());
+        idt::register_interrupt_handler(irq, handler, args, false);
+    }
+    else if (this->msi_support)
+    {
+        irq = idt::alloc_vector();
+        this->msi_set(irq, irq_lapic());
         idt::register_interrupt_handler(irq, handler, args, false);
     }
     else
@@ -217,6 +258,10 @@ static void msi_check(pcidevice_t *device)
                     device->msi_support = true;
                     device->msi_offset = offset;
                     break;
+                case 0x11:
+                    device->msix_support = true;
+                    device->msix_offset = offset;
+                    break;
             }
             offset = device->readb(offset + 1);
         }
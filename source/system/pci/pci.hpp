@@ -7,6 +7,7 @@
 #include <lib/vector.hpp>
 #include <lib/string.hpp>
 #include <lib/mmio.hpp>
+#include <lib/lock.hpp>
 #include <lib/io.hpp>
 #include <cstdint>
 
@@ -75,6 +76,7 @@ struct pciheader_t
 };
 
 extern bool legacy;
+extern lock_t legacy_lock;
 static inline void *get_addr(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint32_t offset)
 {
     if (legacy)
@@ -103,6 +105,7 @@ static inline uint8_t readb(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func
 {
     if (legacy)
     {
+        lockit(legacy_lock);
         get_addr(seg, bus, dev, func, offset);
         return inb(0xCFC + (offset & 3));
     }
@@ -112,6 +115,7 @@ static inline uint16_t readw(uint16_t seg, int8_t bus, uint8_t dev, uint8_t func
 {
     if (legacy)
     {
+        lockit(legacy_lock);
         get_addr(seg, bus, dev, func, offset);
         return inw(0xCFC + (offset & 3));
     }
@@ -121,6 +125,7 @@ static inline uint32_t readl(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t fun
 {
     if (legacy)
     {
+        lockit(legacy_lock);
         get_addr(seg, bus, dev, func, offset);
         return inl(0xCFC + (offset & 3));
     }
@@ -131,6 +136,7 @@ static inline void writeb(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func,
 {
     if (legacy)
     {
+        lockit(legacy_lock);
         get_addr(seg, bus, dev, func, offset);
         outb(0xCFC + (offset & 3), value);
     }
@@ -140,6 +146,7 @@ static inline void writew(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func,
 {
     if (legacy)
     {
+        lockit(legacy_lock);
         get_addr(seg, bus, dev, func, offset);
         outw(0xCFC + (offset & 3), value);
     }
@@ -149,6 +156,7 @@ static inline void writel(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func,
 {
     if (legacy)
     {
+        lockit(legacy_lock);
         get_addr(seg, bus, dev, func, offset);
         outl(0xCFC + (offset & 3), value);
     }
@@ -174,6 +182,9 @@ struct pcidevice_t
     bool msi_support;
     uint16_t msi_offset;
 
+    bool msix_support;
+    uint16_t msix_offset;
+
     void *get_addr(uint32_t offset)
     {
         return kernel::system::pci::get_addr(this->seg, this->bus, this->dev, this->func, offset);
@@ -223,7 +234,9 @@ struct pcidevice_t
     }
 
     pcibar get_bar(size_t bar);
-    void msi_set(uint8_t vector);
+    void msi_set(uint8_t vector, uint32_t lapic_id);
+    uint16_t msix_count();
+    void msix_set(uint16_t entry, uint8_t vector, uint32_t lapic_id);
     uint8_t irq_set(cpu::idt::int_handler_func handler);
     uint8_t irq_set(cpu::idt::int_handler_func_arg handler, uint64_t args);
 };
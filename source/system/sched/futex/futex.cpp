@@ -0,0 +1,212 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <system/sched/futex/futex.hpp>
+#include <system/vdso/vdso.hpp>
+#include <kernel/kernel.hpp>
+
+namespace kernel::system::sched::futex {
+
+static bucket_t buckets[BUCKETS];
+
+static uint64_t key_of(uint32_t *uaddr)
+{
+    uint64_t vaddr = reinterpret_cast<uint64_t>(uaddr);
+    if (vaddr == 0 || (vaddr & 3))
+    {
+        errno_set(EINVAL);
+        return 0;
+    }
+
+    scheduler::process_t *proc = this_proc();
+    if (proc == nullptr || vaddr >= hhdm_offset) return vaddr;
+
+    __atomic_load_n(uaddr, __ATOMIC_RELAXED);
+    uint64_t page = proc->pagemap->virt2phys(vaddr & ~0xFFFUL);
+    if (page == 0)
+    {
+        errno_set(EFAULT);
+        return 0;
+    }
+    return page | (vaddr & 0xFFF);
+}
+
+static bucket_t *bucket_of(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    return &buckets[key % BUCKETS];
+}
+
+void bucket_t::add(waiter_t *waiter)
+{
+    __atomic_store_n(&waiter->bucket, this, __ATOMIC_RELEASE);
+    waiter->next = this->head;
+    this->head = waiter;
+}
+
+void bucket_t::remove(waiter_t *waiter)
+{
+    for (waiter_t **curr = &this->head; *curr != nullptr; curr = &(*curr)->next)
+    {
+        if (*curr == waiter)
+        {
+            *curr = waiter->next;
+            waiter->next = nullptr;
+            return;
+        }
+    }
+}
+
+static void wake_one(waiter_t *waiter)
+{
+    scheduler::thread_t *thread = waiter->thread;
+    __atomic_store_n(&waiter->woken, true, __ATOMIC_RELEASE);
+    thread->unblock();
+}
+
+int wait(uint32_t *uaddr, uint32_t val, uint64_t deadline, uint32_t bitset)
+{
+    if (bitset == 0)
+    {
+        errno_set(EINVAL);
+        return -1;
+    }
+
+    uint64_t key = key_of(uaddr);
+    if (key == 0) return -1;
+
+    scheduler::thread_t *thread = this_thread();
+    waiter_t waiter { key, bitset, thread, nullptr, nullptr, false };
+
+    bucket_t *bucket = bucket_of(key);
+    bucket->lock.lock();
+    if (__atomic_load_n(uaddr, __ATOMIC_SEQ_CST) != val)
+    {
+        bucket->lock.unlock();
+        errno_set(EAGAIN);
+        return -1;
+    }
+    bucket->add(&waiter);
+    bucket->lock.unlock();
+
+    if (deadline) scheduler::add_timeout(thread, deadline);
+    while (__atomic_load_n(&waiter.woken, __ATOMIC_ACQUIRE) == false)
+    {
+        if (deadline && vdso::monotonic() >= deadline) break;
+        thread->block();
+    }
+    if (deadline) scheduler::remove_timeout(thread);
+
+    if (__atomic_load_n(&waiter.woken, __ATOMIC_ACQUIRE)) return 0;
+
+    while (true)
+    {
+        bucket = __atomic_load_n(&waiter.bucket, __ATOMIC_ACQUIRE);
+        bucket->lock.lock();
+        if (waiter.bucket == bucket) break;
+        bucket->lock.unlock();
+    }
+    bool woken = waiter.woken;
+    if (woken == false) bucket->remove(&waiter);
+    bucket->lock.unlock();
+
+    if (woken) return 0;
+    errno_set(ETIMEDOUT);
+    return -1;
+}
+
+int wake(uint32_t *uaddr, size_t count, uint32_t bitset)
+{
+    if (bitset == 0)
+    {
+        errno_set(EINVAL);
+        return -1;
+    }
+
+    uint64_t key = key_of(uaddr);
+    if (key == 0) return -1;
+
+    bucket_t *bucket = bucket_of(key);
+    lockit(bucket->lock);
+
+    int woken = 0;
+    waiter_t **curr = &bucket->head;
+    while (*curr != nullptr && static_cast<size_t>(woken) < count)
+    {
+        waiter_t *waiter = *curr;
+        if (waiter->key != key || !(waiter->bitset & bitset))
+        {
+            curr = &waiter->next;
+            continue;
+        }
+
+        *curr = waiter->next;
+        wake_one(waiter);
+        woken++;
+    }
+    return woken;
+}
+
+int requeue(uint32_t *uaddr, size_t nr_wake, uint32_t *uaddr2, size_t nr_requeue, uint32_t *cmpval)
+{
+    uint64_t key = key_of(uaddr);
+    if (key == 0) return -1;
+    uint64_t key2 = key_of(uaddr2);
+    if (key2 == 0) return -1;
+
+    bucket_t *from = bucket_of(key);
+    bucket_t *to = bucket_of(key2);
+
+    bucket_t *first = from < to ? from : to;
+    bucket_t *second = from < to ? to : from;
+    first->lock.lock();
+    if (second != first) second->lock.lock();
+
+    int ret = 0;
+    if (cmpval != nullptr && __atomic_load_n(uaddr, __ATOMIC_SEQ_CST) != *cmpval)
+    {
+        errno_set(EAGAIN);
+        ret = -1;
+        goto end;
+    }
+
+    {
+        size_t woken = 0;
+        size_t moved = 0;
+        waiter_t **curr = &from->head;
+        while (*curr != nullptr && (woken < nr_wake || moved < nr_requeue))
+        {
+            waiter_t *waiter = *curr;
+            if (waiter->key != key)
+            {
+                curr = &waiter->next;
+                continue;
+            }
+
+            if (woken < nr_wake)
+            {
+                *curr = waiter->next;
+                wake_one(waiter);
+                woken++;
+                continue;
+            }
+
+            waiter->key = key2;
+            if (from != to)
+            {
+                *curr = waiter->next;
+                to->add(waiter);
+            }
+            else curr = &waiter->next;
+            moved++;
+        }
+        ret = woken + moved;
+    }
+
+    end:
+    if (second != first) second->lock.unlock();
+    first->lock.unlock();
+    return ret;
+}
+}
@@ -0,0 +1,54 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <system/sched/scheduler/scheduler.hpp>
+#include <lib/lock.hpp>
+#include <cstdint>
+
+namespace kernel::system::sched::futex {
+
+static constexpr size_t BUCKETS = 256;
+static constexpr uint32_t BITSET_ANY = 0xFFFFFFFF;
+
+enum ops
+{
+    FUTEX_WAIT = 0,
+    FUTEX_WAKE = 1,
+    FUTEX_REQUEUE = 3,
+    FUTEX_CMP_REQUEUE = 4,
+    FUTEX_WAIT_BITSET = 9,
+    FUTEX_WAKE_BITSET = 10
+};
+
+enum opflags
+{
+    FUTEX_PRIVATE_FLAG = 128,
+    FUTEX_CLOCK_REALTIME = 256,
+    FUTEX_CMD_MASK = ~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME)
+};
+
+struct bucket_t;
+struct waiter_t
+{
+    uint64_t key;
+    uint32_t bitset;
+    scheduler::thread_t *thread;
+    bucket_t *bucket;
+    waiter_t *next;
+    volatile bool woken;
+};
+
+struct bucket_t
+{
+    lock_t lock;
+    waiter_t *head = nullptr;
+
+    void add(waiter_t *waiter);
+    void remove(waiter_t *waiter);
+};
+
+int wait(uint32_t *uaddr, uint32_t val, uint64_t deadline, uint32_t bitset = BITSET_ANY);
+int wake(uint32_t *uaddr, size_t count, uint32_t bitset = BITSET_ANY);
+int requeue(uint32_t *uaddr, size_t nr_wake, uint32_t *uaddr2, size_t nr_requeue, uint32_t *cmpval);
+}
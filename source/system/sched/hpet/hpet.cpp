@@ -17,6 +17,12 @@ uint64_t counter()
     return mminq(&hpet->main_counter_value);
 }
 
+uint64_t nanos()
+{
+    uint64_t ticks = counter();
+    return ticks / 1000000 * clk + (ticks % 1000000) * clk / 1000000;
+}
+
 void usleep(uint64_t us)
 {
     uint64_t target = counter() + (us * 1000000000) / clk;
@@ -23,6 +23,7 @@ extern bool initialised;
 extern HPET *hpet;
 
 uint64_t counter();
+uint64_t nanos();
 
 void usleep(uint64_t us);
 void msleep(uint64_t msec);
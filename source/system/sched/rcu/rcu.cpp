@@ -0,0 +1,67 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <system/sched/scheduler/scheduler.hpp>
+#include <system/sched/rcu/rcu.hpp>
+#include <lib/cpumask.hpp>
+#include <lib/lock.hpp>
+
+namespace kernel::system::sched::rcu {
+
+static uint64_t seq = 0;
+static uint64_t seen[MAX_CPUS];
+
+static head_t *pending_head = nullptr;
+static head_t *pending_tail = nullptr;
+new_lock(rcu_lock);
+
+void call(head_t *head, void (*func)(head_t*))
+{
+    head->func = func;
+    head->next = nullptr;
+
+    uint64_t flags = read_lock();
+    rcu_lock.lock();
+
+    head->seq = __atomic_add_fetch(&seq, 1, __ATOMIC_SEQ_CST);
+    if (pending_tail) pending_tail->next = head;
+    else pending_head = head;
+    pending_tail = head;
+
+    rcu_lock.unlock();
+    read_unlock(flags);
+}
+
+void quiescent(size_t cpu)
+{
+    __atomic_store_n(&seen[cpu], __atomic_load_n(&seq, __ATOMIC_SEQ_CST), __ATOMIC_RELEASE);
+    if (__atomic_load_n(&pending_head, __ATOMIC_ACQUIRE) == nullptr) return;
+
+    uint64_t done = static_cast<uint64_t>(-1);
+    for (size_t i = 0; i < MAX_CPUS; i++)
+    {
+        if (scheduler::online.test(i) == false) continue;
+        uint64_t curr = __atomic_load_n(&seen[i], __ATOMIC_ACQUIRE);
+        if (curr < done) done = curr;
+    }
+
+    rcu_lock.lock();
+    head_t *first = pending_head;
+    head_t *last = nullptr;
+    while (pending_head != nullptr && pending_head->seq <= done)
+    {
+        last = pending_head;
+        pending_head = pending_head->next;
+    }
+    if (pending_head == nullptr) pending_tail = nullptr;
+    rcu_lock.unlock();
+
+    if (last == nullptr) return;
+    last->next = nullptr;
+    while (first != nullptr)
+    {
+        head_t *next = first->next;
+        first->func(first);
+        first = next;
+    }
+}
+}
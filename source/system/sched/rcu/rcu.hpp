@@ -0,0 +1,43 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kernel::system::sched::rcu {
+
+struct head_t
+{
+    void (*func)(head_t *head);
+    head_t *next;
+    uint64_t seq;
+};
+
+static inline uint64_t read_lock()
+{
+    uint64_t flags = 0;
+    asm volatile ("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void read_unlock(uint64_t flags)
+{
+    if (flags & (1 << 9)) asm volatile ("sti" : : : "memory");
+}
+
+template<typename type>
+static inline type dereference(type &ptr)
+{
+    return __atomic_load_n(&ptr, __ATOMIC_ACQUIRE);
+}
+
+template<typename type>
+static inline void assign(type &ptr, type value)
+{
+    __atomic_store_n(&ptr, value, __ATOMIC_RELEASE);
+}
+
+void call(head_t *head, void (*func)(head_t*));
+void quiescent(size_t cpu);
+}
@@ -1,13 +1,16 @@
 // Copyright (C) 2021-2022  ilobilo
 
 #include <system/sched/scheduler/scheduler.hpp>
+#include <system/sched/futex/futex.hpp>
+#include <system/sched/rcu/rcu.hpp>
 #include <system/sched/pit/pit.hpp>
 #include <system/cpu/apic/apic.hpp>
 #include <system/cpu/idt/idt.hpp>
 #include <system/cpu/smp/smp.hpp>
+#include <system/vdso/vdso.hpp>
+#include <system/mm/pmm/pmm.hpp>
 #include <kernel/kernel.hpp>
 #include <lib/string.hpp>
-#include <lib/bitmap.hpp>
 #include <lib/timer.hpp>
 #include <lib/log.hpp>
 
@@ -19,10 +22,17 @@ bool initialised = false;
 static bool die = false;
 bool debug = false;
 
-Bitmap pids;
+static uint64_t pids[max_procs / 64];
+static size_t pid_cursor = 1;
+static process_t *pid_table[PID_BUCKETS];
 static uint8_t sched_vector = 0;
 
-vector<process_t*> proc_table;
+list_t<process_t, &process_t::table_node> proc_table;
+lock_t list_lock;
+
+cpumask_t default_affinity = cpumask_t::all();
+cpumask_t online = cpumask_t::all();
+cpumask_t isolated;
 process_t *initproc = nullptr;
 
 size_t proc_count = 0;
@@ -31,19 +41,92 @@ size_t thread_count = 0;
 new_lock(thread_lock);
 new_lock(sched_lock);
 new_lock(proc_lock);
+new_lock(timeout_lock);
+new_lock(pid_lock);
+
+static thread_t *timeouts = nullptr;
+
+static thread_t *reaper_thread = nullptr;
+static vfs::fdtable_t *reap_list = nullptr;
+new_lock(reap_lock);
 
 int alloc_pid()
 {
-    if (pids.buffer == nullptr) pids.buffer = new uint8_t[(max_procs - 1) / 8 + 1];
-    for (size_t i = 1; i < max_procs; i++)
+    uint64_t flags = irq_save();
+    pid_lock.lock();
+
+    int pid = -1;
+    size_t words = max_procs / 64;
+    size_t start = pid_cursor / 64;
+    for (size_t i = 0; i <= words; i++)
     {
-        if (pids[i] == false)
+        size_t word = (start + i) % words;
+        uint64_t bits = pids[word];
+        if (i == 0) bits |= (1UL << (pid_cursor % 64)) - 1;
+        if (word == 0) bits |= 1;
+        if (bits == ~0UL) continue;
+
+        pid = word * 64 + __builtin_ctzl(~bits);
+        pids[word] |= (1UL << (pid % 64));
+        pid_cursor = (pid + 1) % max_procs;
+        break;
+    }
+
+    pid_lock.unlock();
+    irq_restore(flags);
+    return pid;
+}
+
+void free_pid(int pid)
+{
+    if (pid <= 0 || static_cast<uint64_t>(pid) >= max_procs) return;
+
+    uint64_t flags = irq_save();
+    pid_lock.lock();
+    pids[pid / 64] &= ~(1UL << (pid % 64));
+    pid_lock.unlock();
+    irq_restore(flags);
+}
+
+static void hash_proc(process_t *proc)
+{
+    uint64_t flags = irq_save();
+    pid_lock.lock();
+    process_t **bucket = &pid_table[proc->pid % PID_BUCKETS];
+    proc->pid_next = *bucket;
+    *bucket = proc;
+    pid_lock.unlock();
+    irq_restore(flags);
+}
+
+static void unhash_proc(process_t *proc)
+{
+    uint64_t flags = irq_save();
+    pid_lock.lock();
+    for (process_t **curr = &pid_table[proc->pid % PID_BUCKETS]; *curr != nullptr; curr = &(*curr)->pid_next)
+    {
+        if (*curr == proc)
         {
-            pids.Set(i, true);
-            return i;
+            *curr = proc->pid_next;
+            break;
         }
     }
-    return -1;
+    proc->pid_next = nullptr;
+    pid_lock.unlock();
+    irq_restore(flags);
+}
+
+process_t *find_proc(int pid)
+{
+    if (pid <= 0) return nullptr;
+
+    uint64_t flags = irq_save();
+    pid_lock.lock();
+    process_t *proc = pid_table[pid % PID_BUCKETS];
+    while (proc != nullptr && proc->pid != pid) proc = proc->pid_next;
+    pid_lock.unlock();
+    irq_restore(flags);
+    return proc;
 }
 
 void yield(uint64_t ms)
@@ -163,6 +246,7 @@ thread_t::thread_t(process_t *parent, priority_t priority, Auxval auxval, vector
     tmpstack -= 2; *tmpstack = AT_PHDR; *(tmpstack + 1) = auxval.phdr;
     tmpstack -= 2; *tmpstack = AT_PHENT; *(tmpstack + 1) = auxval.phent;
     tmpstack -= 2; *tmpstack = AT_PHNUM; *(tmpstack + 1) = auxval.phnum;
+    if (auxval.sysinfo) { tmpstack -= 2; *tmpstack = AT_SYSINFO_EHDR; *(tmpstack + 1) = auxval.sysinfo; }
 
     *(--tmpstack) = 0;
 
@@ -208,11 +292,14 @@ thread_t *thread_t::fork(registers_t *regs)
 
     newthread->regs = *regs;
 
-    uint64_t offset = reinterpret_cast<uint64_t>(newthread->stack) - reinterpret_cast<uint64_t>(this->stack);
-    newthread->regs.rsp += offset;
-    newthread->regs.rbp += offset;
+    if (this->user == false)
+    {
+        uint64_t offset = reinterpret_cast<uint64_t>(newthread->stack) - reinterpret_cast<uint64_t>(this->stack);
+        newthread->regs.rsp += offset;
+        newthread->regs.rbp += offset;
 
-    memcpy(newthread->stack, this->stack, STACK_SIZE);
+        memcpy(newthread->stack, this->stack, STACK_SIZE);
+    }
 
     newthread->priority = this->priority;
     newthread->parent = this->parent;
@@ -220,6 +307,40 @@ thread_t *thread_t::fork(registers_t *regs)
 
     newthread->gsbase = (this->user ? this->gsbase : reinterpret_cast<uint64_t>(newthread));
     newthread->fsbase = this->fsbase;
+    newthread->affinity = this->affinity;
+
+    return newthread;
+}
+
+thread_t *thread_t::clone(registers_t *regs, uint64_t stack, uint64_t tls)
+{
+    lockit(thread_lock);
+
+    auto newthread = new thread_t;
+
+    newthread->state = INITIAL;
+    newthread->stack_phys = nullptr;
+    newthread->stack = reinterpret_cast<uint8_t*>(stack);
+
+    newthread->kstack_phys = malloc<uint8_t*>(STACK_SIZE);
+    newthread->kstack = newthread->kstack_phys + hhdm_offset;
+
+    newthread->fpu_storage = malloc<uint8_t*>(this_cpu->fpu_storage_size) + hhdm_offset;
+    newthread->fpu_storage_size = this_cpu->fpu_storage_size;
+    this_cpu->fpu_save(newthread->fpu_storage);
+
+    newthread->regs = *regs;
+    newthread->regs.rsp = stack;
+    newthread->regs.rax = 0;
+    newthread->regs.rdx = 0;
+
+    newthread->priority = this->priority;
+    newthread->parent = this->parent;
+    newthread->user = true;
+
+    newthread->gsbase = this->gsbase;
+    newthread->fsbase = tls ? tls : get_fs();
+    newthread->affinity = this->affinity;
 
     return newthread;
 }
@@ -233,7 +354,11 @@ thread_t *process_t::add_user_thread(uint64_t addr, uint64_t args, priority_t pr
     thread->tid = this->next_tid++;
     thread_count++;
 
+    uint64_t flags = irq_save();
+    list_lock.lock();
     this->threads.push_back(thread);
+    list_lock.unlock();
+    irq_restore(flags);
     thread->state = READY;
 
     return thread;
@@ -248,13 +373,17 @@ thread_t *process_t::add_thread(uint64_t addr, uint64_t args, priority_t priorit
     thread->tid = this->next_tid++;
     thread_count++;
 
+    uint64_t flags = irq_save();
+    list_lock.lock();
     this->threads.push_back(thread);
+    list_lock.unlock();
+    irq_restore(flags);
     thread->state = READY;
 
     return thread;
 }
 
-thread_t *process_t::add_thread(thread_t *thread)
+thread_t *process_t::add_thread(thread_t *thread, bool start)
 {
     lockit(proc_lock);
 
@@ -263,20 +392,31 @@ thread_t *process_t::add_thread(thread_t *thread)
     thread->tid = this->next_tid++;
     thread_count++;
 
+    uint64_t flags = irq_save();
+    list_lock.lock();
     this->threads.push_back(thread);
-    thread->state = READY;
+    list_lock.unlock();
+    irq_restore(flags);
+    if (start) thread->state = READY;
 
     return thread;
 }
 
 bool process_t::enqueue()
 {
-    if (this->in_table || (this->children.size() == 0 && this->threads.size() == 0)) return false;
+    if (this->in_table || (this->children.empty() && this->threads.empty())) return false;
     lockit(proc_lock);
 
     if (initproc == nullptr) initproc = this;
 
+    uint64_t flags = irq_save();
+    list_lock.lock();
     proc_table.push_back(this);
+    if (this->parent != nullptr) this->parent->children.push_back(this);
+    list_lock.unlock();
+    irq_restore(flags);
+
+    hash_proc(this);
     proc_count++;
 
     this->state = READY;
@@ -328,6 +468,7 @@ process_t *start_program(vfs::fs_node_t *dir, std::string path, vector<std::stri
     auto proc = new process_t(procname);
     auto [auxval, ld_path] = elf_load(proc->pagemap, prog->res, 0);
     uint64_t entry = 0;
+    auxval.sysinfo = vdso::map(proc);
 
     if (ld_path.empty()) entry = auxval.entry;
     else
@@ -350,7 +491,7 @@ process_t *start_program(vfs::fs_node_t *dir, std::string path, vector<std::stri
         .refcount = 1
     };
     auto stdin_fd = new vfs::fd_t { .handle = stdin_handle };
-    proc->fds[0] = stdin_fd;
+    vfs::fdnum_from_fd(proc, stdin_fd, 0, true);
 
     auto stdout_node = vfs::get_node(nullptr, stdout, true);
     auto stdout_handle = new vfs::handle_t
@@ -360,7 +501,7 @@ process_t *start_program(vfs::fs_node_t *dir, std::string path, vector<std::stri
         .refcount = 1
     };
     auto stdout_fd = new vfs::fd_t { .handle = stdout_handle };
-    proc->fds[1] = stdout_fd;
+    vfs::fdnum_from_fd(proc, stdout_fd, 1, true);
 
     auto stderr_node = vfs::get_node(nullptr, stderr, true);
     auto stderr_handle = new vfs::handle_t
@@ -370,7 +511,7 @@ process_t *start_program(vfs::fs_node_t *dir, std::string path, vector<std::stri
         .refcount = 1
     };
     auto stderr_fd = new vfs::fd_t { .handle = stderr_handle };
-    proc->fds[2] = stderr_fd;
+    vfs::fdnum_from_fd(proc, stderr_fd, 2, true);
 
     proc->add_user_thread(entry, 0, MID, auxval, argv, envp);
 
@@ -437,7 +578,13 @@ void thread_t::block()
     if (this->state != READY && this->state != RUNNING) return;
     asm volatile ("cli");
 
-    this->state = BLOCKED;
+    __atomic_store_n(&this->state, BLOCKED, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&this->wakeup, false, __ATOMIC_SEQ_CST))
+    {
+        this->state = READY;
+        asm volatile ("sti");
+        return;
+    }
     if (debug) log("Blocking thread with TID: %d and PID: %d", this->tid, this->parent->pid);
 
     asm volatile ("sti");
@@ -450,23 +597,187 @@ void thread_t::block()
 
 void thread_t::unblock()
 {
-    if (this->state != BLOCKED)
-    asm volatile ("cli");
+    __atomic_store_n(&this->wakeup, true, __ATOMIC_SEQ_CST);
 
-    this->state = READY;
+    state_t expected = BLOCKED;
+    if (!__atomic_compare_exchange_n(&this->state, &expected, READY, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) return;
+
+    // Woken directly, so the pending flag must not leak into the next block()
+    __atomic_store_n(&this->wakeup, false, __ATOMIC_SEQ_CST);
     if (debug) log("Unblocking thread with TID: %d and PID: %d", this->tid, this->parent->pid);
+}
 
-    asm volatile ("sti");
+void waitqueue_t::add(thread_t *thread)
+{
+    uint64_t flags = irq_save();
+    this->lock.lock();
+
+    thread->wait_next = this->head;
+    this->head = thread;
+
+    this->lock.unlock();
+    irq_restore(flags);
+}
+
+void waitqueue_t::remove(thread_t *thread)
+{
+    uint64_t flags = irq_save();
+    this->lock.lock();
+
+    for (thread_t **curr = &this->head; *curr != nullptr; curr = &(*curr)->wait_next)
+    {
+        if (*curr == thread)
+        {
+            *curr = thread->wait_next;
+            thread->wait_next = nullptr;
+            break;
+        }
+    }
+
+    this->lock.unlock();
+    irq_restore(flags);
+}
+
+void waitqueue_t::wake()
+{
+    uint64_t flags = irq_save();
+    this->lock.lock();
+
+    thread_t *thread = this->head;
+    this->head = nullptr;
+    while (thread != nullptr)
+    {
+        thread_t *next = thread->wait_next;
+        thread->wait_next = nullptr;
+        thread->unblock();
+        thread = next;
+    }
+
+    this->lock.unlock();
+    irq_restore(flags);
+}
+
+bool set_affinity(thread_t *thread, cpumask_t mask)
+{
+    mask = mask & online;
+    if (mask.empty()) return false;
+
+    thread->affinity = mask;
+    return true;
+}
+
+void init_affinity(size_t count)
+{
+    online = cpumask_t::first(count);
+
+    const char *list = strstr(cmdline, "isolcpus=");
+    if (list != nullptr)
+    {
+        char *curr = const_cast<char*>(list) + 9;
+        while (isdigit(*curr))
+        {
+            size_t first = strtoul(curr, &curr, 10);
+            size_t last = first;
+            if (*curr == '-') last = strtoul(curr + 1, &curr, 10);
+            for (size_t cpu = first; cpu <= last && cpu < count; cpu++)
+            {
+                if (cpu != 0) isolated.set(cpu);
+            }
+            if (*curr != ',') break;
+            curr++;
+        }
+    }
+
+    default_affinity = online & ~isolated;
+    for (size_t cpu = 0; cpu < count; cpu++)
+    {
+        if (isolated.test(cpu)) log("CPU %zu is isolated from general scheduling", cpu);
+    }
+
+    if (apic::initialised == false) return;
+    for (uint8_t vector = idt::IRQ0; vector <= idt::IRQ15; vector++)
+    {
+        if (idt::interrupt_handlers[vector].handler) apic::ioapic_set_affinity(vector - idt::IRQ0, irq_target());
+    }
+}
+
+uint32_t irq_target()
+{
+    static size_t next = 0;
+    while (true)
+    {
+        size_t cpu = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED) % MAX_CPUS;
+        if (default_affinity.test(cpu) && online.test(cpu)) return smp::cpus[cpu].lapic_id;
+    }
+}
+
+void add_timeout(thread_t *thread, uint64_t deadline)
+{
+    uint64_t flags = irq_save();
+    timeout_lock.lock();
+
+    thread->deadline = deadline;
+    thread_t **curr = &timeouts;
+    while (*curr != nullptr && (*curr)->deadline <= deadline) curr = &(*curr)->timeout_next;
+    thread->timeout_next = *curr;
+    *curr = thread;
+
+    timeout_lock.unlock();
+    irq_restore(flags);
+}
+
+void remove_timeout(thread_t *thread)
+{
+    uint64_t flags = irq_save();
+    timeout_lock.lock();
+
+    for (thread_t **curr = &timeouts; *curr != nullptr; curr = &(*curr)->timeout_next)
+    {
+        if (*curr == thread)
+        {
+            *curr = thread->timeout_next;
+            break;
+        }
+    }
+    thread->timeout_next = nullptr;
+    thread->deadline = 0;
+
+    timeout_lock.unlock();
+    irq_restore(flags);
+}
+
+static void expire_timeouts()
+{
+    if (__atomic_load_n(&timeouts, __ATOMIC_ACQUIRE) == nullptr) return;
+    uint64_t now = vdso::monotonic();
+
+    timeout_lock.lock();
+    while (timeouts != nullptr && timeouts->deadline <= now)
+    {
+        thread_t *thread = timeouts;
+        timeouts = thread->timeout_next;
+        thread->timeout_next = nullptr;
+        thread->deadline = 0;
+        thread->unblock();
+    }
+    timeout_lock.unlock();
 }
 
 void thread_t::exit(bool halt)
 {
-    if (this->parent == initproc && this->parent->threads.size() == 1 && this->parent->children.size() == 0)
+    if (this->parent == initproc && this->parent->threads.size() == 1 && this->parent->children.empty())
     {
         error("Can not kill init thread!");
         return;
     }
 
+    if (this->clear_tid != nullptr && this == this_thread())
+    {
+        __atomic_store_n(this->clear_tid, 0, __ATOMIC_SEQ_CST);
+        futex::wake(this->clear_tid, 1);
+        this->clear_tid = nullptr;
+    }
+
     asm volatile ("cli");
 
     this->state = KILLED;
@@ -480,66 +791,139 @@ void thread_t::exit(bool halt)
     }
 }
 
+static bool on_cpu(thread_t *thread)
+{
+    for (size_t i = 0; i < MAX_CPUS; i++)
+    {
+        if (online.test(i) && smp::cpus[i].current_thread == thread) return true;
+    }
+    return false;
+}
+
+static void free_thread(process_t *proc, thread_t *thread)
+{
+    proc->threads.remove(thread);
+    if (thread->deadline != 0) remove_timeout(thread);
+    if (thread->cleanup != nullptr) thread->cleanup(thread, thread->cleanup_arg);
+    free(thread->fpu_storage - hhdm_offset);
+    // TODO: Fix this: Triple fault
+    // free(thread->stack_phys);
+    // if (thread->kstack_phys) free(thread->kstack_phys);
+    free(thread);
+    thread_count--;
+}
+
+static void close_fdtable(vfs::fdtable_t *fdt)
+{
+    for (size_t i = 0; i < fdt->size; i++)
+    {
+        if (fdt->test(i) && fdt->fds[i] != nullptr) fdt->fds[i]->unref();
+    }
+    vfs::free_fdtable(fdt);
+}
+
+// Resources take their own locks with interrupts enabled, so they are
+// released from a thread rather than from clean_proc()
+static void reaper(uint64_t arg)
+{
+    while (true)
+    {
+        uint64_t flags = irq_save();
+        reap_lock.lock();
+        vfs::fdtable_t *fdt = reap_list;
+        reap_list = nullptr;
+        reap_lock.unlock();
+        irq_restore(flags);
+
+        if (fdt == nullptr)
+        {
+            this_thread()->block();
+            continue;
+        }
+        while (fdt != nullptr)
+        {
+            vfs::fdtable_t *next = fdt->reap_next;
+            close_fdtable(fdt);
+            fdt = next;
+        }
+    }
+}
+
+static void reap_fdtable(vfs::fdtable_t *fdt)
+{
+    reap_lock.lock();
+    fdt->reap_next = reap_list;
+    reap_list = fdt;
+    reap_lock.unlock();
+    reaper_thread->unblock();
+}
+
+// Called from schedule() with list_lock held
 void clean_proc(process_t *proc)
 {
     if (proc == nullptr || proc == this_cpu->idle_proc) return;
     if (proc->state == KILLED)
     {
-        for (size_t i = 0; i < proc->children.size(); i++)
+        bool running = false;
+        for (thread_t *thread = proc->threads.front(); thread != nullptr;)
         {
-            process_t *childproc = proc->children[i];
-            childproc->state = KILLED;
-            clean_proc(childproc);
+            thread_t *next = proc->threads.next(thread);
+            thread->state = KILLED;
+            if (on_cpu(thread))
+            {
+                running = true;
+                if (apic::initialised && thread->cpu != this_cpu->id) apic::apic_send_ipi(smp::cpus[thread->cpu].lapic_id, sched_vector);
+            }
+            else free_thread(proc, thread);
+            thread = next;
         }
-        for (size_t i = 0; i < proc->threads.size(); i++)
+        if (running) return;
+
+        while (process_t *childproc = proc->children.front())
         {
-            thread_t *thread = proc->threads[i];
-            proc->threads.remove(proc->threads.find(thread));
-            free(thread->fpu_storage - hhdm_offset);
-            // TODO: Fix this: Triple fault
-            // free(thread->stack_phys);
-            // if (thread->kstack_phys) free(thread->kstack_phys);
-            free(thread);
-            thread_count--;
+            proc->children.remove(childproc);
+            childproc->parent = (proc == initproc) ? nullptr : initproc;
+            if (childproc->parent != nullptr) initproc->children.push_back(childproc);
         }
-        for (size_t i = 0; i < max_fds; i++)
+
+        if (proc->fdt != nullptr)
         {
-            if (proc->fds[i] == nullptr) continue;
-            vfs::fdnum_close(proc, i);
+            if (reaper_thread != nullptr) reap_fdtable(proc->fdt);
+            else close_fdtable(proc->fdt);
+            proc->fdt = nullptr;
         }
 
         process_t *parentproc = proc->parent;
         if (parentproc != nullptr)
         {
-            parentproc->children.remove(parentproc->children.find(proc));
-            if (parentproc->children.size() == 0 && proc->threads.size() == 0)
+            parentproc->children.remove(proc);
+            if (parentproc != initproc && parentproc->children.empty() && parentproc->threads.empty())
             {
                 parentproc->state = KILLED;
                 clean_proc(parentproc);
             }
         }
-        pids.Set(proc->pid, false);
+        if (proc->in_table)
+        {
+            proc_table.remove(proc);
+            unhash_proc(proc);
+        }
+        free_pid(proc->pid);
         proc->pagemap->deleteThis();
+        if (proc->vdso_data) pmm::free(reinterpret_cast<void*>(proc->vdso_data));
+        delete proc->trace_stats;
         free(proc);
         proc_count--;
     }
     else
     {
-        for (size_t i = 0; i < proc->threads.size(); i++)
+        for (thread_t *thread = proc->threads.front(); thread != nullptr;)
         {
-            thread_t *thread = proc->threads[i];
-            if (thread->state == KILLED)
-            {
-                proc->threads.remove(proc->threads.find(thread));
-                free(thread->fpu_storage - hhdm_offset);
-                // TODO: Fix this: Triple fault
-                // free(thread->stack_phys);
-                // if (thread->kstack_phys) free(thread->kstack_phys);
-                free(thread);
-                thread_count--;
-            }
+            thread_t *next = proc->threads.next(thread);
+            if (thread->state == KILLED && on_cpu(thread) == false) free_thread(proc, thread);
+            thread = next;
         }
-        if (proc->children.size() == 0 && proc->threads.size() == 0)
+        if (proc->children.empty() && proc->threads.empty())
         {
             proc->state = KILLED;
             clean_proc(proc);
@@ -563,6 +947,7 @@ size_t switchThread(registers_t *regs, thread_t *thread)
 
     this_cpu->current_thread = thread;
     this_cpu->current_proc = thread->parent;
+    thread->skipped = 0;
 
     *regs = this_thread()->regs;
     this_thread()->cpu = this_cpu->id;
@@ -578,6 +963,54 @@ size_t switchThread(registers_t *regs, thread_t *thread)
     return thread->priority;
 }
 
+static bool runnable(thread_t *thread, bool warm)
+{
+    if (thread->state != READY || !thread->affinity.test(this_cpu->id)) return false;
+    if (warm == false || thread->cpu == this_cpu->id || thread->cpu == static_cast<uint64_t>(-1)) return true;
+    return __atomic_add_fetch(&thread->skipped, 1, __ATOMIC_RELAXED) > MIGRATE_AFTER;
+}
+
+static thread_t *pick_from(process_t *proc, thread_t *thread, bool warm)
+{
+    if (proc->state != READY) return nullptr;
+    for (; thread != nullptr; thread = proc->threads.next(thread))
+    {
+        if (runnable(thread, warm)) return thread;
+    }
+    return nullptr;
+}
+
+static thread_t *pick(bool warm)
+{
+    process_t *curr = this_proc();
+    thread_t *thread = nullptr;
+
+    if (curr == nullptr || this_thread() == nullptr || curr->in_table == false)
+    {
+        for (process_t *proc : proc_table)
+        {
+            thread = pick_from(proc, proc->threads.front(), warm);
+            if (thread != nullptr) return thread;
+        }
+        return nullptr;
+    }
+
+    thread = pick_from(curr, curr->threads.next(this_thread()), warm);
+    if (thread != nullptr) return thread;
+
+    for (process_t *proc = proc_table.next(curr); proc != nullptr; proc = proc_table.next(proc))
+    {
+        thread = pick_from(proc, proc->threads.front(), warm);
+        if (thread != nullptr) return thread;
+    }
+    for (process_t *proc = proc_table.front(); proc != proc_table.next(curr); proc = proc_table.next(proc))
+    {
+        thread = pick_from(proc, proc->threads.front(), warm);
+        if (thread != nullptr) return thread;
+    }
+    return nullptr;
+}
+
 void schedule(registers_t *regs)
 {
     if (die) while (true) asm volatile ("cli; hlt");
@@ -586,93 +1019,42 @@ void schedule(registers_t *regs)
         yield();
         return;
     }
+    expire_timeouts();
+    rcu::quiescent(this_cpu->id);
     lockit(sched_lock);
 
     uint64_t timeslice = MID;
+    process_t *prev = this_proc();
 
+    list_lock.lock();
     if (!this_proc() || !this_thread())
     {
-        for (size_t i = 0; i < proc_table.size(); i++)
+        for (process_t *proc = proc_table.front(); proc != nullptr;)
         {
-            auto proc = proc_table[i];
-            if (proc->state != READY)
-            {
-                clean_proc(proc);
-                continue;
-            }
-
-            for (size_t t = 0; t < proc->threads.size(); t++)
-            {
-                auto thread = proc->threads[t];
-                if (thread->state != READY) continue;
-
-                timeslice = switchThread(regs, thread);
-                goto success;
-            }
+            process_t *proc_next = proc_table.next(proc);
+            if (proc->state != READY) clean_proc(proc);
+            proc = proc_next;
         }
-        goto idle;
     }
-    else
-    {
-        size_t this_proc_id = proc_table.find(this_proc());
-        size_t this_thread_id = this_proc()->threads.find(this_thread());
-
-        for (size_t t = this_thread_id + 1; t < this_proc()->threads.size(); t++)
-        {
-            auto thread = this_proc()->threads[t];
-
-            if (this_proc()->state != READY) break;
-            if (thread->state != READY) continue;
-
-            clean_proc(this_proc());
-
-            timeslice = switchThread(regs, thread);
-            goto success;
-        }
-        for (size_t p = this_proc_id + 1; p < proc_table.size(); p++)
-        {
-            auto proc = proc_table[p];
-            if (proc->state != READY) continue;
-
-            for (size_t t = 0; t < proc->threads.size(); t++)
-            {
-                thread_t *thread = proc->threads[t];
-                if (thread->state != READY) continue;
-
-                clean_proc(this_proc());
-
-                timeslice = switchThread(regs, thread);
-                goto success;
-            }
-        }
-        for (size_t p = 0; p < this_proc_id + 1; p++)
-        {
-            auto proc = proc_table[p];
-            if (proc->state != READY) continue;
-
-            for (size_t t = 0; t < proc->threads.size(); t++)
-            {
-                auto thread = proc->threads[t];
-                if (thread->state != READY) continue;
 
-                clean_proc(this_proc());
-
-                timeslice = switchThread(regs, thread);
-                goto success;
-            }
-        }
+    thread_t *next = pick(true);
+    if (next == nullptr) next = pick(false);
+    if (next == nullptr)
+    {
+        list_lock.unlock();
+        goto idle;
     }
-    goto idle;
 
-    success:
+    timeslice = switchThread(regs, next);
+    clean_proc(prev);
+    list_lock.unlock();
+
     if (debug) log("Running process[%d]->thread[%d] on CPU core %zu with timeslice: %zu", this_proc()->pid - 1, this_thread()->tid - 1, this_cpu->id, timeslice);
 
     yield(timeslice);
     return;
 
     idle:
-    clean_proc(this_proc());
-
     if (this_cpu->idle_proc == nullptr)
     {
         this_cpu->idle_proc = new process_t("Idle Process", reinterpret_cast<uint64_t>(idle), 0, LOW);
@@ -680,6 +1062,9 @@ void schedule(registers_t *regs)
     }
 
     timeslice = switchThread(regs, this_cpu->idle_proc->threads.front());
+    list_lock.lock();
+    clean_proc(prev);
+    list_lock.unlock();
     if (debug) log("Running Idle process on CPU core %zu", this_cpu->id);
 
     yield(timeslice);
@@ -715,7 +1100,13 @@ void init(bool last)
         }
         if (initproc != nullptr) pit::schedule = true;
     }
-    if (last) initialised = true;
+    if (last)
+    {
+        auto proc = new process_t("reaper", reaper, 0, LOW);
+        reaper_thread = proc->threads.front();
+        proc->enqueue();
+        initialised = true;
+    }
     while (true) asm volatile ("hlt");
 }
 }
@@ -2,8 +2,11 @@
 
 #pragma once
 
+#include <system/cpu/syscall/trace.hpp>
 #include <system/mm/vmm/vmm.hpp>
 #include <system/vfs/vfs.hpp>
+#include <lib/cpumask.hpp>
+#include <lib/ilist.hpp>
 #include <lib/lock.hpp>
 #include <lib/cpu.hpp>
 #include <lib/elf.hpp>
@@ -14,9 +17,11 @@ using namespace kernel::system::mm;
 namespace kernel::system::sched::scheduler {
 
 static constexpr uint64_t max_procs = 65536;
-static constexpr uint64_t max_fds = 256;
+static constexpr size_t PID_BUCKETS = 1024;
+static constexpr uint64_t max_fds = 1024;
 static constexpr uint64_t MMAP_ANON_BASE = 0x80000000000;
 static constexpr uint64_t THREAD_STACK_TOP = 0x70000000000;
+static constexpr size_t MIGRATE_AFTER = 4;
 
 enum state_t
 {
@@ -35,10 +40,14 @@ enum priority_t
     HIGH = 7,
 };
 
+extern cpumask_t default_affinity;
+extern cpumask_t online;
+extern cpumask_t isolated;
+
 struct process_t;
 struct thread_t
 {
-    uint64_t cpu;
+    uint64_t cpu = static_cast<uint64_t>(-1);
     uint8_t *stack;
     uint8_t *kstack;
 
@@ -57,6 +66,17 @@ struct thread_t
 
     bool user;
 
+    volatile bool wakeup = false;
+    thread_t *wait_next = nullptr;
+    uint64_t deadline = 0;
+    thread_t *timeout_next = nullptr;
+    uint32_t *clear_tid = nullptr;
+    cpumask_t affinity = default_affinity;
+    size_t skipped = 0;
+    void (*cleanup)(thread_t *thread, uint64_t arg) = nullptr;
+    uint64_t cleanup_arg = 0;
+    list_node_t<thread_t> sibling;
+
     thread_t(process_t *parent, priority_t priority, Auxval auxval, vector<std::string> argv, vector<std::string> envp);
     thread_t(uint64_t addr, uint64_t args, process_t *parent, priority_t priority);
 
@@ -67,6 +87,7 @@ struct thread_t
     bool map_user();
 
     thread_t *fork(registers_t *regs);
+    thread_t *clone(registers_t *regs, uint64_t stack, uint64_t tls);
 
     void block();
     void unblock();
@@ -83,11 +104,16 @@ struct process_t
     uint64_t mmap_anon_base = MMAP_ANON_BASE;
     lock_t fd_lock;
     vfs::fs_node_t *current_dir;
-    void *fds[max_fds];
-    vector<thread_t*> threads;
-    vector<process_t*> children;
+    vfs::fdtable_t *fdt = nullptr;
+    list_node_t<process_t> sibling;
+    list_node_t<process_t> table_node;
+    process_t *pid_next = nullptr;
+    list_t<thread_t, &thread_t::sibling> threads;
+    list_t<process_t, &process_t::sibling> children;
     process_t *parent;
     uint64_t thread_stack_top = THREAD_STACK_TOP;
+    uint64_t vdso_data = 0;
+    cpu::syscall::trace::stats_t *trace_stats = nullptr;
 
     bool in_table = false;
 
@@ -102,7 +128,7 @@ struct process_t
     {
         return this->add_thread(reinterpret_cast<uint64_t>(addr), args, priority);
     }
-    thread_t *add_thread(thread_t *thread);
+    thread_t *add_thread(thread_t *thread, bool start = true);
 
     bool enqueue();
 
@@ -119,17 +145,38 @@ struct process_t
     private:
 };
 
+struct waitqueue_t
+{
+    lock_t lock;
+    thread_t *head = nullptr;
+
+    void add(thread_t *thread);
+    void remove(thread_t *thread);
+    void wake();
+};
+
 extern bool debug;
 extern process_t *initproc;
 
-extern vector<process_t*> proc_table;
+extern list_t<process_t, &process_t::table_node> proc_table;
+// Guards proc_table and every threads/children list; take with interrupts off
+extern lock_t list_lock;
 
 extern size_t proc_count;
 extern size_t thread_count;
 
 int alloc_pid();
+void free_pid(int pid);
+process_t *find_proc(int pid);
 process_t *start_program(vfs::fs_node_t *dir, std::string path, vector<std::string> argv, vector<std::string> envp, std::string stdin, std::string stdout, std::string stderr, std::string procname = "");
 
+bool set_affinity(thread_t *thread, cpumask_t mask);
+void init_affinity(size_t count);
+uint32_t irq_target();
+
+void add_timeout(thread_t *thread, uint64_t deadline);
+void remove_timeout(thread_t *thread);
+
 void yield(uint64_t ms = 1);
 void schedule(registers_t *regs);
 
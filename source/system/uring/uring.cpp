@@ -0,0 +1,340 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <system/cpu/syscall/syscall.hpp>
+#include <system/uring/uring.hpp>
+#include <system/mm/pmm/pmm.hpp>
+#include <kernel/kernel.hpp>
+#include <lib/string.hpp>
+#include <lib/math.hpp>
+
+using namespace kernel::system::cpu;
+using namespace kernel::system::mm;
+
+namespace kernel::system::uring {
+
+static uint64_t ring_dev = 0;
+
+static int32_t execute(sqe_t &sqe)
+{
+    bool positional = sqe.off != static_cast<uint64_t>(-1);
+    switch (sqe.opcode)
+    {
+        case op_nop:
+            return 0;
+        case op_read:
+            return syscall::invoke(positional ? syscall::SYSCALL_PREAD : syscall::SYSCALL_READ, sqe.fd, sqe.addr, sqe.len, sqe.off);
+        case op_write:
+            return syscall::invoke(positional ? syscall::SYSCALL_PWRITE : syscall::SYSCALL_WRITE, sqe.fd, sqe.addr, sqe.len, sqe.off);
+        case op_readv:
+            return syscall::invoke(positional ? syscall::SYSCALL_PREADV : syscall::SYSCALL_READV, sqe.fd, sqe.addr, sqe.len, sqe.off);
+        case op_writev:
+            return syscall::invoke(positional ? syscall::SYSCALL_PWRITEV : syscall::SYSCALL_WRITEV, sqe.fd, sqe.addr, sqe.len, sqe.off);
+        case op_fsync:
+            return syscall::invoke(syscall::SYSCALL_FSYNC, sqe.fd);
+        case op_openat:
+            return syscall::invoke(syscall::SYSCALL_OPENAT, sqe.fd, sqe.addr, sqe.op_flags, sqe.len);
+        case op_close:
+            return syscall::invoke(syscall::SYSCALL_CLOSE, sqe.fd);
+    }
+    return -EINVAL;
+}
+
+uint32_t uring_res::submit(uint32_t count)
+{
+    lockit(this->sq_lock);
+
+    uint32_t head = this->sq_head;
+    uint32_t avail = MIN(count, MIN(this->sq_pending(), this->cq_space()));
+
+    work_t *first = nullptr;
+    work_t *last = nullptr;
+    uint32_t queued = 0;
+
+    for (uint32_t i = 0; i < avail; i++)
+    {
+        sqe_t sqe = this->sqes[(head + i) & this->sq_mask];
+        if (sqe.opcode == op_nop)
+        {
+            this->complete(sqe.user_data, 0);
+            continue;
+        }
+
+        work_t *work = new work_t { sqe, nullptr };
+        if (last) last->next = work;
+        else first = work;
+        last = work;
+        queued++;
+    }
+    this->sq_head = head + avail;
+    __atomic_store_n(&this->header->sq_head, this->sq_head, __ATOMIC_RELEASE);
+
+    if (queued > 0)
+    {
+        this->work_lock.lock();
+        if (this->work_tail) this->work_tail->next = first;
+        else this->work_head = first;
+        this->work_tail = last;
+        __atomic_add_fetch(&this->inflight, queued, __ATOMIC_ACQ_REL);
+        this->work_lock.unlock();
+
+        this->workers.wake();
+    }
+    return avail;
+}
+
+void uring_res::complete(uint64_t user_data, int32_t res)
+{
+    this->cq_lock.lock();
+    if (this->cq_ready() >= this->cq_entries) this->header->cq_overflow++;
+    else
+    {
+        this->cqes[this->cq_tail & this->cq_mask] = cqe_t { user_data, res, 0 };
+        this->cq_tail++;
+        __atomic_store_n(&this->header->cq_tail, this->cq_tail, __ATOMIC_RELEASE);
+    }
+    this->cq_lock.unlock();
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (this->waiters.head != nullptr) this->waiters.wake();
+    this->notify(vfs::pollin | vfs::pollrdnorm);
+    if (this->header->sq_flags & sq_need_wakeup) this->poller.wake();
+}
+
+work_t *uring_res::next_work()
+{
+    while (true)
+    {
+        this->work_lock.lock();
+        work_t *work = this->work_head;
+        if (work != nullptr)
+        {
+            this->work_head = work->next;
+            if (this->work_head == nullptr) this->work_tail = nullptr;
+        }
+        this->work_lock.unlock();
+
+        if (work != nullptr || this->dying) return work;
+
+        scheduler::thread_t *thread = this_thread();
+        this->workers.add(thread);
+        if (this->work_head == nullptr && this->dying == false) thread->block();
+        this->workers.remove(thread);
+    }
+}
+
+void uring_res::wait_cq(uint32_t count)
+{
+    if (count > this->cq_entries) count = this->cq_entries;
+    while (this->cq_ready() < count && this->dying == false)
+    {
+        scheduler::thread_t *thread = this_thread();
+        if (thread == nullptr)
+        {
+            asm volatile ("pause");
+            continue;
+        }
+
+        this->waiters.add(thread);
+        if (this->cq_ready() < count && this->dying == false) thread->block();
+        this->waiters.remove(thread);
+    }
+}
+
+void uring_res::thread_exit()
+{
+    if (__atomic_sub_fetch(&this->threads, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+    while (this->work_head != nullptr)
+    {
+        work_t *next = this->work_head->next;
+        delete this->work_head;
+        this->work_head = next;
+    }
+    delete this;
+}
+
+void uring_res::unref(void *handle)
+{
+    this->refcount--;
+    if (this->refcount > 0) return;
+
+    this->dying = true;
+    this->workers.wake();
+    this->waiters.wake();
+    this->poller.wake();
+    this->thread_exit();
+}
+
+// Called by the scheduler when the process dies before the thread returns
+static void thread_gone(scheduler::thread_t *thread, uint64_t arg)
+{
+    uring_res *ring = reinterpret_cast<uring_res*>(arg);
+    ring->workers.remove(thread);
+    ring->poller.remove(thread);
+    ring->thread_exit();
+}
+
+static void leave(uring_res *ring)
+{
+    uint64_t flags = irq_save();
+    this_thread()->cleanup = nullptr;
+    ring->thread_exit();
+    irq_restore(flags);
+}
+
+static void worker(uint64_t arg)
+{
+    uring_res *ring = reinterpret_cast<uring_res*>(arg);
+    while (work_t *work = ring->next_work())
+    {
+        ring->complete(work->sqe.user_data, execute(work->sqe));
+        __atomic_sub_fetch(&ring->inflight, 1, __ATOMIC_ACQ_REL);
+        delete work;
+    }
+    leave(ring);
+}
+
+static void sqpoll(uint64_t arg)
+{
+    uring_res *ring = reinterpret_cast<uring_res*>(arg);
+    uint32_t idle = 0;
+
+    while (ring->dying == false)
+    {
+        if (ring->submit(ring->sq_entries) > 0)
+        {
+            idle = 0;
+            continue;
+        }
+        if (++idle < ring->idle)
+        {
+            asm volatile ("pause");
+            continue;
+        }
+
+        scheduler::thread_t *thread = this_thread();
+        ring->poller.add(thread);
+        __atomic_or_fetch(&ring->header->sq_flags, sq_need_wakeup, __ATOMIC_SEQ_CST);
+        if ((ring->sq_pending() == 0 || ring->cq_space() == 0) && ring->dying == false) thread->block();
+        __atomic_and_fetch(&ring->header->sq_flags, ~sq_need_wakeup, __ATOMIC_SEQ_CST);
+        ring->poller.remove(thread);
+        idle = 0;
+    }
+    leave(ring);
+}
+
+int setup(uint32_t entries, params_t *params)
+{
+    if (entries == 0 || entries > MAX_ENTRIES || params == nullptr)
+    {
+        errno_set(EINVAL);
+        return -1;
+    }
+
+    uint32_t sq_entries = 1;
+    while (sq_entries < entries) sq_entries <<= 1;
+    uint32_t cq_entries = sq_entries * 2;
+
+    size_t workers = params->workers ? MIN(static_cast<size_t>(params->workers), MAX_WORKERS) : DEFAULT_WORKERS;
+    size_t threads = workers + ((params->flags & setup_sqpoll) ? 1 : 0);
+
+    uint64_t sqes_off = ALIGN_UP(sizeof(header_t), sizeof(sqe_t));
+    uint64_t cqes_off = sqes_off + sq_entries * sizeof(sqe_t);
+    uint64_t size = ALIGN_UP(cqes_off + cq_entries * sizeof(cqe_t), vmm::page_size);
+
+    if (ring_dev == 0) ring_dev = vfs::dev_new_id();
+
+    uring_res *ring = new uring_res;
+    ring->proc = this_proc();
+    ring->pages = size / vmm::page_size;
+    ring->phys = reinterpret_cast<uint64_t>(pmm::alloc(ring->pages));
+    ring->flags = params->flags;
+    ring->idle = params->sq_idle ? params->sq_idle : DEFAULT_IDLE;
+
+    ring->header = reinterpret_cast<header_t*>(ring->phys + hhdm_offset);
+    ring->sqes = reinterpret_cast<sqe_t*>(ring->phys + hhdm_offset + sqes_off);
+    ring->cqes = reinterpret_cast<cqe_t*>(ring->phys + hhdm_offset + cqes_off);
+
+    ring->sq_entries = sq_entries;
+    ring->sq_mask = sq_entries - 1;
+    ring->cq_entries = cq_entries;
+    ring->cq_mask = cq_entries - 1;
+
+    ring->header->sq_entries = sq_entries;
+    ring->header->sq_mask = sq_entries - 1;
+    ring->header->cq_entries = cq_entries;
+    ring->header->cq_mask = cq_entries - 1;
+
+    ring->refcount = 0;
+    ring->can_mmap = false;
+    ring->stat.dev = ring_dev;
+    ring->stat.mode = 0600;
+    ring->stat.nlink = 1;
+    ring->stat.size = size;
+    ring->stat.blksize = vmm::page_size;
+    ring->stat.blocks = ring->pages;
+    ring->threads = threads + 1;
+
+    int fdnum = vfs::fdnum_from_res(nullptr, ring, vfs::o_rdwr | vfs::o_cloexec, 0, false);
+    if (fdnum == -1)
+    {
+        pmm::free(reinterpret_cast<void*>(ring->phys), ring->pages);
+        delete ring;
+        errno_set(EMFILE);
+        return -1;
+    }
+
+    uint64_t addr = ring->proc->mmap_anon_base;
+    ring->proc->mmap_anon_base += size + vmm::page_size;
+    ring->proc->pagemap->mapRange(addr, ring->phys, size, vmm::ProtRead | vmm::ProtWrite, vmm::MapShared);
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        auto thread = new scheduler::thread_t(i < workers ? worker : sqpoll, reinterpret_cast<uint64_t>(ring), ring->proc, scheduler::MID);
+        thread->cleanup = thread_gone;
+        thread->cleanup_arg = reinterpret_cast<uint64_t>(ring);
+        ring->proc->add_thread(thread);
+    }
+
+    params->sq_entries = sq_entries;
+    params->cq_entries = cq_entries;
+    params->workers = workers;
+    params->sq_idle = ring->idle;
+    params->ring_addr = addr;
+    params->ring_size = size;
+    params->sqes_off = sqes_off;
+    params->cqes_off = cqes_off;
+
+    return fdnum;
+}
+
+int64_t enter(vfs::fd_t *fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    vfs::resource_t *res = fd->handle->res;
+    if (ring_dev == 0 || res->stat.dev != ring_dev)
+    {
+        errno_set(EBADF);
+        return -1;
+    }
+    uring_res *ring = static_cast<uring_res*>(res);
+
+    int64_t submitted = 0;
+    if (ring->flags & setup_sqpoll)
+    {
+        if (flags & enter_sq_wakeup) ring->poller.wake();
+        submitted = to_submit;
+    }
+    else if (to_submit > 0)
+    {
+        submitted = ring->submit(to_submit);
+        if (submitted == 0 && ring->sq_pending() > 0)
+        {
+            errno_set(EBUSY);
+            return -1;
+        }
+    }
+
+    if ((flags & enter_getevents) && min_complete > 0) ring->wait_cq(min_complete);
+    return submitted;
+}
+}
@@ -0,0 +1,187 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <system/sched/scheduler/scheduler.hpp>
+#include <system/vfs/vfs.hpp>
+#include <lib/ring.hpp>
+#include <lib/lock.hpp>
+#include <cstdint>
+
+using namespace kernel::system::sched;
+
+namespace kernel::system::uring {
+
+static constexpr uint32_t MAX_ENTRIES = 4096;
+static constexpr size_t MAX_WORKERS = 8;
+static constexpr size_t DEFAULT_WORKERS = 2;
+static constexpr uint32_t DEFAULT_IDLE = 100000;
+
+enum setupflags
+{
+    setup_sqpoll = (1 << 1)
+};
+
+enum enterflags
+{
+    enter_getevents = (1 << 0),
+    enter_sq_wakeup = (1 << 1)
+};
+
+enum sqflags
+{
+    sq_need_wakeup = (1 << 0)
+};
+
+enum opcodes
+{
+    op_nop = 0,
+    op_readv = 1,
+    op_writev = 2,
+    op_fsync = 3,
+    op_openat = 18,
+    op_close = 19,
+    op_read = 22,
+    op_write = 23
+};
+
+struct sqe_t
+{
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t ioprio;
+    int32_t fd;
+    uint64_t off;
+    uint64_t addr;
+    uint32_t len;
+    uint32_t op_flags;
+    uint64_t user_data;
+    uint64_t pad[3];
+};
+
+struct cqe_t
+{
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+};
+
+struct header_t
+{
+    alignas(CACHE_LINE) volatile uint32_t sq_head;
+    alignas(CACHE_LINE) volatile uint32_t sq_tail;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    volatile uint32_t sq_flags;
+
+    alignas(CACHE_LINE) volatile uint32_t cq_head;
+    alignas(CACHE_LINE) volatile uint32_t cq_tail;
+    uint32_t cq_mask;
+    uint32_t cq_entries;
+    volatile uint32_t cq_overflow;
+};
+
+struct params_t
+{
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t flags;
+    uint32_t workers;
+    uint32_t sq_idle;
+    uint32_t resv;
+    uint64_t ring_addr;
+    uint64_t ring_size;
+    uint64_t sqes_off;
+    uint64_t cqes_off;
+};
+
+struct work_t
+{
+    sqe_t sqe;
+    work_t *next;
+};
+
+struct uring_res : vfs::resource_t
+{
+    scheduler::process_t *proc;
+    uint64_t phys;
+    size_t pages;
+    uint32_t flags;
+    uint32_t idle;
+
+    // Private copies, the header page is writable by the process
+    uint32_t sq_entries;
+    uint32_t sq_mask;
+    uint32_t sq_head = 0;
+    uint32_t cq_entries;
+    uint32_t cq_mask;
+    uint32_t cq_tail = 0;
+
+    header_t *header;
+    sqe_t *sqes;
+    cqe_t *cqes;
+
+    lock_t sq_lock;
+    lock_t cq_lock;
+    lock_t work_lock;
+    work_t *work_head = nullptr;
+    work_t *work_tail = nullptr;
+    volatile uint32_t inflight = 0;
+    volatile size_t threads = 0;
+    volatile bool dying = false;
+
+    scheduler::waitqueue_t workers;
+    scheduler::waitqueue_t waiters;
+    scheduler::waitqueue_t poller;
+
+    uint32_t cq_ready()
+    {
+        uint32_t ready = __atomic_load_n(&this->cq_tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&this->header->cq_head, __ATOMIC_ACQUIRE);
+        return ready > this->cq_entries ? this->cq_entries : ready;
+    }
+    uint32_t sq_pending()
+    {
+        uint32_t pending = __atomic_load_n(&this->header->sq_tail, __ATOMIC_ACQUIRE) - this->sq_head;
+        return pending > this->sq_entries ? this->sq_entries : pending;
+    }
+    uint32_t cq_space()
+    {
+        uint32_t used = this->cq_ready() + this->inflight;
+        return used >= this->cq_entries ? 0 : this->cq_entries - used;
+    }
+
+    uint32_t submit(uint32_t count);
+    void complete(uint64_t user_data, int32_t res);
+    work_t *next_work();
+    void wait_cq(uint32_t count);
+    void thread_exit();
+
+    int poll(void *handle)
+    {
+        int events = 0;
+        if (this->cq_ready() > 0) events |= vfs::pollin | vfs::pollrdnorm;
+        if (this->sq_pending() < this->sq_entries) events |= vfs::pollout | vfs::pollwrnorm;
+        return events;
+    }
+
+    void unref(void *handle);
+
+    void link(void *handle)
+    {
+        this->stat.nlink++;
+    }
+
+    void unlink(void *handle)
+    {
+        this->stat.nlink--;
+    }
+
+    void *mmap(uint64_t page, int flags)
+    {
+        return nullptr;
+    }
+};
+
+int setup(uint32_t entries, params_t *params);
+int64_t enter(vfs::fd_t *fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags);
+}
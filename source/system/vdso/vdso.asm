@@ -0,0 +1,246 @@
+BITS 64
+
+VVAR equ -0x2000
+VPROC equ -0x1000
+
+VVAR_SEQ equ 0
+VVAR_VALID equ 4
+VVAR_RDTSCP equ 8
+VVAR_SHIFT equ 12
+VVAR_TSC_BASE equ 16
+VVAR_MONO_BASE equ 24
+VVAR_REAL_OFFSET equ 32
+VVAR_MULT equ 40
+
+NSEC_PER_SEC equ 1000000000
+
+%macro fallback 1
+    mov eax, %1
+    syscall
+    cmp rax, -1
+    jne %%done
+    mov rax, rdx
+%%done:
+    ret
+%endmacro
+
+%macro symbol 3
+    dd %1 - dynstr
+    db 0x12, 0
+    dw 1
+    dq %2 - vdso_start
+    dq %3 - %2
+%endmacro
+
+section .rodata.vdso progbits alloc noexec nowrite align=4096
+
+GLOBAL vdso_start
+GLOBAL vdso_end
+
+vdso_start:
+    db 0x7F, "ELF", 2, 1, 1, 0
+    times 8 db 0
+    dw 3
+    dw 62
+    dd 1
+    dq 0
+    dq phdrs - vdso_start
+    dq 0
+    dd 0
+    dw 64
+    dw 56
+    dw 2
+    dw 64
+    dw 0
+    dw 0
+
+phdrs:
+    dd 1, 5
+    dq 0, 0, 0
+    dq vdso_end - vdso_start
+    dq vdso_end - vdso_start
+    dq 0x1000
+
+    dd 2, 4
+    dq dynamic - vdso_start
+    dq dynamic - vdso_start
+    dq dynamic - vdso_start
+    dq dynamic_end - dynamic
+    dq dynamic_end - dynamic
+    dq 8
+
+dynamic:
+    dq 4, hash - vdso_start
+    dq 5, dynstr - vdso_start
+    dq 6, dynsym - vdso_start
+    dq 10, dynstr_end - dynstr
+    dq 11, 24
+    dq 0, 0
+dynamic_end:
+
+hash:
+    dd 1, 6
+    dd 1
+    dd 0, 2, 3, 4, 5, 0
+
+dynsym:
+    times 24 db 0
+    symbol str_clock_gettime, clock_gettime, clock_gettime_end
+    symbol str_gettimeofday, gettimeofday, gettimeofday_end
+    symbol str_time, time, time_end
+    symbol str_getcpu, getcpu, getcpu_end
+    symbol str_getpid, getpid, getpid_end
+
+dynstr:
+    db 0
+str_clock_gettime:
+    db "__vdso_clock_gettime", 0
+str_gettimeofday:
+    db "__vdso_gettimeofday", 0
+str_time:
+    db "__vdso_time", 0
+str_getcpu:
+    db "__vdso_getcpu", 0
+str_getpid:
+    db "__vdso_getpid", 0
+dynstr_end:
+
+align 16
+mono_ns:
+    mov r10d, [r8 + VVAR_SEQ]
+    test r10d, 1
+    jnz .busy
+
+    lfence
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, [r8 + VVAR_TSC_BASE]
+    jnc .scale
+    xor eax, eax
+.scale:
+    mul qword [r8 + VVAR_MULT]
+    mov ecx, [r8 + VVAR_SHIFT]
+    shrd rax, rdx, cl
+    add rax, [r8 + VVAR_MONO_BASE]
+    mov r9, [r8 + VVAR_REAL_OFFSET]
+
+    cmp r10d, [r8 + VVAR_SEQ]
+    jne mono_ns
+    ret
+.busy:
+    pause
+    jmp mono_ns
+
+align 16
+clock_gettime:
+    cmp edi, 7
+    ja .fallback
+    mov eax, 0b11110011
+    bt eax, edi
+    jnc .fallback
+
+    lea r8, [rel vdso_start + VVAR]
+    cmp dword [r8 + VVAR_VALID], 0
+    je .fallback
+
+    call mono_ns
+    cmp edi, 0
+    je .real
+    cmp edi, 5
+    jne .split
+.real:
+    add rax, r9
+.split:
+    xor edx, edx
+    mov ecx, NSEC_PER_SEC
+    div rcx
+    mov [rsi], rax
+    mov [rsi + 8], rdx
+    xor eax, eax
+    ret
+.fallback:
+    fallback 228
+clock_gettime_end:
+
+align 16
+gettimeofday:
+    lea r8, [rel vdso_start + VVAR]
+    cmp dword [r8 + VVAR_VALID], 0
+    je .fallback
+
+    call mono_ns
+    add rax, r9
+
+    test rdi, rdi
+    jz .tz
+    xor edx, edx
+    mov ecx, NSEC_PER_SEC
+    div rcx
+    mov [rdi], rax
+    mov rax, rdx
+    xor edx, edx
+    mov ecx, 1000
+    div rcx
+    mov [rdi + 8], rax
+.tz:
+    test rsi, rsi
+    jz .done
+    mov qword [rsi], 0
+.done:
+    xor eax, eax
+    ret
+.fallback:
+    fallback 96
+gettimeofday_end:
+
+align 16
+time:
+    lea r8, [rel vdso_start + VVAR]
+    cmp dword [r8 + VVAR_VALID], 0
+    je .fallback
+
+    call mono_ns
+    add rax, r9
+    xor edx, edx
+    mov ecx, NSEC_PER_SEC
+    div rcx
+
+    test rdi, rdi
+    jz .done
+    mov [rdi], rax
+.done:
+    ret
+.fallback:
+    fallback 201
+time_end:
+
+align 16
+getcpu:
+    lea r8, [rel vdso_start + VVAR]
+    cmp dword [r8 + VVAR_RDTSCP], 0
+    je .fallback
+
+    rdtscp
+    test rdi, rdi
+    jz .node
+    mov [rdi], ecx
+.node:
+    test rsi, rsi
+    jz .done
+    mov dword [rsi], 0
+.done:
+    xor eax, eax
+    ret
+.fallback:
+    fallback 309
+getcpu_end:
+
+align 16
+getpid:
+    mov eax, [rel vdso_start + VPROC]
+    ret
+getpid_end:
+
+align 4096, db 0
+vdso_end:
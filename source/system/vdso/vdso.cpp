@@ -0,0 +1,123 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <system/sched/rtc/rtc.hpp>
+#include <system/boot/timing.hpp>
+#include <system/mm/pmm/pmm.hpp>
+#include <system/mm/vmm/vmm.hpp>
+#include <system/boot/boot.hpp>
+#include <system/vdso/vdso.hpp>
+#include <kernel/kernel.hpp>
+#include <lib/lock.hpp>
+#include <lib/cpu.hpp>
+#include <lib/log.hpp>
+#include <cpuid.h>
+
+using namespace kernel::system::mm;
+
+namespace kernel::system::vdso {
+
+bool initialised = false;
+vvar_t *vvar = nullptr;
+
+static uint64_t vvar_phys = 0;
+new_lock(vvar_lock);
+
+static uint64_t kernel2phys(uint64_t vaddr)
+{
+    return vaddr - kernel_address_request.response->virtual_base + kernel_address_request.response->physical_base;
+}
+
+uint64_t monotonic()
+{
+    if (vvar == nullptr || __atomic_load_n(&vvar->valid, __ATOMIC_ACQUIRE) == 0) return boot::now();
+
+    uint32_t seq = 0;
+    uint64_t ret = 0;
+    do {
+        seq = __atomic_load_n(&vvar->seq, __ATOMIC_ACQUIRE);
+        uint64_t tsc = rdtsc();
+        uint64_t delta = tsc > vvar->tsc_base ? tsc - vvar->tsc_base : 0;
+        ret = vvar->mono_base + static_cast<uint64_t>((static_cast<unsigned __int128>(delta) * vvar->mult) >> vvar->shift);
+    } while ((seq & 1) || seq != __atomic_load_n(&vvar->seq, __ATOMIC_ACQUIRE));
+
+    return ret;
+}
+
+uint64_t realtime()
+{
+    if (vvar == nullptr) return rtc::epoch() * 1000000000;
+    return monotonic() + vvar->real_offset;
+}
+
+void update()
+{
+    if (vvar == nullptr || __atomic_load_n(&vvar->valid, __ATOMIC_ACQUIRE) == 0) return;
+    lockit(vvar_lock);
+
+    uint64_t now = monotonic();
+    uint64_t tsc = rdtsc();
+
+    __atomic_add_fetch(&vvar->seq, 1, __ATOMIC_SEQ_CST);
+    vvar->tsc_base = tsc;
+    vvar->mono_base = now;
+    __atomic_add_fetch(&vvar->seq, 1, __ATOMIC_RELEASE);
+}
+
+uint64_t map(scheduler::process_t *proc)
+{
+    if (initialised == false) return 0;
+
+    uint64_t vproc = reinterpret_cast<uint64_t>(pmm::alloc());
+    reinterpret_cast<vproc_t*>(vproc + hhdm_offset)->pid = proc->pid;
+    proc->vdso_data = vproc;
+
+    proc->pagemap->mapMem(VVAR_ADDR, vvar_phys, vmm::Present | vmm::UserSuper);
+    proc->pagemap->mapMem(VPROC_ADDR, vproc, vmm::Present | vmm::UserSuper);
+
+    uint64_t image = kernel2phys(reinterpret_cast<uint64_t>(vdso_start));
+    uint64_t size = vdso_end - vdso_start;
+    for (uint64_t i = 0; i < size; i += vmm::page_size)
+    {
+        proc->pagemap->mapMem(IMAGE_ADDR + i, image + i, vmm::Present | vmm::UserSuper);
+    }
+    return IMAGE_ADDR;
+}
+
+void init()
+{
+    log("Initialising vDSO");
+
+    if (initialised)
+    {
+        warn("vDSO has already been initialised!\n");
+        return;
+    }
+
+    boot::calibrate();
+
+    vvar_phys = reinterpret_cast<uint64_t>(pmm::alloc());
+    vvar = reinterpret_cast<vvar_t*>(vvar_phys + hhdm_offset);
+
+    uint32_t a = 0, b = 0, c = 0, d = 0;
+    bool invariant = __get_cpuid(0x80000007, &a, &b, &c, &d) && (d & CPUID_INVARIANT_TSC);
+    vvar->rdtscp = __get_cpuid(0x80000001, &a, &b, &c, &d) && (d & CPUID_RDTSCP);
+
+    if (invariant && boot::tsc_hz != 0)
+    {
+        vvar->shift = 32;
+        vvar->mult = (1000000000UL << 32) / boot::tsc_hz;
+        // Continue from boot::now() so deadlines taken before the switch stay valid
+        vvar->tsc_base = rdtsc();
+        vvar->mono_base = boot::now();
+        __atomic_store_n(&vvar->valid, 1, __ATOMIC_RELEASE);
+        log("vDSO: TSC clock at %lu Hz", boot::tsc_hz);
+    }
+    else warn("vDSO: TSC is not invariant, time calls will use system calls");
+
+    vvar->real_offset = rtc::epoch() * 1000000000 - monotonic();
+    log("vDSO: Image is %lu bytes, mapped at 0x%lX", static_cast<uint64_t>(vdso_end - vdso_start), IMAGE_ADDR);
+
+    serial::newline();
+    initialised = true;
+}
+}
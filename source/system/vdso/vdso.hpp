@@ -0,0 +1,67 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <system/sched/scheduler/scheduler.hpp>
+#include <cstddef>
+#include <cstdint>
+
+using namespace kernel::system::sched;
+
+namespace kernel::system::vdso {
+
+static constexpr uint64_t VDSO_BASE = 0x7F000000000;
+static constexpr uint64_t VVAR_ADDR = VDSO_BASE;
+static constexpr uint64_t VPROC_ADDR = VDSO_BASE + 0x1000;
+static constexpr uint64_t IMAGE_ADDR = VDSO_BASE + 0x2000;
+
+static constexpr uint64_t TSC_AUX = 0xC0000103;
+
+enum clocks
+{
+    CLOCK_REALTIME = 0,
+    CLOCK_MONOTONIC = 1,
+    CLOCK_MONOTONIC_RAW = 4,
+    CLOCK_REALTIME_COARSE = 5,
+    CLOCK_MONOTONIC_COARSE = 6,
+    CLOCK_BOOTTIME = 7
+};
+
+struct vvar_t
+{
+    volatile uint32_t seq;
+    uint32_t valid;
+    uint32_t rdtscp;
+    uint32_t shift;
+    uint64_t tsc_base;
+    uint64_t mono_base;
+    uint64_t real_offset;
+    uint64_t mult;
+};
+static_assert(offsetof(vvar_t, shift) == 12 && offsetof(vvar_t, tsc_base) == 16 && offsetof(vvar_t, mult) == 40);
+
+struct timeval_t
+{
+    int64_t tv_sec;
+    int64_t tv_usec;
+};
+
+struct vproc_t
+{
+    int32_t pid;
+};
+
+extern "C" uint8_t vdso_start[];
+extern "C" uint8_t vdso_end[];
+
+extern bool initialised;
+extern vvar_t *vvar;
+
+uint64_t monotonic();
+uint64_t realtime();
+
+void update();
+uint64_t map(scheduler::process_t *proc);
+
+void init();
+}
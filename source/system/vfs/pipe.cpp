@@ -0,0 +1,480 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#include <system/mm/pmm/pmm.hpp>
+#include <system/mm/vmm/vmm.hpp>
+#include <system/vfs/pipe.hpp>
+#include <kernel/kernel.hpp>
+#include <lib/memory.hpp>
+#include <lib/string.hpp>
+
+using namespace kernel::system::mm;
+
+namespace kernel::system::vfs {
+
+static constexpr uint64_t FIONREAD = 0x541B;
+
+static inline uint8_t *bufaddr(pipe_buffer_t &buffer)
+{
+    return reinterpret_cast<uint8_t*>(buffer.page + hhdm_offset + buffer.offset);
+}
+
+static inline void drop(lock_t *first, lock_t *second)
+{
+    if (second) second->unlock();
+    if (first) first->unlock();
+}
+
+static inline void retake(lock_t *first, lock_t *second)
+{
+    if (first) first->lock();
+    if (second) second->lock();
+}
+
+// Locks passed in are held by the caller and dropped while sleeping
+int pipe_t::wait_readable(bool nonblock, lock_t *first, lock_t *second)
+{
+    while (this->empty())
+    {
+        if (this->writer->refcount == 0) return 0;
+        if (nonblock)
+        {
+            errno_set(EAGAIN);
+            return -1;
+        }
+
+        scheduler::thread_t *thread = this_thread();
+        if (thread == nullptr)
+        {
+            asm volatile ("pause");
+            continue;
+        }
+
+        this->readers.add(thread);
+        drop(first, second);
+        if (this->empty() && this->writer->refcount > 0) thread->block();
+        this->readers.remove(thread);
+        retake(first, second);
+    }
+    return 1;
+}
+
+int pipe_t::wait_writable(bool nonblock, lock_t *first, lock_t *second)
+{
+    while (true)
+    {
+        if (this->reader->refcount == 0)
+        {
+            errno_set(EPIPE);
+            return -1;
+        }
+        if (!this->full()) return 1;
+        if (nonblock)
+        {
+            errno_set(EAGAIN);
+            return -1;
+        }
+
+        scheduler::thread_t *thread = this_thread();
+        if (thread == nullptr)
+        {
+            asm volatile ("pause");
+            continue;
+        }
+
+        this->writers.add(thread);
+        drop(first, second);
+        if (this->full() && this->reader->refcount > 0) thread->block();
+        this->writers.remove(thread);
+        retake(first, second);
+    }
+}
+
+void pipe_t::push(pipe_buffer_t buffer)
+{
+    lockit(this->lock);
+    this->buffers[this->head % PIPE_BUFFERS] = buffer;
+    this->bytes += buffer.length;
+    this->head++;
+}
+
+size_t pipe_t::pop(pipe_buffer_t &out, size_t max)
+{
+    lockit(this->lock);
+
+    pipe_buffer_t &buffer = this->buffers[this->tail % PIPE_BUFFERS];
+    if (buffer.length <= max)
+    {
+        out = buffer;
+        this->tail++;
+    }
+    else
+    {
+        out.page = reinterpret_cast<uint64_t>(pmm::alloc());
+        out.offset = 0;
+        out.length = max;
+        memcpy(bufaddr(out), bufaddr(buffer), max);
+
+        buffer.offset += max;
+        buffer.length -= max;
+    }
+
+    this->bytes -= out.length;
+    return out.length;
+}
+
+void pipe_t::consume(size_t count)
+{
+    lockit(this->lock);
+
+    pipe_buffer_t &buffer = this->buffers[this->tail % PIPE_BUFFERS];
+    buffer.offset += count;
+    buffer.length -= count;
+    this->bytes -= count;
+
+    if (buffer.length == 0)
+    {
+        pmm::free(reinterpret_cast<void*>(buffer.page));
+        this->tail++;
+    }
+}
+
+int64_t pipe_t::read(uint8_t *buffer, size_t size, bool nonblock)
+{
+    if (size == 0) return 0;
+    lockit(this->read_lock);
+
+    int ret = this->wait_readable(nonblock, &this->read_lock);
+    if (ret <= 0) return ret;
+
+    size_t copied = 0;
+    this->lock.lock();
+    while (copied < size && !this->empty())
+    {
+        pipe_buffer_t &buf = this->buffers[this->tail % PIPE_BUFFERS];
+        size_t chunk = MIN(static_cast<size_t>(buf.length), size - copied);
+        memcpy(buffer + copied, bufaddr(buf), chunk);
+
+        buf.offset += chunk;
+        buf.length -= chunk;
+        this->bytes -= chunk;
+        copied += chunk;
+
+        if (buf.length == 0)
+        {
+            pmm::free(reinterpret_cast<void*>(buf.page));
+            this->tail++;
+        }
+    }
+    this->lock.unlock();
+
+    this->wake_writers();
+    return copied;
+}
+
+int64_t pipe_t::write(uint8_t *buffer, size_t size, bool nonblock)
+{
+    if (size == 0) return 0;
+    lockit(this->write_lock);
+
+    size_t written = 0;
+    while (written < size)
+    {
+        if (this->wait_writable(nonblock, &this->write_lock) < 0) return written ? written : -1;
+
+        this->lock.lock();
+        if (!this->empty())
+        {
+            pipe_buffer_t &last = this->buffers[(this->head - 1) % PIPE_BUFFERS];
+            size_t space = vmm::page_size - (last.offset + last.length);
+            size_t chunk = MIN(space, size - written);
+            if (chunk > 0)
+            {
+                memcpy(bufaddr(last) + last.length, buffer + written, chunk);
+                last.length += chunk;
+                this->bytes += chunk;
+                written += chunk;
+            }
+        }
+        while (written < size && !this->full())
+        {
+            size_t chunk = MIN(vmm::page_size, size - written);
+            pipe_buffer_t &buf = this->buffers[this->head % PIPE_BUFFERS];
+            buf.page = reinterpret_cast<uint64_t>(pmm::alloc());
+            buf.offset = 0;
+            buf.length = chunk;
+            memcpy(bufaddr(buf), buffer + written, chunk);
+
+            this->head++;
+            this->bytes += chunk;
+            written += chunk;
+        }
+        this->lock.unlock();
+
+        this->wake_readers();
+    }
+    return written;
+}
+
+int64_t pipe_t::move(pipe_t *out, size_t len, bool nonblock)
+{
+    if (len == 0) return 0;
+    lockit(this->read_lock);
+    lockit(out->write_lock);
+
+    while (true)
+    {
+        int ret = this->wait_readable(nonblock, &this->read_lock, &out->write_lock);
+        if (ret <= 0) return ret;
+        if (out->wait_writable(nonblock, &this->read_lock, &out->write_lock) < 0) return -1;
+        if (!this->empty()) break;
+    }
+
+    size_t moved = 0;
+    while (moved < len && !this->empty() && !out->full())
+    {
+        pipe_buffer_t buf;
+        moved += this->pop(buf, len - moved);
+        out->push(buf);
+    }
+
+    this->wake_writers();
+    out->wake_readers();
+    return moved;
+}
+
+int64_t pipe_t::drain(handle_t *out, int64_t *offset, size_t len, bool nonblock)
+{
+    if (len == 0) return 0;
+    lockit(this->read_lock);
+    lockit(out->lock);
+
+    int ret = this->wait_readable(nonblock, &this->read_lock, &out->lock);
+    if (ret <= 0) return ret;
+
+    int64_t pos = offset ? *offset : out->offset;
+    size_t done = 0;
+    while (done < len && !this->empty())
+    {
+        this->lock.lock();
+        pipe_buffer_t buf = this->buffers[this->tail % PIPE_BUFFERS];
+        this->lock.unlock();
+        size_t count = MIN(static_cast<size_t>(buf.length), len - done);
+
+        int64_t written = out->res->write(out, bufaddr(buf), pos, count);
+        if (written <= 0)
+        {
+            if (written < 0 && done == 0) return -1;
+            break;
+        }
+
+        this->consume(written);
+        this->wake_writers();
+
+        pos += written;
+        done += written;
+        if (static_cast<size_t>(written) < count) break;
+    }
+
+    if (offset) *offset = pos;
+    else out->offset = pos;
+    return done;
+}
+
+int64_t pipe_t::fill(handle_t *in, int64_t *offset, size_t len, bool nonblock)
+{
+    if (len == 0) return 0;
+    lockit(this->write_lock);
+    lockit(in->lock);
+
+    if (this->wait_writable(nonblock, &this->write_lock, &in->lock) < 0) return -1;
+
+    int64_t pos = offset ? *offset : in->offset;
+    size_t done = 0;
+    while (done < len && !this->full())
+    {
+        pipe_buffer_t buf { reinterpret_cast<uint64_t>(pmm::alloc()), 0, 0 };
+        size_t chunk = MIN(vmm::page_size, len - done);
+
+        int64_t got = in->res->read(in, bufaddr(buf), pos, chunk);
+        if (got <= 0)
+        {
+            pmm::free(reinterpret_cast<void*>(buf.page));
+            if (got < 0 && done == 0) return -1;
+            break;
+        }
+
+        buf.length = got;
+        this->push(buf);
+        this->wake_readers();
+
+        pos += got;
+        done += got;
+        if (static_cast<size_t>(got) < chunk) break;
+    }
+
+    if (offset) *offset = pos;
+    else in->offset = pos;
+    return done;
+}
+
+int64_t pipe_res::read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
+{
+    if (this != this->pipe->reader)
+    {
+        errno_set(EBADF);
+        return -1;
+    }
+    bool nonblock = handle && (static_cast<handle_t*>(handle)->flags & o_nonblock);
+    return this->pipe->read(buffer, size, nonblock);
+}
+
+int64_t pipe_res::write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
+{
+    if (this != this->pipe->writer)
+    {
+        errno_set(EBADF);
+        return -1;
+    }
+    bool nonblock = handle && (static_cast<handle_t*>(handle)->flags & o_nonblock);
+    return this->pipe->write(buffer, size, nonblock);
+}
+
+int pipe_res::ioctl(void *handle, uint64_t request, void *argp)
+{
+    if (request == FIONREAD)
+    {
+        *static_cast<int*>(argp) = this->pipe->bytes;
+        return 0;
+    }
+    return default_ioctl(handle, request, argp);
+}
+
+int pipe_res::poll(void *handle)
+{
+    pipe_t *pipe = this->pipe;
+    int events = 0;
+    if (this == pipe->reader)
+    {
+        if (!pipe->empty()) events |= pollin | pollrdnorm;
+        if (pipe->writer->refcount == 0) events |= pollhup;
+    }
+    else
+    {
+        if (pipe->reader->refcount == 0) events |= pollerr;
+        else if (!pipe->full()) events |= pollout | pollwrnorm;
+    }
+    return events;
+}
+
+void pipe_res::unref(void *handle)
+{
+    pipe_t *pipe = this->pipe;
+
+    // The other end may free the pipe as soon as the lock is dropped
+    pipe->lock.lock();
+    this->refcount--;
+    bool dead = pipe->reader->refcount == 0 && pipe->writer->refcount == 0;
+    if (this == pipe->writer)
+    {
+        pipe->readers.wake();
+        pipe->reader->notify(pollhup);
+    }
+    else
+    {
+        pipe->writers.wake();
+        pipe->writer->notify(pollerr);
+    }
+    pipe->lock.unlock();
+
+    if (dead == false) return;
+
+    for (size_t i = pipe->tail; i != pipe->head; i++)
+    {
+        pmm::free(reinterpret_cast<void*>(pipe->buffers[i % PIPE_BUFFERS].page));
+    }
+    delete pipe->reader;
+    delete pipe->writer;
+    delete pipe;
+}
+
+pipe_t *new_pipe()
+{
+    pipe_t *pipe = new pipe_t;
+    uint64_t dev = dev_new_id();
+
+    pipe_res **ends[2] = { &pipe->reader, &pipe->writer };
+    for (pipe_res **end : ends)
+    {
+        pipe_res *res = new pipe_res;
+        res->pipe = pipe;
+        res->refcount = 0;
+        res->can_mmap = false;
+        res->stat.dev = dev;
+        res->stat.mode = 0600 | stats::ififo;
+        res->stat.nlink = 1;
+        res->stat.blksize = vmm::page_size;
+        *end = res;
+    }
+    return pipe;
+}
+
+int64_t splice(fd_t *in, int64_t *off_in, fd_t *out, int64_t *off_out, size_t len, int flags)
+{
+    pipe_t *pin = res2pipe(in->handle->res);
+    pipe_t *pout = res2pipe(out->handle->res);
+
+    if ((pin && in->handle->res != pin->reader) || (pout && out->handle->res != pout->writer))
+    {
+        errno_set(EBADF);
+        return -1;
+    }
+    if ((pin && off_in) || (pout && off_out))
+    {
+        errno_set(ESPIPE);
+        return -1;
+    }
+
+    bool nonblock = flags & splice_f_nonblock;
+    if (pin && pout)
+    {
+        if (pin == pout)
+        {
+            errno_set(EINVAL);
+            return -1;
+        }
+        return pin->move(pout, len, nonblock || (in->handle->flags & o_nonblock) || (out->handle->flags & o_nonblock));
+    }
+    if (pin) return pin->drain(out->handle, off_out, len, nonblock || (in->handle->flags & o_nonblock));
+    if (pout) return pout->fill(in->handle, off_in, len, nonblock || (out->handle->flags & o_nonblock));
+
+    errno_set(EINVAL);
+    return -1;
+}
+
+int64_t vmsplice(fd_t *fd, iovec_t *iov, size_t count, int flags)
+{
+    pipe_t *pipe = res2pipe(fd->handle->res);
+    if (pipe == nullptr)
+    {
+        errno_set(EBADF);
+        return -1;
+    }
+
+    bool nonblock = (flags & splice_f_nonblock) || (fd->handle->flags & o_nonblock);
+    bool towrite = fd->handle->res == pipe->writer;
+
+    int64_t total = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (iov[i].len == 0) continue;
+
+        uint8_t *base = static_cast<uint8_t*>(iov[i].base);
+        int64_t ret = towrite ? pipe->write(base, iov[i].len, nonblock) : pipe->read(base, iov[i].len, nonblock);
+        if (ret < 0) return total ? total : -1;
+
+        total += ret;
+        if (static_cast<size_t>(ret) < iov[i].len) break;
+    }
+    return total;
+}
+}
@@ -0,0 +1,124 @@
+// Copyright (C) 2021-2022  ilobilo
+
+#pragma once
+
+#include <system/sched/scheduler/scheduler.hpp>
+#include <system/vfs/vfs.hpp>
+#include <lib/lock.hpp>
+#include <cstdint>
+
+using namespace kernel::system::sched;
+
+namespace kernel::system::vfs {
+
+static constexpr size_t PIPE_BUFFERS = 16;
+
+enum spliceflags
+{
+    splice_f_move = 1,
+    splice_f_nonblock = 2,
+    splice_f_more = 4,
+    splice_f_gift = 8
+};
+
+struct pipe_buffer_t
+{
+    uint64_t page;
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct pipe_t;
+struct pipe_res : resource_t
+{
+    pipe_t *pipe;
+
+    int64_t read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size);
+    int64_t write(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size);
+    int ioctl(void *handle, uint64_t request, void *argp);
+    int poll(void *handle);
+    void unref(void *handle);
+
+    void link(void *handle)
+    {
+        this->stat.nlink++;
+    }
+
+    void unlink(void *handle)
+    {
+        this->stat.nlink--;
+    }
+
+    void *mmap(uint64_t page, int flags)
+    {
+        return nullptr;
+    }
+};
+
+struct pipe_t
+{
+    lock_t lock;
+    lock_t read_lock;
+    lock_t write_lock;
+
+    pipe_buffer_t buffers[PIPE_BUFFERS];
+    size_t head = 0;
+    size_t tail = 0;
+    size_t bytes = 0;
+
+    pipe_res *reader;
+    pipe_res *writer;
+
+    scheduler::waitqueue_t readers;
+    scheduler::waitqueue_t writers;
+
+    size_t used()
+    {
+        return this->head - this->tail;
+    }
+    bool empty()
+    {
+        return this->head == this->tail;
+    }
+    bool full()
+    {
+        return this->used() == PIPE_BUFFERS;
+    }
+
+    void wake_readers()
+    {
+        this->readers.wake();
+        this->reader->notify(pollin | pollrdnorm);
+    }
+    void wake_writers()
+    {
+        this->writers.wake();
+        this->writer->notify(pollout | pollwrnorm);
+    }
+
+    int wait_readable(bool nonblock, lock_t *first = nullptr, lock_t *second = nullptr);
+    int wait_writable(bool nonblock, lock_t *first = nullptr, lock_t *second = nullptr);
+
+    void push(pipe_buffer_t buffer);
+    size_t pop(pipe_buffer_t &out, size_t max);
+    void consume(size_t count);
+
+    int64_t read(uint8_t *buffer, size_t size, bool nonblock);
+    int64_t write(uint8_t *buffer, size_t size, bool nonblock);
+
+    int64_t move(pipe_t *out, size_t len, bool nonblock);
+    int64_t drain(handle_t *out, int64_t *offset, size_t len, bool nonblock);
+    int64_t fill(handle_t *in, int64_t *offset, size_t len, bool nonblock);
+};
+
+static inline pipe_t *res2pipe(resource_t *res)
+{
+    if (res == nullptr || !isifo(res->stat.mode)) return nullptr;
+    return static_cast<pipe_res*>(res)->pipe;
+}
+
+pipe_t *new_pipe();
+
+int64_t splice(fd_t *in, int64_t *off_in, fd_t *out, int64_t *off_out, size_t len, int flags);
+int64_t vmsplice(fd_t *fd, iovec_t *iov, size_t count, int flags);
+}
@@ -29,6 +29,92 @@ int default_ioctl(void *handle, uint64_t request, void *argp)
     return -1;
 }
 
+void resource_t::watch(watch_t *watch)
+{
+    uint64_t flags = irq_save();
+    this->watch_lock.lock();
+
+    watch->prev = nullptr;
+    watch->next = this->watchers;
+    if (this->watchers) this->watchers->prev = watch;
+    this->watchers = watch;
+    watch->watching = true;
+
+    this->watch_lock.unlock();
+    irq_restore(flags);
+}
+
+bool resource_t::unwatch(watch_t *watch)
+{
+    bool ret = false;
+    uint64_t flags = irq_save();
+    this->watch_lock.lock();
+
+    if (watch->watching == true)
+    {
+        if (watch->prev) watch->prev->next = watch->next;
+        else this->watchers = watch->next;
+        if (watch->next) watch->next->prev = watch->prev;
+        watch->watching = false;
+        ret = true;
+    }
+
+    this->watch_lock.unlock();
+    irq_restore(flags);
+    return ret;
+}
+
+// May be called from interrupt handlers
+void resource_t::notify(int events)
+{
+    if (__atomic_load_n(&this->watchers, __ATOMIC_ACQUIRE) == nullptr) return;
+
+    uint64_t flags = irq_save();
+    this->watch_lock.lock();
+    for (watch_t *watch = this->watchers; watch != nullptr; watch = watch->next)
+    {
+        watch->callback(watch, events);
+    }
+    this->watch_lock.unlock();
+    irq_restore(flags);
+}
+
+void resource_t::release(void *handle)
+{
+    if (__atomic_load_n(&this->watchers, __ATOMIC_ACQUIRE) == nullptr) return;
+
+    watch_t *released = nullptr;
+
+    uint64_t flags = irq_save();
+    this->watch_lock.lock();
+    watch_t *watch = this->watchers;
+    while (watch != nullptr)
+    {
+        watch_t *next = watch->next;
+        if (watch->handle == handle)
+        {
+            if (watch->prev) watch->prev->next = watch->next;
+            else this->watchers = watch->next;
+            if (watch->next) watch->next->prev = watch->prev;
+            watch->watching = false;
+
+            watch->next = released;
+            released = watch;
+        }
+        watch = next;
+    }
+    this->watch_lock.unlock();
+    irq_restore(flags);
+
+    // Owners take their own locks before watch_lock, so call back without it
+    while (released != nullptr)
+    {
+        watch_t *next = released->next;
+        released->release(released);
+        released = next;
+    }
+}
+
 void install_fs(filesystem_t *fs)
 {
     filesystems.push_back(fs);
@@ -266,25 +352,118 @@ int fdnum_from_node(fs_node_t *node, int flags, int oldfd, bool specific)
     return fdnum_from_fd(this_proc(), fd, oldfd, specific);
 }
 
+static constexpr size_t fdtable_initial = 64;
+
+static void free_fd(rcu::head_t *head)
+{
+    delete reinterpret_cast<fd_t*>(reinterpret_cast<uint8_t*>(head) - offsetof(fd_t, rcu));
+}
+
+static void free_fdtable_rcu(rcu::head_t *head)
+{
+    free_fdtable(reinterpret_cast<fdtable_t*>(reinterpret_cast<uint8_t*>(head) - offsetof(fdtable_t, rcu)));
+}
+
+// The resource is only released once nothing has the fd pinned, so a
+// close() can't pull it out from under a blocked read() or write()
+void fd_t::unref()
+{
+    if (__atomic_sub_fetch(&this->refcount, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+    handle_t *handle = this->handle;
+    resource_t *res = handle->res;
+
+    if (__atomic_load_n(&handle->refcount, __ATOMIC_ACQUIRE) == 1) res->release(handle);
+    res->unref(handle);
+    handle->unref();
+    rcu::call(&this->rcu, free_fd);
+}
+
+fdtable_t *new_fdtable(size_t size)
+{
+    fdtable_t *fdt = new fdtable_t;
+    fdt->size = size;
+    fdt->next = 0;
+    fdt->fds = new fd_t*[size];
+    fdt->open = new uint64_t[size / 64];
+    memset(fdt->fds, 0, size * sizeof(fd_t*));
+    memset(fdt->open, 0, size / 8);
+    return fdt;
+}
+
+void free_fdtable(fdtable_t *fdt)
+{
+    delete[] fdt->fds;
+    delete[] fdt->open;
+    delete fdt;
+}
+
+static fdtable_t *expand_fdtable(scheduler::process_t *proc, size_t fdnum)
+{
+    fdtable_t *old = proc->fdt;
+    if (old != nullptr && fdnum < old->size) return old;
+    if (fdnum >= scheduler::max_fds)
+    {
+        errno_set(EMFILE);
+        return nullptr;
+    }
+
+    size_t size = old ? old->size : fdtable_initial;
+    while (size <= fdnum) size *= 2;
+
+    fdtable_t *fdt = new_fdtable(MIN(size, scheduler::max_fds));
+    if (old != nullptr)
+    {
+        memcpy(fdt->fds, old->fds, old->size * sizeof(fd_t*));
+        memcpy(fdt->open, old->open, old->size / 8);
+        fdt->next = old->next;
+    }
+    rcu::assign(proc->fdt, fdt);
+
+    if (old != nullptr) rcu::call(&old->rcu, free_fdtable_rcu);
+    return fdt;
+}
+
+static size_t find_free(fdtable_t *fdt)
+{
+    for (size_t i = fdt->next / 64; i < fdt->size / 64; i++)
+    {
+        if (fdt->open[i] != ~0UL) return i * 64 + __builtin_ctzl(~fdt->open[i]);
+    }
+    return fdt->size;
+}
+
 int fdnum_from_fd(scheduler::process_t *proc, fd_t *fd, int oldfd, bool specific)
 {
     if (proc == nullptr) proc = this_proc();
-    lockit(proc->fd_lock);
-
-    if (specific)
+    if (specific && oldfd < 0)
     {
-        proc->fds[oldfd] = fd;
-        return oldfd;
+        errno_set(EBADF);
+        return -1;
     }
-    for (size_t i = 0; i < scheduler::max_fds; i++)
+
+    proc->fd_lock.lock();
+
+    size_t fdnum = oldfd;
+    if (specific == false) fdnum = proc->fdt ? find_free(proc->fdt) : 0;
+
+    fdtable_t *fdt = expand_fdtable(proc, fdnum);
+    if (fdt == nullptr)
     {
-        if (proc->fds[i] == nullptr)
-        {
-            proc->fds[i] = fd;
-            return i;
-        }
+        proc->fd_lock.unlock();
+        return -1;
     }
-    return -1;
+
+    fd_t *old = fdt->fds[fdnum];
+    if (specific == false) fdt->next = fdnum + 1;
+
+    fdt->open[fdnum / 64] |= (1UL << (fdnum % 64));
+    rcu::assign(fdt->fds[fdnum], fd);
+
+    proc->fd_lock.unlock();
+
+    if (old != nullptr) old->unref();
+    return fdnum;
 }
 
 int fdnum_from_res(scheduler::process_t *proc, resource_t *res, int flags, int oldfd, bool specific)
@@ -297,22 +476,20 @@ int fdnum_from_res(scheduler::process_t *proc, resource_t *res, int flags, int o
 fd_t *fd_from_fdnum(scheduler::process_t *proc, int fdnum)
 {
     if (proc == nullptr) proc = this_proc();
-    lockit(proc->fd_lock);
 
-    if (static_cast<uint64_t>(fdnum) >= scheduler::max_fds || fdnum < 0)
-    {
-        errno_set(EBADF);
-        return nullptr;
-    }
+    fd_t *ret = nullptr;
+    uint64_t flags = rcu::read_lock();
 
-    fd_t *ret = static_cast<fd_t*>(proc->fds[fdnum]);
-    if (ret == nullptr)
+    fdtable_t *fdt = rcu::dereference(proc->fdt);
+    if (fdt != nullptr && fdnum >= 0 && static_cast<size_t>(fdnum) < fdt->size)
     {
-        errno_set(EBADF);
-        return nullptr;
+        ret = rcu::dereference(fdt->fds[fdnum]);
+        if (ret != nullptr && ret->ref() == false) ret = nullptr;
     }
 
-    ret->handle->refcount++;
+    rcu::read_unlock(flags);
+
+    if (ret == nullptr) errno_set(EBADF);
     return ret;
 }
 
@@ -347,20 +524,16 @@ int fdnum_dup(scheduler::process_t *oldproc, int oldfdnum, scheduler::process_t
     if (oldfd == nullptr) return -1;
 
     fd_t *newfd = new fd_t;
-    memcpy(newfd, oldfd, sizeof(fd_t));
-
-    int new_fdnum = fdnum_from_fd(newproc, newfd, newfdnum, specific);
-    if (new_fdnum == -1)
-    {
-        oldfd->unref();
-        return -1;
-    }
-
+    newfd->handle = oldfd->handle;
     newfd->flags = flags & file_descriptor_flags_mask;
-    if (cloexec) newfd->flags &= o_cloexec;
+    if (cloexec) newfd->flags |= o_cloexec;
+
+    newfd->handle->ref();
+    newfd->handle->res->refcount++;
+    oldfd->unref();
 
-    oldfd->handle->refcount++;
-    oldfd->handle->res->refcount++;
+    int new_fdnum = fdnum_from_fd(newproc, newfd, newfdnum, specific);
+    if (new_fdnum == -1) newfd->unref();
 
     return new_fdnum;
 }
@@ -369,32 +542,24 @@ bool fdnum_close(scheduler::process_t *proc, int fdnum)
 {
     if (proc == nullptr) proc = this_proc();
 
-    if (static_cast<uint64_t>(fdnum) >= scheduler::max_fds)
-    {
-        errno_set(EBADF);
-        return false;
-    }
+    proc->fd_lock.lock();
 
-    lockit(proc->fd_lock);
-
-    fd_t *fd = static_cast<fd_t*>(proc->fds[fdnum]);
-    if (fd == nullptr)
+    fdtable_t *fdt = proc->fdt;
+    if (fdt == nullptr || fdnum < 0 || static_cast<size_t>(fdnum) >= fdt->size || fdt->fds[fdnum] == nullptr)
     {
+        proc->fd_lock.unlock();
         errno_set(EBADF);
         return false;
     }
 
-    handle_t *handle = fd->handle;
-    resource_t *res = handle->res;
-
-    res->unref(handle);
-    handle->refcount--;
-
-    if (handle->refcount == 0) delete handle;
-    delete fd;
+    fd_t *fd = fdt->fds[fdnum];
+    rcu::assign(fdt->fds[fdnum], static_cast<fd_t*>(nullptr));
+    fdt->open[fdnum / 64] &= ~(1UL << (fdnum % 64));
+    if (static_cast<size_t>(fdnum) < fdt->next) fdt->next = fdnum;
 
-    proc->fds[fdnum] = nullptr;
+    proc->fd_lock.unlock();
 
+    fd->unref();
     return true;
 }
 
@@ -403,6 +568,8 @@ void dump_vfs(fs_node_t *current_node)
     if (current_node == nullptr) return;
 
     current_node = node2reduced(current_node, false);
+    current_node->populate();
+
     for (fs_node_t *node : current_node->children)
     {
         if (node->name == "." || node->name == "..") continue;
@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <system/sched/rcu/rcu.hpp>
 #include <lib/vector.hpp>
 #include <lib/string.hpp>
 #include <lib/errno.hpp>
@@ -94,6 +95,21 @@ enum fcntls
     fd_cloexec = 1
 };
 
+enum pollevents
+{
+    pollin = 0x001,
+    pollpri = 0x002,
+    pollout = 0x004,
+    pollerr = 0x008,
+    pollhup = 0x010,
+    pollnval = 0x020,
+    pollrdnorm = 0x040,
+    pollrdband = 0x080,
+    pollwrnorm = 0x100,
+    pollwrband = 0x200,
+    pollrdhup = 0x2000
+};
+
 struct timespec_t
 {
     int64_t tv_sec;
@@ -155,9 +171,34 @@ struct dirent_t
     char name[1024];
 };
 
+struct iovec_t
+{
+    void *base;
+    size_t len;
+};
+
+static constexpr size_t iov_max = 1024;
+
+static inline size_t iov_length(iovec_t *iov, size_t count)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) total += iov[i].len;
+    return total;
+}
+
 struct resource_t;
 int default_ioctl(void *handle, uint64_t request, void *argp);
 
+struct watch_t
+{
+    void (*callback)(watch_t *watch, int events);
+    void (*release)(watch_t *watch);
+    void *handle;
+    watch_t *next;
+    watch_t *prev;
+    bool watching;
+};
+
 struct resource_t
 {
     stat_t stat;
@@ -165,6 +206,14 @@ struct resource_t
     lock_t lock;
     bool can_mmap;
 
+    lock_t watch_lock;
+    watch_t *watchers = nullptr;
+
+    void watch(watch_t *watch);
+    bool unwatch(watch_t *watch);
+    void notify(int events);
+    void release(void *handle);
+
     virtual int64_t read(void *handle, uint8_t *buffer, uint64_t offset, uint64_t size)
     {
         errno_set(EINVAL);
@@ -175,6 +224,36 @@ struct resource_t
         errno_set(EINVAL);
         return -1;
     }
+    virtual int64_t readv(void *handle, iovec_t *iov, size_t count, uint64_t offset)
+    {
+        int64_t total = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (iov[i].len == 0) continue;
+
+            int64_t ret = this->read(handle, static_cast<uint8_t*>(iov[i].base), offset + total, iov[i].len);
+            if (ret < 0) return total ? total : -1;
+
+            total += ret;
+            if (static_cast<size_t>(ret) < iov[i].len) break;
+        }
+        return total;
+    }
+    virtual int64_t writev(void *handle, iovec_t *iov, size_t count, uint64_t offset)
+    {
+        int64_t total = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (iov[i].len == 0) continue;
+
+            int64_t ret = this->write(handle, static_cast<uint8_t*>(iov[i].base), offset + total, iov[i].len);
+            if (ret < 0) return total ? total : -1;
+
+            total += ret;
+            if (static_cast<size_t>(ret) < iov[i].len) break;
+        }
+        return total;
+    }
     virtual int ioctl(void *handle, uint64_t request, void *argp)
     {
         return default_ioctl(this, request, argp);
@@ -204,6 +283,22 @@ struct resource_t
         errno_set(EINVAL);
         return nullptr;
     }
+    virtual bool sync(void *handle)
+    {
+        return true;
+    }
+    virtual int poll(void *handle)
+    {
+        return pollin | pollout | pollrdnorm | pollwrnorm;
+    }
+};
+
+struct readahead_t
+{
+    lock_t lock;
+    uint64_t prev = -1;
+    uint64_t next = 0;
+    uint64_t size = 0;
 };
 
 struct fs_node_t;
@@ -217,6 +312,7 @@ struct handle_t
     int flags;
     bool dirlist_valid;
     vector<dirent_t*> dirlist;
+    readahead_t ra;
 
     int64_t read(uint8_t *buffer, uint64_t size)
     {
@@ -232,20 +328,74 @@ struct handle_t
         this->offset += ret;
         return ret;
     }
+    int64_t readv(iovec_t *iov, size_t count)
+    {
+        lockit(this->lock);
+        int64_t ret = this->res->readv(this, iov, count, this->offset);
+        if (ret > 0) this->offset += ret;
+        return ret;
+    }
+    int64_t writev(iovec_t *iov, size_t count)
+    {
+        lockit(this->lock);
+        int64_t ret = this->res->writev(this, iov, count, this->offset);
+        if (ret > 0) this->offset += ret;
+        return ret;
+    }
+    int64_t preadv(iovec_t *iov, size_t count, int64_t offset)
+    {
+        return this->res->readv(this, iov, count, offset);
+    }
+    int64_t pwritev(iovec_t *iov, size_t count, int64_t offset)
+    {
+        return this->res->writev(this, iov, count, offset);
+    }
     int ioctl(uint64_t request, void *argp)
     {
         return this->res->ioctl(this, request, argp);
     }
+
+    void ref()
+    {
+        __atomic_add_fetch(&this->refcount, 1, __ATOMIC_RELAXED);
+    }
+    void unref()
+    {
+        if (__atomic_sub_fetch(&this->refcount, 1, __ATOMIC_ACQ_REL) == 0) delete this;
+    }
 };
 
 struct fd_t
 {
     handle_t *handle;
     int flags;
+    int refcount = 1;
+    rcu::head_t rcu;
 
-    void unref()
+    bool ref()
+    {
+        int count = __atomic_load_n(&this->refcount, __ATOMIC_RELAXED);
+        while (count > 0)
+        {
+            if (__atomic_compare_exchange_n(&this->refcount, &count, count + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return true;
+        }
+        return false;
+    }
+    void unref();
+};
+
+struct fdtable_t
+{
+    size_t size;
+    size_t next;
+    fd_t **fds;
+    uint64_t *open;
+    rcu::head_t rcu;
+    fdtable_t *reap_next = nullptr;
+
+    bool test(size_t fdnum)
     {
-        this->handle->refcount--;
+        return this->open[fdnum / 64] & (1UL << (fdnum % 64));
     }
 };
 
@@ -295,8 +445,19 @@ struct fs_node_t
     fs_node_t *parent;
     vector<fs_node_t*> children;
     fs_node_t *redir;
+    lock_t populate_lock;
+    bool populated = false;
 
     void dotentries(fs_node_t *parent);
+    void populate()
+    {
+        if (__atomic_load_n(&this->populated, __ATOMIC_ACQUIRE) || this->fs == nullptr) return;
+
+        lockit(this->populate_lock);
+        if (this->populated) return;
+        this->fs->populate(this);
+        __atomic_store_n(&this->populated, true, __ATOMIC_RELEASE);
+    }
 };
 
 extern bool initialised;
@@ -336,6 +497,9 @@ fd_t *fd_from_res(resource_t *res, int flags);
 int fdnum_dup(scheduler::process_t *oldproc, int oldfdnum, scheduler::process_t *newproc, int newfdnum, int flags, bool specific, bool cloexec);
 bool fdnum_close(scheduler::process_t *proc, int fdnum);
 
+fdtable_t *new_fdtable(size_t size);
+void free_fdtable(fdtable_t *fdt);
+
 void dump_vfs(fs_node_t *current_node = fs_root);
 
 void init();
@@ -366,6 +530,7 @@ static inline auto path2node(fs_node_t *parent, std::string path)
         if (seg == lastseg) last = true;
 
         curr_node = node2reduced(curr_node, false);
+        curr_node->populate();
 
         for (fs_node_t *child : curr_node->children)
         {